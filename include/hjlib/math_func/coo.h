@@ -1,12 +1,19 @@
 #ifndef HJ_MATH_FUNC_COO_H_
 #define HJ_MATH_FUNC_COO_H_
 
+#include <cassert>
+#include <cstddef>
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <atomic>
 
 #include "config.h"
 
+#if HJ_MATH_FUNC_USE_OMP && defined(_OPENMP)
+#  include <omp.h>
+#endif
+
 namespace hj { namespace math_func {
 
 //! @brief
@@ -18,21 +25,193 @@ inline size_t powi(size_t base, size_t pow) {
   return rtn;
 }
 
-//! c is dim major. TODO: put the requirement to function.
+inline int coo_threads(void) {
+#if HJ_MATH_FUNC_USE_OMP && defined(_OPENMP)
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+//! @brief stable LSD radix sort of the low bits of key, 11 bits a
+//! pass, each thread counts and scatters its own chunk
+template <typename K>
+void radix_sort_keys(std::vector<K> &key, int bits)
+{
+  const int RB = 11, R = 1 << RB;
+  const size_t n = key.size();
+  const int nt = (n < 65536) ? 1 : coo_threads();
+  std::vector<K> tmp(n);
+  std::vector<size_t> cnt(size_t(nt)*R);
+  for(int shift = 0; shift < bits; shift += RB) {
+    const K *in = n ? &key[0] : 0;
+    K *out = n ? &tmp[0] : 0;
+    std::fill(cnt.begin(), cnt.end(), 0);
+    int t;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(t) schedule(static, 1) if(nt > 1)
+#endif
+    for(t = 0; t < nt; ++t) {
+      size_t *ct = &cnt[size_t(t)*R];
+      for(size_t i = n*t/nt; i < n*(t+1)/nt; ++i)
+        ++ct[(in[i] >> shift) & (R-1)];
+    }
+    size_t sum = 0;
+    for(int b = 0; b < R; ++b)
+      for(int t2 = 0; t2 < nt; ++t2) {
+        const size_t c = cnt[size_t(t2)*R+b];
+        cnt[size_t(t2)*R+b] = sum;
+        sum += c;
+      }
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(t) schedule(static, 1) if(nt > 1)
+#endif
+    for(t = 0; t < nt; ++t) {
+      size_t *ct = &cnt[size_t(t)*R];
+      for(size_t i = n*t/nt; i < n*(t+1)/nt; ++i)
+        out[ct[(in[i] >> shift) & (R-1)]++] = in[i];
+    }
+    key.swap(tmp);
+  }
+}
+
+//! @brief remove the adjacent duplicates of sorted key in parallel
+template <typename K>
+void unique_keys(std::vector<K> &key)
+{
+  const size_t n = key.size();
+  const int nt = (n < 65536) ? 1 : coo_threads();
+  std::vector<size_t> beg(nt+1, 0);
+  int t;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(t) schedule(static, 1) if(nt > 1)
+#endif
+  for(t = 0; t < nt; ++t)
+    for(size_t i = n*t/nt; i < n*(t+1)/nt; ++i)
+      beg[t+1] += (i == 0 || key[i] != key[i-1]);
+  for(t = 0; t < nt; ++t) beg[t+1] += beg[t];
+  std::vector<K> u(beg[nt]);
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(t) schedule(static, 1) if(nt > 1)
+#endif
+  for(t = 0; t < nt; ++t) {
+    size_t o = beg[t];
+    for(size_t i = n*t/nt; i < n*(t+1)/nt; ++i)
+      if(i == 0 || key[i] != key[i-1]) u[o++] = key[i];
+  }
+  key.swap(u);
+}
+
 template <typename T>
-void pack_coo(size_t num, size_t dim, const T *c, std::vector<std::vector<T> > &pc)
+struct coo_less {
+  coo_less(size_t dim, const T *c):dim_(dim), c_(c) {}
+  bool operator()(size_t a, size_t b) const {
+    return std::lexicographical_compare(c_+a*dim_, c_+a*dim_+dim_, c_+b*dim_, c_+b*dim_+dim_);
+  }
+  bool equal(size_t a, size_t b) const {
+    return std::equal(c_+a*dim_, c_+a*dim_+dim_, c_+b*dim_);
+  }
+  size_t dim_;
+  const T *c_;
+};
+
+//! @brief sort and unique the num coordinates in c, c[ni*dim+d].
+//! @param pc: the unique coordinates, dim major, pc[d*nnz+i]
+//! @return nnz
+//!
+//! The coordinates are mixed radix keys of 64 bits sorted by
+//! radix_sort_keys, only coordinates which do not fit fall back to a
+//! comparison sort.
+template <typename T>
+size_t pack_coo(size_t num, size_t dim, const T *c, std::vector<T> &pc)
 {
   using namespace std;
-  pc.resize(num); {
-    size_t ni;
-#if HJ_FUNC_USE_OMP
-#pragma omp parallel for private(ni)
+  typedef unsigned long long key_type;
+  // the radix of each dimension, from the largest of each thread
+  const int nt = (num < 65536) ? 1 : coo_threads();
+  vector<T> lo(nt*dim, 0), hi(nt*dim, 0);
+  int t;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(t) schedule(static, 1) if(nt > 1)
 #endif
-    for(ni = 0; ni < num; ++ni)
-      pc[ni].insert(pc[ni].begin(), c+ni*dim, c+ni*dim+dim);
-    sort(pc.begin(), pc.end());
-    typename vector<vector<T> >::iterator pos = unique(pc.begin(), pc.end());
-    pc.erase(pos, pc.end());
+  for(t = 0; t < nt; ++t)
+    for(size_t ni = num*t/nt; ni < num*(t+1)/nt; ++ni)
+      for(size_t d = 0; d < dim; ++d) {
+        lo[t*dim+d] = min(lo[t*dim+d], c[ni*dim+d]);
+        hi[t*dim+d] = max(hi[t*dim+d], c[ni*dim+d]);
+      }
+  vector<key_type> radix(dim, 1);
+  bool fit = true;
+  for(size_t d = 0; d < dim; ++d)
+    for(t = 0; t < nt; ++t) {
+      if(lo[t*dim+d] < 0) fit = false;
+      radix[d] = max(radix[d], key_type(hi[t*dim+d])+1);
+    }
+  key_type range = 1;
+  for(size_t d = 0; d < dim && fit; ++d) {
+    if(range > (~key_type(0))/radix[d]) fit = false;
+    else range *= radix[d];
+  }
+
+  size_t nnz = 0;
+  if(fit) {
+    vector<key_type> key(num);
+    ptrdiff_t ni;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(ni) if(num >= 65536)
+#endif
+    for(ni = 0; ni < ptrdiff_t(num); ++ni) {
+      key_type k = c[ni*dim];
+      for(size_t d = 1; d < dim; ++d)
+        k = k*radix[d]+c[ni*dim+d];
+      key[ni] = k;
+    }
+    int bits = 0;
+    while(bits < 64 && (range-1) >> bits) ++bits;
+    radix_sort_keys(key, bits);
+    unique_keys(key);
+    nnz = key.size();
+    pc.resize(nnz*dim);
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(ni) if(nnz >= 65536)
+#endif
+    for(ni = 0; ni < ptrdiff_t(nnz); ++ni) {
+      key_type k = key[ni];
+      for(size_t d = dim-1; d > 0; --d) {
+        pc[d*nnz+ni] = T(k%radix[d]);
+        k /= radix[d];
+      }
+      pc[ni] = T(k);
+    }
+  }
+  else {
+    vector<size_t> order(num);
+    for(size_t ni = 0; ni < num; ++ni) order[ni] = ni;
+    const coo_less<T> less(dim, c);
+    sort(order.begin(), order.end(), less);
+    size_t u = 0;
+    for(size_t i = 0; i < num; ++i)
+      if(i == 0 || !less.equal(order[i], order[u-1])) order[u++] = order[i];
+    nnz = u;
+    pc.resize(nnz*dim);
+    for(size_t i = 0; i < nnz; ++i)
+      for(size_t d = 0; d < dim; ++d)
+        pc[d*nnz+i] = c[order[i]*dim+d];
+  }
+  return nnz;
+}
+
+//! c is dim major. TODO: put the requirement to function.
+template <typename T>
+void pack_coo(size_t num, size_t dim, const T *c, std::vector<std::vector<T> > &pc)
+{
+  std::vector<T> flat;
+  const size_t nnz = pack_coo(num, dim, c, flat);
+  pc.resize(nnz);
+  for(size_t ni = 0; ni < nnz; ++ni) {
+    pc[ni].resize(dim);
+    for(size_t d = 0; d < dim; ++d)
+      pc[ni][d] = flat[d*nnz+ni];
   }
 }
 
@@ -74,10 +253,10 @@ public:
     switch(format_) {
     case 'D': return new coo_pat_dense<INT>(dim(), nf(), nx());
     case 'S': {
-      std::vector<std::vector<INT> > pc;
-      pack_coo(coo_num(), dim(), &coos_[0], pc);
+      std::vector<INT> pc;
+      const size_t nnz = pack_coo(coo_num(), dim(), coos_.empty() ? 0 : &coos_[0], pc);
       coo_pat_dense<INT> cpd(dim()-1, nf(), nx());
-      if(dim() > 1 && cpd.nnz() < pc.size())
+      if(dim() > 1 && cpd.nnz() < nnz)
         return new coo_pat_csc<INT>(dim(), nf(), nx(), pc);
       //      std::cout << "use coo: " << pc.size() << " " << cpd.nnz() << std::endl;
       return new coo_pat_coo<INT>(dim(), nf(), nx(), pc);
@@ -102,12 +281,22 @@ private:
 template <typename INT> class coo_pat_dense;
 template <typename INT> class coo_pat_coo;
 
+//! @brief a number never given twice (until it wraps after 2^32), 0
+//! is not used
+inline unsigned int coo_pat_next_serial(void) {
+  static std::atomic<unsigned int> next(0);
+  unsigned int s;
+  while((s = ++next) == 0);
+  return s;
+}
+
 template <typename INT>
 class coo_pat
 {
 public:
   coo_pat(size_t dim, size_t nf, size_t nx, char format)
-    :dim_(dim), nf_(nf), nx_(nx), format_(format), d_(0), s_(0), p_(0) {
+    :dim_(dim), nf_(nf), nx_(nx), format_(format), serial_(coo_pat_next_serial()),
+     d_(0), s_(0), p_(0) {
     switch(format_) {
     case 'D': d_ = static_cast<const coo_pat_dense<INT> *>(this); break;
     case 'S': s_ = static_cast<const coo_pat_coo<INT> *>(this); break;
@@ -120,6 +309,8 @@ public:
   inline size_t dim(void) const { return dim_; }
   inline size_t nf(void) const { return nf_; }
   inline size_t nx(void) const { return nx_; }
+  //! @brief tells the pattern from a later one at the same address
+  inline size_t serial(void) const { return serial_; }
   inline size_t operator()(const INT *coo) const {
     switch(format_) {
     case 'D': return (*d_)(coo);
@@ -142,6 +333,8 @@ protected:
   const size_t dim_, nf_, nx_;
   size_t nnz_;
   const char format_;
+  // in the padding after format_, the layout stays the same
+  const unsigned int serial_;
   const coo_pat_dense<INT> *d_;
   const coo_pat_coo<INT> *s_;
   const coo_pat_csc<INT> *p_;
@@ -192,6 +385,12 @@ public:
     }
     nnz_ = pc.size();
   }
+  //! @param pc: the dim major coordinates of pack_coo, taken over
+  coo_pat_coo(size_t dim, size_t nf, size_t nx, std::vector<INT> &pc)
+    :coo_pat<INT>(dim, nf, nx, 'S') {
+    nnz_ = pc.size()/dim;
+    coos_.swap(pc);
+  }
   inline size_t operator()(const INT *coo) const {
     size_t beg = 0, end = nnz();
     const INT *ptr = &coos_[0];
@@ -260,6 +459,27 @@ public:
 
 #endif
   }
+  //! @param pc: the dim major coordinates of pack_coo, taken over
+  coo_pat_csc(size_t dim, size_t nf, size_t nx, std::vector<INT> &pc)
+    :coo_pat<INT>(dim, nf, nx, 'P'),
+     ptr_addr_(dim-1, nf, nx) {
+    assert(dim > 1);
+    const size_t nnz = pc.size()/dim;
+    nnz_ = nnz;
+    ptr_.resize(ptr_addr_.nnz()+1);
+    // ptr_[pa] is the first coordinate of address pa or larger
+    ptrdiff_t i;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(i) if(nnz >= 65536)
+#endif
+    for(i = 0; i <= ptrdiff_t(nnz); ++i) {
+      const ptrdiff_t pa = (i < ptrdiff_t(nnz)) ? address(pc, nnz, i) : ptrdiff_t(ptr_.size()-1);
+      for(ptrdiff_t p = (i ? address(pc, nnz, i-1)+1 : 0); p <= pa; ++p)
+        ptr_[p] = INT(i);
+    }
+    pc.erase(pc.begin(), pc.begin()+(dim-1)*nnz);
+    coos_.swap(pc);
+  }
   inline size_t operator()(const INT *coo) const {
     const size_t pa = ptr_addr_(coo);
     size_t beg = ptr_[pa], end = ptr_[pa+1];
@@ -277,6 +497,13 @@ public:
     return coo;
   }
 private:
+  //! the address in ptr_addr_ of coordinate i in pc of pack_coo
+  ptrdiff_t address(const std::vector<INT> &pc, size_t nnz, size_t i) const {
+    ptrdiff_t a = pc[i];
+    for(size_t d = 1; d+1 < dim(); ++d)
+      a = a*ptrdiff_t(this->nx())+pc[d*nnz+i];
+    return a;
+  }
   coo_pat_dense<INT> ptr_addr_;
   std::vector<INT> ptr_;
   std::vector<INT> coos_;
@@ -307,6 +534,12 @@ public:
   inline val_type &operator[](int_type *coo) const {
     return val_[addr(coo)];
   }
+  //! @brief offset of coo in val(), NOTICE: coo will be changed
+  inline size_t offset(int_type *coo) const {
+    return addr(coo);
+  }
+  inline val_type *val(void) const { return val_; }
+  inline const coo_pat<int_type> &pat(void) const { return cp_; }
 private:
   inline size_t addr(int_type *coo) const {
     coo[0] += f_base();
@@ -324,6 +557,72 @@ coo2val(const coo_pat<INT_TYPE> &cp, VAL_TYPE *val, size_t f_base = 0) {
   return coo2val_t<VAL_TYPE, INT_TYPE>(cp, val, f_base);
 }
 
+//! @brief offsets in the val of a destination coo2val_t of a fixed
+//! sequence of local coordinates, so that eval writes val[off[i]]
+//! instead of looking every coordinate up in the pattern.
+//!
+//! The map is bound to the pattern and f_base it was built for, use
+//! match to tell whether it can be used for another coo2val_t.
+template <typename INT_TYPE>
+class coo_scatter
+{
+public:
+  typedef INT_TYPE int_type;
+
+  //! @param coo num local coordinates of dim integers each, in the
+  //! order eval writes them
+  template <typename VAL_TYPE>
+  coo_scatter(const coo2val_t<VAL_TYPE, INT_TYPE> &cv,
+              size_t dim, size_t num, const int_type *coo)
+    :cp_(&cv.pat()), f_base_(cv.f_base()), serial_(cv.pat().serial()), off_(num), ends_(2*dim) {
+    std::vector<int_type> c(dim);
+    for(size_t i = 0; i < num; ++i, coo += dim) {
+      std::copy(coo, coo+dim, c.begin());
+      off_[i] = cv.offset(&c[0]);
+      if(i == 0)
+        std::copy(c.begin(), c.end(), ends_.begin());
+      if(i+1 == num)
+        std::copy(c.begin(), c.end(), ends_.begin()+dim);
+    }
+    shape(cv.pat(), shape_);
+  }
+
+  //! the serial number tells a released pattern from a new one
+  //! allocated at its address
+  template <typename VAL_TYPE>
+  bool match(const coo2val_t<VAL_TYPE, INT_TYPE> &cv) const {
+    size_t s[4];
+    if(&cv.pat() != cp_ || cv.pat().serial() != serial_ || cv.f_base() != f_base_
+       || !std::equal(s, shape(cv.pat(), s), shape_))
+      return false;
+    assert(off_.empty() || (check(off_.front(), &ends_[0])
+                            && check(off_.back(), &ends_[ends_.size()/2])));
+    return true;
+  }
+
+  inline size_t serial(void) const { return serial_; }
+  inline size_t size(void) const { return off_.size(); }
+  inline size_t operator[](size_t i) const { return off_[i]; }
+  inline const size_t *begin(void) const { return off_.empty()?0:&off_[0]; }
+private:
+  static size_t *shape(const coo_pat<int_type> &cp, size_t *s) {
+    s[0] = cp.nnz(); s[1] = cp.dim(); s[2] = cp.nf(); s[3] = cp.nx();
+    return s+4;
+  }
+  bool check(size_t off, const int_type *expect) const {
+    const size_t dim = ends_.size()/2;
+    int_type buf[4];
+    std::vector<int_type> heap(dim > 4 ? dim : 0);
+    int_type *c = (dim > 4) ? &heap[0] : buf;
+    (*cp_)(off, c);
+    return std::equal(c, c+dim, expect);
+  }
+  const coo_pat<int_type> *cp_;
+  size_t f_base_, serial_, shape_[4];
+  std::vector<size_t> off_;
+  std::vector<int_type> ends_; // global coordinates of the first and last entry
+};
+
 class coo_l2g : public coo_map {
 public:
   coo_l2g(size_t f_base = 0)
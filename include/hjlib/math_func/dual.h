@@ -0,0 +1,475 @@
+#ifndef HJ_MATH_FUNC_DUAL_H_
+#define HJ_MATH_FUNC_DUAL_H_
+
+#include <cmath>
+
+#include "math_func.h"
+
+//! forward mode automatic differentiation on small dense stencils.
+//! Write the function once as a template on its scalar type:
+//!
+//!   template <typename T> int operator()(const T *x, T *f) const;
+//!
+//! with "using std::sqrt;" etc. and unqualified calls, then T = dual
+//! gives the gradient and T = hyper_dual the gradient and Hessian, in
+//! one pass.  The derivative parts are fixed size arrays, no heap.
+//! ad_func makes such a function a math_func_t, and ad_kernel makes
+//! an element energy the KERNEL of element_sum.
+
+// the loops over the N derivatives are unrolled also at -O2, which
+// keeps small duals in registers
+#if defined(__clang__)
+#  define HJ_MATH_FUNC_DUAL_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#  define HJ_MATH_FUNC_DUAL_UNROLL _Pragma("GCC unroll 32")
+#else
+#  define HJ_MATH_FUNC_DUAL_UNROLL
+#endif
+
+namespace hj { namespace math_func {
+
+//! @brief value and gradient w.r.t. N variables
+template <typename T, int N>
+class dual
+{
+public:
+  typedef T val_type;
+  enum { size = N };
+
+  dual(const T &v = T(0)):v(v) {
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] = 0;
+  }
+  //! @brief the i-th of the N variables
+  static dual var(const T &v, int i) {
+    dual r(v);
+    r.g[i] = 1;
+    return r;
+  }
+
+  //! @brief f(a), f1 = f'(a.v)
+  static dual chain(const dual &a, const T &f0, const T &f1) {
+    dual r((no_init()));
+    r.v = f0;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) r.g[i] = f1*a.g[i];
+    return r;
+  }
+  //! @brief f(a, b), fa and fb the partials at (a.v, b.v)
+  static dual chain(const dual &a, const dual &b, const T &f0,
+                    const T &fa, const T &fb) {
+    dual r((no_init()));
+    r.v = f0;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) r.g[i] = fa*a.g[i]+fb*b.g[i];
+    return r;
+  }
+
+  friend dual operator - (const dual &a) { dual r(a); r *= T(-1); return r; }
+  friend dual operator + (const dual &a, const dual &b) { dual r(a); r += b; return r; }
+  friend dual operator - (const dual &a, const dual &b) { dual r(a); r -= b; return r; }
+  friend dual operator * (const dual &a, const dual &b) { return chain(a, b, a.v*b.v, b.v, a.v); }
+  friend dual operator / (const dual &a, const dual &b) {
+    const T ib = T(1)/b.v, r = a.v*ib;
+    return chain(a, b, r, ib, -r*ib);
+  }
+  friend dual operator + (const dual &a, const T &c) { dual r(a); r.v += c; return r; }
+  friend dual operator + (const T &c, const dual &a) { dual r(a); r.v += c; return r; }
+  friend dual operator - (const dual &a, const T &c) { dual r(a); r.v -= c; return r; }
+  friend dual operator - (const T &c, const dual &a) { return chain(a, c-a.v, T(-1)); }
+  friend dual operator * (const dual &a, const T &c) { dual r(a); r *= c; return r; }
+  friend dual operator * (const T &c, const dual &a) { dual r(a); r *= c; return r; }
+  friend dual operator / (const dual &a, const T &c) { dual r(a); r /= c; return r; }
+  friend dual operator / (const T &c, const dual &a) {
+    const T ia = T(1)/a.v, r = c*ia;
+    return chain(a, r, -r*ia);
+  }
+
+  dual &operator += (const dual &b) {
+    v += b.v;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] += b.g[i];
+    return *this;
+  }
+  dual &operator -= (const dual &b) {
+    v -= b.v;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] -= b.g[i];
+    return *this;
+  }
+  dual &operator += (const T &c) { v += c; return *this; }
+  dual &operator -= (const T &c) { v -= c; return *this; }
+  dual &operator *= (const T &c) {
+    v *= c;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] *= c;
+    return *this;
+  }
+  dual &operator /= (const T &c) { return *this *= T(1)/c; }
+  dual &operator *= (const dual &b) { return *this = *this * b; }
+  dual &operator /= (const dual &b) { return *this = *this / b; }
+
+#define HJ_MATH_FUNC_DUAL_COMPARE(OP)                                   \
+  friend bool operator OP (const dual &a, const dual &b) { return a.v OP b.v; } \
+  friend bool operator OP (const dual &a, const T &b) { return a.v OP b; } \
+  friend bool operator OP (const T &a, const dual &b) { return a OP b.v; }
+  HJ_MATH_FUNC_DUAL_COMPARE(<)
+  HJ_MATH_FUNC_DUAL_COMPARE(>)
+  HJ_MATH_FUNC_DUAL_COMPARE(<=)
+  HJ_MATH_FUNC_DUAL_COMPARE(>=)
+  HJ_MATH_FUNC_DUAL_COMPARE(==)
+  HJ_MATH_FUNC_DUAL_COMPARE(!=)
+#undef HJ_MATH_FUNC_DUAL_COMPARE
+
+  T v, g[N];
+private:
+  struct no_init {};
+  explicit dual(const no_init &) {}
+};
+
+//! @brief value, gradient and Hessian w.r.t. N variables, the
+//! Hessian is symmetric and keeps the upper triangle column by
+//! column, see hess(i, j).  The variables, constants and their
+//! linear combinations have lin set and h unset, which skips the
+//! O(N^2) part of most of the first operations of a function.
+template <typename T, int N>
+class hyper_dual
+{
+public:
+  typedef T val_type;
+  enum { size = N, hess_size = N*(N+1)/2 };
+
+  hyper_dual(const T &v = T(0)):v(v), lin(true) {
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] = 0;
+  }
+  hyper_dual(const hyper_dual &a) {
+    *this = a;
+  }
+  hyper_dual &operator = (const hyper_dual &a) {
+    v = a.v;
+    std::copy(a.g, a.g+N, g);
+    if(!a.lin)
+      std::copy(a.h, a.h+hess_size, h);
+    lin = a.lin;
+    return *this;
+  }
+  //! @brief the i-th of the N variables
+  static hyper_dual var(const T &v, int i) {
+    hyper_dual r(v);
+    r.g[i] = 1;
+    return r;
+  }
+
+  T hess(int i, int j) const {
+    if(lin) return T(0);
+    return (i <= j) ? h[j*(j+1)/2+i] : h[i*(i+1)/2+j];
+  }
+
+  //! @brief f(a), f1 and f2 the first and second derivatives at a.v
+  static hyper_dual chain(const hyper_dual &a, const T &f0, const T &f1, const T &f2) {
+    hyper_dual r((no_init()));
+    r.v = f0;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) r.g[i] = f1*a.g[i];
+    r.lin = a.lin && f2 == 0;
+    if(r.lin)
+      return r;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int j = 0, k = 0; j < N; ++j) {
+      const T f2g = f2*a.g[j];
+      if(a.lin) {
+        for(int i = 0; i <= j; ++i, ++k)
+          r.h[k] = f2g*a.g[i];
+      }
+      else {
+        for(int i = 0; i <= j; ++i, ++k)
+          r.h[k] = f1*a.h[k]+f2g*a.g[i];
+      }
+    }
+    return r;
+  }
+  //! @brief f(a, b), with the first and second partials at (a.v, b.v)
+  static hyper_dual chain(const hyper_dual &a, const hyper_dual &b, const T &f0,
+                          const T &fa, const T &fb,
+                          const T &faa, const T &fab, const T &fbb) {
+    hyper_dual r((no_init()));
+    r.v = f0;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) r.g[i] = fa*a.g[i]+fb*b.g[i];
+    r.lin = a.lin && b.lin && faa == 0 && fab == 0 && fbb == 0;
+    if(r.lin)
+      return r;
+    if(a.lin) {
+      if(b.lin) chain_hess<false, false>(r, a, b, fa, fb, faa, fab, fbb);
+      else chain_hess<false, true>(r, a, b, fa, fb, faa, fab, fbb);
+    }
+    else {
+      if(b.lin) chain_hess<true, false>(r, a, b, fa, fb, faa, fab, fbb);
+      else chain_hess<true, true>(r, a, b, fa, fb, faa, fab, fbb);
+    }
+    return r;
+  }
+
+  hyper_dual &operator += (const hyper_dual &b) { return add(b, T(1)); }
+  hyper_dual &operator -= (const hyper_dual &b) { return add(b, T(-1)); }
+  hyper_dual &operator += (const T &c) { v += c; return *this; }
+  hyper_dual &operator -= (const T &c) { v -= c; return *this; }
+  hyper_dual &operator *= (const T &c) {
+    v *= c;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] *= c;
+    if(!lin)
+      HJ_MATH_FUNC_DUAL_UNROLL for(int k = 0; k < hess_size; ++k) h[k] *= c;
+    return *this;
+  }
+  hyper_dual &operator /= (const T &c) { return *this *= T(1)/c; }
+  hyper_dual &operator *= (const hyper_dual &b) { return *this = *this * b; }
+  hyper_dual &operator /= (const hyper_dual &b) { return *this = *this / b; }
+
+  friend hyper_dual operator - (const hyper_dual &a) { hyper_dual r(a); r *= T(-1); return r; }
+  friend hyper_dual operator + (const hyper_dual &a, const hyper_dual &b) { hyper_dual r(a); r += b; return r; }
+  friend hyper_dual operator - (const hyper_dual &a, const hyper_dual &b) { hyper_dual r(a); r -= b; return r; }
+  friend hyper_dual operator * (const hyper_dual &a, const hyper_dual &b) {
+    return chain(a, b, a.v*b.v, b.v, a.v, T(0), T(1), T(0));
+  }
+  friend hyper_dual operator / (const hyper_dual &a, const hyper_dual &b) {
+    const T ib = T(1)/b.v, r = a.v*ib;
+    return chain(a, b, r, ib, -r*ib, T(0), -ib*ib, 2*r*ib*ib);
+  }
+  friend hyper_dual operator + (const hyper_dual &a, const T &c) { hyper_dual r(a); r.v += c; return r; }
+  friend hyper_dual operator + (const T &c, const hyper_dual &a) { hyper_dual r(a); r.v += c; return r; }
+  friend hyper_dual operator - (const hyper_dual &a, const T &c) { hyper_dual r(a); r.v -= c; return r; }
+  friend hyper_dual operator - (const T &c, const hyper_dual &a) { hyper_dual r(-a); r.v += c; return r; }
+  friend hyper_dual operator * (const hyper_dual &a, const T &c) { hyper_dual r(a); r *= c; return r; }
+  friend hyper_dual operator * (const T &c, const hyper_dual &a) { hyper_dual r(a); r *= c; return r; }
+  friend hyper_dual operator / (const hyper_dual &a, const T &c) { hyper_dual r(a); r /= c; return r; }
+  friend hyper_dual operator / (const T &c, const hyper_dual &a) {
+    const T ia = T(1)/a.v, r = c*ia;
+    return chain(a, r, -r*ia, 2*r*ia*ia);
+  }
+
+#define HJ_MATH_FUNC_DUAL_COMPARE(OP)                                   \
+  friend bool operator OP (const hyper_dual &a, const hyper_dual &b) { return a.v OP b.v; } \
+  friend bool operator OP (const hyper_dual &a, const T &b) { return a.v OP b; } \
+  friend bool operator OP (const T &a, const hyper_dual &b) { return a OP b.v; }
+  HJ_MATH_FUNC_DUAL_COMPARE(<)
+  HJ_MATH_FUNC_DUAL_COMPARE(>)
+  HJ_MATH_FUNC_DUAL_COMPARE(<=)
+  HJ_MATH_FUNC_DUAL_COMPARE(>=)
+  HJ_MATH_FUNC_DUAL_COMPARE(==)
+  HJ_MATH_FUNC_DUAL_COMPARE(!=)
+#undef HJ_MATH_FUNC_DUAL_COMPARE
+
+  T v, g[N], h[hess_size]; // h is 0 and not set when lin
+  bool lin;
+private:
+  struct no_init {};
+  explicit hyper_dual(const no_init &) {}
+
+  //! @brief *this += s*b
+  hyper_dual &add(const hyper_dual &b, const T &s) {
+    v += s*b.v;
+    HJ_MATH_FUNC_DUAL_UNROLL for(int i = 0; i < N; ++i) g[i] += s*b.g[i];
+    if(b.lin)
+      return *this;
+    if(lin) {
+      HJ_MATH_FUNC_DUAL_UNROLL for(int k = 0; k < hess_size; ++k) h[k] = s*b.h[k];
+      lin = false;
+    }
+    else {
+      HJ_MATH_FUNC_DUAL_UNROLL for(int k = 0; k < hess_size; ++k) h[k] += s*b.h[k];
+    }
+    return *this;
+  }
+  template <bool HA, bool HB>
+  static void chain_hess(hyper_dual &r, const hyper_dual &a, const hyper_dual &b,
+                         const T &fa, const T &fb,
+                         const T &faa, const T &fab, const T &fbb) {
+    HJ_MATH_FUNC_DUAL_UNROLL for(int j = 0, k = 0; j < N; ++j) {
+      const T sa = faa*a.g[j]+fab*b.g[j], sb = fab*a.g[j]+fbb*b.g[j];
+      for(int i = 0; i <= j; ++i, ++k) {
+        T hk = sa*a.g[i]+sb*b.g[i];
+        if(HA) hk += fa*a.h[k];
+        if(HB) hk += fb*b.h[k];
+        r.h[k] = hk;
+      }
+    }
+  }
+};
+
+//! @brief the value part, for branches and output
+template <typename T>
+inline const T &value(const T &a) { return a; }
+template <typename T, int N>
+inline const T &value(const dual<T, N> &a) { return a.v; }
+template <typename T, int N>
+inline const T &value(const hyper_dual<T, N> &a) { return a.v; }
+
+// F0, F1 and F2 are f, f' and f'' in terms of x = a.v and f0 = F0
+#define HJ_MATH_FUNC_DUAL_UNARY(NAME, F0, F1, F2)                       \
+  template <typename T, int N>                                          \
+  inline dual<T, N> NAME(const dual<T, N> &a) {                         \
+    const T &x = a.v, f0 = F0;                                          \
+    return dual<T, N>::chain(a, f0, F1);                                \
+  }                                                                     \
+  template <typename T, int N>                                          \
+  inline hyper_dual<T, N> NAME(const hyper_dual<T, N> &a) {             \
+    const T &x = a.v, f0 = F0;                                          \
+    return hyper_dual<T, N>::chain(a, f0, F1, F2);                      \
+  }
+
+HJ_MATH_FUNC_DUAL_UNARY(sqrt, std::sqrt(x), T(0.5)/f0, T(-0.25)/(f0*x))
+HJ_MATH_FUNC_DUAL_UNARY(exp, std::exp(x), f0, f0)
+HJ_MATH_FUNC_DUAL_UNARY(log, std::log(x), T(1)/x, T(-1)/(x*x))
+HJ_MATH_FUNC_DUAL_UNARY(sin, std::sin(x), std::cos(x), -f0)
+HJ_MATH_FUNC_DUAL_UNARY(cos, std::cos(x), -std::sin(x), -f0)
+HJ_MATH_FUNC_DUAL_UNARY(tan, std::tan(x), 1+f0*f0, 2*f0*(1+f0*f0))
+HJ_MATH_FUNC_DUAL_UNARY(asin, std::asin(x), T(1)/std::sqrt(1-x*x), x/((1-x*x)*std::sqrt(1-x*x)))
+HJ_MATH_FUNC_DUAL_UNARY(acos, std::acos(x), T(-1)/std::sqrt(1-x*x), -x/((1-x*x)*std::sqrt(1-x*x)))
+HJ_MATH_FUNC_DUAL_UNARY(atan, std::atan(x), T(1)/(1+x*x), -2*x/((1+x*x)*(1+x*x)))
+HJ_MATH_FUNC_DUAL_UNARY(fabs, std::fabs(x), T(x < 0 ? -1 : 1), T(0))
+HJ_MATH_FUNC_DUAL_UNARY(abs, std::fabs(x), T(x < 0 ? -1 : 1), T(0))
+
+#undef HJ_MATH_FUNC_DUAL_UNARY
+
+template <typename T, int N>
+inline dual<T, N> pow(const dual<T, N> &a, const typename dual<T, N>::val_type &p) {
+  const T f1 = p*std::pow(a.v, p-1);
+  return dual<T, N>::chain(a, std::pow(a.v, p), f1);
+}
+template <typename T, int N>
+inline hyper_dual<T, N> pow(const hyper_dual<T, N> &a, const typename hyper_dual<T, N>::val_type &p) {
+  const T f2 = p*(p-1)*std::pow(a.v, p-2);
+  return hyper_dual<T, N>::chain(a, std::pow(a.v, p), p*std::pow(a.v, p-1), f2);
+}
+template <typename T, int N>
+inline dual<T, N> atan2(const dual<T, N> &y, const dual<T, N> &x) {
+  const T ir2 = T(1)/(x.v*x.v+y.v*y.v);
+  return dual<T, N>::chain(y, x, std::atan2(y.v, x.v), x.v*ir2, -y.v*ir2);
+}
+template <typename T, int N>
+inline hyper_dual<T, N> atan2(const hyper_dual<T, N> &y, const hyper_dual<T, N> &x) {
+  const T ir2 = T(1)/(x.v*x.v+y.v*y.v), ir4 = ir2*ir2;
+  return hyper_dual<T, N>::chain(y, x, std::atan2(y.v, x.v), x.v*ir2, -y.v*ir2,
+                                 -2*x.v*y.v*ir4, (y.v*y.v-x.v*x.v)*ir4, 2*x.v*y.v*ir4);
+}
+
+//! @brief dense math_func_t from FUNC, which evaluates f[NF] at x[NX] by
+//!   template <typename T> int operator()(const T *x, T *f) const;
+//! with nonzero return for failure.
+// -> DDD
+template <typename FUNC, int NX, int NF, typename VAL_TYPE = double, typename INT_TYPE = int32_t>
+class ad_func : public math_func_t<VAL_TYPE, INT_TYPE>
+{
+public:
+	typedef VAL_TYPE val_type;
+	typedef INT_TYPE int_type;
+
+  ad_func(const FUNC &func = FUNC())
+    :func_(func) {
+  }
+
+	virtual size_t nx(void) const {
+		return NX;
+	}
+	virtual size_t nf(void) const {
+		return NF;
+	}
+  virtual int eval(size_t k, const val_type *x,
+                   const coo2val_t<val_type, int_type> &cv,
+                   func_ctx *ctx = 0) const {
+    if(k == 0) {
+      val_type f[NF];
+      if(func_(x, f))
+        return __LINE__;
+      for(int_type fi = 0; fi < NF; ++fi) {
+        int_type c[] = {fi};
+        cv[c] += f[fi];
+      }
+      return 0;
+    }
+    if(k == 1) {
+      dual<val_type, NX> xd[NX], f[NF];
+      for(int i = 0; i < NX; ++i)
+        xd[i] = dual<val_type, NX>::var(x[i], i);
+      if(func_(xd, f))
+        return __LINE__;
+      for(int_type fi = 0; fi < NF; ++fi) {
+        for(int_type xi = 0; xi < NX; ++xi) {
+          int_type c[] = {fi, xi};
+          cv[c] += f[fi].g[xi];
+        }
+      }
+      return 0;
+    }
+    if(k == 2) {
+      hyper_dual<val_type, NX> xd[NX], f[NF];
+      for(int i = 0; i < NX; ++i)
+        xd[i] = hyper_dual<val_type, NX>::var(x[i], i);
+      if(func_(xd, f))
+        return __LINE__;
+      for(int_type fi = 0; fi < NF; ++fi) {
+        for(int_type xi1 = 0; xi1 < NX; ++xi1) {
+          for(int_type xi0 = 0; xi0 < NX; ++xi0) {
+            int_type c[] = {fi, xi0, xi1};
+            cv[c] += f[fi].hess(xi0, xi1);
+          }
+        }
+      }
+      return 0;
+    }
+    return __LINE__;
+  }
+  virtual int patt(size_t k, coo_set<int_type> &cs, const coo_l2g &l2g, func_ctx *ctx = 0) const {
+    return 0;
+  }
+  virtual size_t nnz(size_t k) const {
+    return (k < 3) ? -1 : -2;
+  }
+protected:
+  FUNC func_;
+};
+
+//! @brief KERNEL of element_sum from FUNC, which evaluates the energy
+//! of element e at its local variables x[N] by
+//!   template <typename T> int operator()(size_t e, const T *x, T &f) const;
+template <typename FUNC, int N, typename VAL_TYPE = double>
+class ad_kernel
+{
+public:
+  typedef VAL_TYPE val_type;
+
+  ad_kernel(const FUNC &func = FUNC())
+    :func_(func) {
+  }
+
+  int operator()(size_t e, const val_type *x, val_type *f, val_type *g, val_type *H) const {
+    if(H)
+      return hess(e, x, f, g, H);
+    if(g)
+      return grad(e, x, f, g);
+    return func_(e, x, *f) ? __LINE__ : 0;
+  }
+protected:
+  int grad(size_t e, const val_type *x, val_type *f, val_type *g) const {
+    dual<val_type, N> xd[N], fd;
+    for(int i = 0; i < N; ++i)
+      xd[i] = dual<val_type, N>::var(x[i], i);
+    if(func_(e, xd, fd))
+      return __LINE__;
+    *f = fd.v;
+    std::copy(fd.g, fd.g+N, g);
+    return 0;
+  }
+  int hess(size_t e, const val_type *x, val_type *f, val_type *g, val_type *H) const {
+    hyper_dual<val_type, N> xd[N], fd;
+    for(int i = 0; i < N; ++i)
+      xd[i] = hyper_dual<val_type, N>::var(x[i], i);
+    if(func_(e, xd, fd))
+      return __LINE__;
+    *f = fd.v;
+    if(g)
+      std::copy(fd.g, fd.g+N, g);
+    for(int j = 0, k = 0; j < N; ++j) {
+      for(int i = 0; i <= j; ++i, ++k)
+        H[i+j*N] = H[j+i*N] = fd.lin ? val_type(0) : fd.h[k];
+    }
+    return 0;
+  }
+
+  FUNC func_;
+};
+
+}}
+
+#endif
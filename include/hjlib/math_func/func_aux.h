@@ -25,6 +25,53 @@ VAL_TYPE numerical_check(const math_func &f, size_t k, const VAL_TYPE *x,
   
 }
 
+//! @brief fv+i*cp0.nnz() = f(x+alpha[i]*d) for the n steps alpha, in
+//! one eval_batch
+//! @param cp0 the pattern of f for k = 0
+template <typename VAL_TYPE, typename INT_TYPE>
+int line_values(const math_func &f, const coo_pat<INT_TYPE> &cp0,
+                const VAL_TYPE *x, const VAL_TYPE *d, size_t n,
+                const VAL_TYPE *alpha, VAL_TYPE *fv, func_ctx *ctx = 0) {
+  const size_t nx = f.nx();
+  func_workspace::scope ws(workspace(ctx));
+  VAL_TYPE *X = ws.alloc<VAL_TYPE>(n*nx);
+  for(size_t i = 0; i < n; ++i) {
+    for(size_t j = 0; j < nx; ++j)
+      X[i*nx+j] = x[j]+alpha[i]*d[j];
+  }
+  std::fill(fv, fv+n*cp0.nnz(), VAL_TYPE(0));
+  return eval_batch(f, 0, n, X, cp0, fv, ctx);
+}
+
+//! @brief backtracking line search of a scalar f along d, the steps
+//! alpha0*beta^i are probed n at a time.
+//! @param f0 f(x)
+//! @param slope the directional derivative of f at x along d, < 0
+//! @return the first step with f <= f0+c*alpha*slope, 0 if none in
+//! max_probe steps, -1 if f fails
+template <typename VAL_TYPE, typename INT_TYPE>
+VAL_TYPE backtrack(const math_func &f, const coo_pat<INT_TYPE> &cp0,
+                   const VAL_TYPE *x, const VAL_TYPE *d,
+                   VAL_TYPE f0, VAL_TYPE slope, VAL_TYPE alpha0 = 1,
+                   VAL_TYPE beta = 0.5, VAL_TYPE c = 1e-4, size_t n = 4,
+                   size_t max_probe = 40, func_ctx *ctx = 0) {
+  assert(f.nf() == 1 && cp0.nnz() == 1 && n > 0);
+  std::vector<VAL_TYPE> alpha(n), fv(n);
+  VAL_TYPE a = alpha0;
+  for(size_t probe = 0; probe < max_probe; probe += n) {
+    const size_t m = std::min(n, max_probe-probe);
+    for(size_t i = 0; i < m; ++i, a *= beta)
+      alpha[i] = a;
+    if(line_values(f, cp0, x, d, m, &alpha[0], &fv[0], ctx))
+      return -1;
+    for(size_t i = 0; i < m; ++i) {
+      if(fv[i] <= f0+c*alpha[i]*slope)
+        return alpha[i];
+    }
+  }
+  return 0;
+}
+
 }}
 
 #endif
@@ -6,6 +6,11 @@
 #include <cassert>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 
 #include "config.h"
 #include "coo.h"
@@ -19,6 +24,110 @@ public:
 	virtual ~func_ctx(){}
 };
 
+//! @brief scratch memory of eval, kept across evaluations.
+//!
+//! Memory is taken in stack order through scope and given back when
+//! the scope ends, the chunks stay with the workspace, so an eval
+//! which has run once does not touch the heap again.  A workspace
+//! is used by one thread at a time: pass one as ctx, or leave ctx 0
+//! to use the workspace of the calling thread, see workspace(ctx).
+class func_workspace : public func_ctx
+{
+public:
+  enum { ALIGN = 64, FIRST_CHUNK = 1 << 16 };
+
+  func_workspace():cur_(0), used_(0) {}
+  virtual ~func_workspace() { release(); }
+
+  class scope
+  {
+  public:
+    explicit scope(func_workspace &ws)
+      :ws_(ws), cur_(ws.cur_), used_(ws.used_) {
+    }
+    ~scope() {
+      ws_.cur_ = cur_;
+      ws_.used_ = used_;
+    }
+    //! @brief n uninitialized T, valid until the scope ends
+    template <typename T>
+    T *alloc(size_t n) {
+      return static_cast<T *>(ws_.alloc(n*sizeof(T)));
+    }
+    template <typename T>
+    T *zeros(size_t n) {
+      T *p = alloc<T>(n);
+      std::fill(p, p+n, T(0));
+      return p;
+    }
+  private:
+    scope(const scope &);
+    scope &operator = (const scope &);
+    func_workspace &ws_;
+    const size_t cur_, used_;
+  };
+
+  //! @brief the workspace of the calling thread
+  static func_workspace &local(void) {
+    static thread_local func_workspace ws;
+    return ws;
+  }
+
+  //! @brief bytes held by the workspace
+  size_t capacity(void) const {
+    size_t bytes = 0;
+    for(size_t i = 0; i < chunks_.size(); ++i)
+      bytes += chunks_[i].bytes;
+    return bytes;
+  }
+  //! @brief give the chunks back, no scope may be open
+  void release(void) {
+    assert(cur_ == 0 && used_ == 0);
+    for(size_t i = 0; i < chunks_.size(); ++i)
+      std::free(chunks_[i].raw);
+    chunks_.clear();
+  }
+private:
+  func_workspace(const func_workspace &);
+  func_workspace &operator = (const func_workspace &);
+
+  struct chunk {
+    void *raw;
+    char *mem;
+    size_t bytes;
+  };
+
+  void *alloc(size_t bytes) {
+    bytes = (bytes+ALIGN-1)/ALIGN*ALIGN;
+    // the rest of a chunk too small for bytes is skipped
+    for(; cur_ < chunks_.size(); ++cur_, used_ = 0) {
+      if(used_+bytes <= chunks_[cur_].bytes) {
+        char *p = chunks_[cur_].mem+used_;
+        used_ += bytes;
+        return p;
+      }
+    }
+    chunk c;
+    c.bytes = std::max(bytes, chunks_.empty()?size_t(FIRST_CHUNK):2*chunks_.back().bytes);
+    c.raw = std::malloc(c.bytes+ALIGN);
+    if(!c.raw) throw std::bad_alloc();
+    c.mem = static_cast<char *>(c.raw)+(ALIGN-reinterpret_cast<size_t>(c.raw)%ALIGN)%ALIGN;
+    chunks_.push_back(c);
+    used_ = bytes;
+    return c.mem;
+  }
+
+  std::vector<chunk> chunks_;
+  size_t cur_, used_; // position of the next alloc
+};
+
+//! @brief the workspace given as ctx, or the one of the calling thread
+inline func_workspace &workspace(func_ctx *ctx)
+{
+  func_workspace *ws = dynamic_cast<func_workspace *>(ctx);
+  return ws ? *ws : func_workspace::local();
+}
+
 //! generic function without known value and int type to avoid template
 class math_func
 {
@@ -104,6 +213,118 @@ protected:
 	}
 };
 
+//! @brief implemented next to math_func_t by functions which evaluate
+//! several points in one call, sharing the reads of their structure
+//! and the pattern lookups among the points.  Call it through
+//! eval_batch, which loops over eval for the other functions.
+template <typename VAL_TYPE, typename INT_TYPE>
+class batch_func_t
+{
+public:
+  virtual ~batch_func_t(){}
+
+  //! @param x the n points of nx values one after another
+  //! @param val the values of point i are added to val+i*cp.nnz()
+  virtual int eval_batch(size_t k, size_t n, const VAL_TYPE *x,
+                         const coo_pat<INT_TYPE> &cp, VAL_TYPE *val,
+                         func_ctx *ctx = 0) const = 0;
+};
+
+//! @brief eval of f at n points, see batch_func_t
+template <typename VAL_TYPE, typename INT_TYPE>
+int eval_batch(const math_func &f, size_t k, size_t n, const VAL_TYPE *x,
+               const coo_pat<INT_TYPE> &cp, VAL_TYPE *val, func_ctx *ctx = 0)
+{
+  const batch_func_t<VAL_TYPE, INT_TYPE> *bf
+    = dynamic_cast<const batch_func_t<VAL_TYPE, INT_TYPE> *>(&f);
+  if(bf)
+    return bf->eval_batch(k, n, x, cp, val, ctx);
+  for(size_t i = 0; i < n; ++i) {
+    if(f.eval(k, x+i*f.nx(), coo2val(cp, val+i*cp.nnz()), ctx))
+      return __LINE__;
+  }
+  return 0;
+}
+
+//! @brief implemented next to math_func_t by functions whose eval
+//! spreads its work over the threads with parallel loops of its own,
+//! so that fcat runs a heavy one alone on the whole team instead of
+//! on one thread.
+class parallel_func
+{
+public:
+  virtual ~parallel_func(){}
+
+  //! @brief whether eval is split over the threads
+  virtual bool parallel_eval(void) const = 0;
+};
+
+//! @brief see parallel_func, false for other functions
+inline bool parallel_eval(const math_func &f)
+{
+  const parallel_func *pf = dynamic_cast<const parallel_func *>(&f);
+  return pf && pf->parallel_eval();
+}
+
+//! @brief the coo_scatter of the destination a function wrote to
+//! last, built once and shared by concurrent evals without a lock.
+//! The map is used while the destination has the serial number it was
+//! built for.  A map replaced by put may still be read by a concurrent
+//! eval, so it is kept until the cache is destroyed; after
+//! MAX_REPLACED replacements the maps are built on each eval instead.
+//! Typical use in eval:
+//!
+//!   ptr sc = scatter_[k].get(cv);
+//!   if(!sc) sc = scatter_[k].put(cv, k+1, coo_in_eval_order);
+//!   for(i...) cv.val()[(*sc)[i]] += v[i];
+template <typename INT_TYPE>
+class coo_scatter_cache
+{
+public:
+  typedef INT_TYPE int_type;
+  //! owns the map only if it is not cached
+  typedef std::shared_ptr<const coo_scatter<int_type> > ptr;
+
+  enum { MAX_REPLACED = 8 };
+
+  coo_scatter_cache():sc_(0) {}
+  //! a copy starts empty
+  coo_scatter_cache(const coo_scatter_cache &):sc_(0) {}
+  coo_scatter_cache &operator = (const coo_scatter_cache &) { return *this; }
+  ~coo_scatter_cache() {
+    delete sc_.load();
+    for(size_t i = 0; i < replaced_.size(); ++i)
+      delete replaced_[i];
+  }
+
+  //! @return null if cv is not the destination of the cached map
+  template <typename VAL_TYPE>
+  ptr get(const coo2val_t<VAL_TYPE, int_type> &cv) const {
+    const coo_scatter<int_type> *sc = sc_.load(std::memory_order_acquire);
+    if(sc && sc->match(cv))
+      return ptr(ptr(), sc);
+    return ptr();
+  }
+  //! @param coo local coordinates of dim integers each
+  template <typename VAL_TYPE>
+  ptr put(const coo2val_t<VAL_TYPE, int_type> &cv, size_t dim,
+          const std::vector<int_type> &coo) const {
+    const coo_scatter<int_type> *sc
+      = new coo_scatter<int_type>(cv, dim, coo.size()/dim, coo.empty()?0:&coo[0]);
+    std::lock_guard<std::mutex> l(m_);
+    if(replaced_.size() >= MAX_REPLACED)
+      return ptr(sc);
+    const coo_scatter<int_type> *old = sc_.exchange(sc, std::memory_order_acq_rel);
+    if(old)
+      replaced_.push_back(old);
+    return ptr(ptr(), sc);
+  }
+private:
+  mutable std::atomic<const coo_scatter<int_type> *> sc_;
+  mutable std::mutex m_;
+  mutable std::vector<const coo_scatter<int_type> *> replaced_;
+};
+
 }}
 
 #endif
@@ -154,7 +154,8 @@ HJ_FUNC_VECTOR_OP_OWN(-, std::minus)
 */
 // [XXX] -> XXX
 template <typename VAL_TYPE, typename INT_TYPE, class CON>
-class fcat : public math_func_t<VAL_TYPE, INT_TYPE>
+class fcat : public math_func_t<VAL_TYPE, INT_TYPE>,
+             public parallel_func
 {
 public:
 	typedef VAL_TYPE val_type;
@@ -188,6 +189,9 @@ public:
 		container::iterator begin(void) {
 			return ctxs_.begin();
 		}
+		func_ctx *operator[](size_t i) {
+			return ctxs_[i];
+		}
 		virtual ~catenated_func_ctx() {
 			for(container::iterator i = ctxs_.begin();
 				i != ctxs_.end(); ++i)
@@ -207,29 +211,47 @@ public:
 	}
 	virtual int eval(size_t k, const val_type *x, const coo2val_t<val_type, int_type> &cv,
                    func_ctx *ctx = 0) const {
-		if(ctx) {
-      assert(0); // TODO: not tested
-			catenated_func_ctx *ctxs = dynamic_cast<catenated_func_ctx *>(ctx);
-			assert(ctxs && ctxs->size() == funcs_->size());
-			typename catenated_func_ctx::container::iterator itr = ctxs->begin();
-			for(const_iterator i = funcs_->begin();
-				i != funcs_->end(); ++i, ++itr) {
-				if((*i)->eval(k, x, cv, *itr))
-					return 1;
-			}
-		}
-		else {
+    // every child writes its own range of f, so an entry of cv has
+    // one writer whatever the schedule is, and the result does not
+    // depend on it.
+    catenated_func_ctx *ctxs = dynamic_cast<catenated_func_ctx *>(ctx);
+    assert(!ctxs || ctxs->size() == funcs_->size());
+    int err = 0;
+    if(ctxs) { // a child gets its ctx of new_ctx, not flattened
       size_t i;
 #if HJ_MATH_FUNC_USE_OMP
-#pragma omp parallel for private(i)
+#pragma omp parallel for private(i) schedule(dynamic, 1) reduction(+:err)
 #endif
       for(i = 0; i < f_base_.size(); ++i) {
         coo2val_t<val_type, int_type> cvi = cv;
         cvi.f_base() += f_base_[i];
-        (*funcs_)[i]->eval(k, x, cvi, 0);
+        if((*funcs_)[i]->eval(k, x, cvi, (*ctxs)[i]))
+          ++err;
       }
-      return 0;
+      return err ? 1 : 0;
     }
+    // the leaves get 0 to use the workspace of the thread running them
+    const size_t pk = std::min<size_t>(k, 2);
+    const std::vector<task> &tasks = tasks_[pk];
+    const size_t nt = coo_threads();
+    // a task over the share of a thread whose function is parallel
+    // runs alone on the whole team, the parallel loops of the function
+    // split it further.  Other heavy tasks, e.g. of an xmap, start
+    // first in the loop next to the rest.
+    const size_t share = (nt > 1) ? weight_[pk]/nt : size_t(-1);
+    for(size_t t = 0; t < tasks.size() && tasks[t].weight > share; ++t) {
+      if(tasks[t].team)
+        err += run(tasks[t], k, x, cv);
+    }
+    ptrdiff_t i;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(i) schedule(dynamic, 1) reduction(+:err) if(nt > 1)
+#endif
+    for(i = 0; i < ptrdiff_t(tasks.size()); ++i) {
+      if(!(tasks[i].team && tasks[i].weight > share))
+        err += run(tasks[i], k, x, cv);
+    }
+    return err ? 1 : 0;
   }
 	virtual int patt(size_t k, coo_set<int_type> &cs, const coo_l2g &l2g, func_ctx *ctx = 0) const {
 		if(ctx) {
@@ -271,7 +293,42 @@ public:
     }
     return nnz;
   }
+  virtual bool parallel_eval(void) const {
+    return true;
+  }
 protected:
+  //! @brief a range of leaves evaluated by one thread, or a single
+  //! parallel_func leaf which may run on the whole team
+  struct task {
+    size_t beg, end, weight;
+    bool team;
+    bool operator < (const task &b) const { return weight > b.weight; }
+  };
+
+  int run(const task &t, size_t k, const val_type *x,
+          const coo2val_t<val_type, int_type> &cv) const {
+    int err = 0;
+    for(size_t l = t.beg; l < t.end; ++l) {
+      coo2val_t<val_type, int_type> cvi = cv;
+      cvi.f_base() += leaf_base_[l];
+      if(leaf_[l]->eval(k, x, cvi))
+        ++err;
+    }
+    return err;
+  }
+
+  //! @brief cost of eval k of f by its nnz, the value is weighted by
+  //! the nnz of the Jacobian, a call costs 16 nonzeros
+  static size_t weight(const math_func &f, size_t k) {
+    if(k == 0) k = 1;
+    size_t nnz = f.nnz(k);
+    if(nnz == size_t(-1))
+      nnz = f.nf()*powi(f.nx(), k);
+    if(nnz == size_t(-2))
+      nnz = f.nf();
+    return nnz+16;
+  }
+
 	void init(void) {
 		assert(funcs_->size());
     f_base_.resize(funcs_->size());
@@ -279,10 +336,66 @@ protected:
     for(size_t i = 1; i < f_base_.size(); ++i)
       f_base_[i] = f_base_[i-1]+(*funcs_)[i-1]->nf();
 		nf_ = f_base_.back()+funcs_->back()->nf();
+
+    // the leaves, an fcat child of the same type is flattened
+    for(size_t i = 0; i < funcs_->size(); ++i) {
+      const fcat *sub = dynamic_cast<const fcat *>(&*(*funcs_)[i]);
+      if(sub) {
+        for(size_t j = 0; j < sub->leaf_.size(); ++j) {
+          leaf_.push_back(sub->leaf_[j]);
+          leaf_base_.push_back(f_base_[i]+sub->leaf_base_[j]);
+        }
+      }
+      else {
+        leaf_.push_back(&*(*funcs_)[i]);
+        leaf_base_.push_back(f_base_[i]);
+      }
+    }
+    for(size_t k = 0; k < 3; ++k)
+      plan(k);
 	}
+
+  //! @brief group consecutive light leaves into tasks of about 1/256
+  //! of the total weight, heavy leaves are tasks of their own, the
+  //! heaviest tasks go first
+  void plan(size_t k) {
+    std::vector<size_t> w(leaf_.size());
+    weight_[k] = 0;
+    for(size_t l = 0; l < leaf_.size(); ++l)
+      weight_[k] += (w[l] = weight(*leaf_[l], k));
+    const size_t grain = std::max<size_t>(weight_[k]/256, 1);
+    std::vector<task> &tasks = tasks_[k];
+    tasks.clear();
+    task cur = {0, 0, 0, false};
+    for(size_t l = 0; l < leaf_.size(); ++l) {
+      if(w[l] >= grain && cur.end > cur.beg) { // keep the heavy leaf alone
+        tasks.push_back(cur);
+        cur.beg = cur.end = l;
+        cur.weight = 0;
+      }
+      ++cur.end;
+      cur.weight += w[l];
+      if(cur.weight >= grain) {
+        tasks.push_back(cur);
+        cur.beg = cur.end;
+        cur.weight = 0;
+      }
+    }
+    if(cur.end > cur.beg)
+      tasks.push_back(cur);
+    for(size_t t = 0; t < tasks.size(); ++t)
+      tasks[t].team = tasks[t].end == tasks[t].beg+1
+        && hj::math_func::parallel_eval(*leaf_[tasks[t].beg]);
+    std::stable_sort(tasks.begin(), tasks.end());
+  }
+
 	size_t nf_;
   std::vector<size_t> f_base_;
   std::shared_ptr<const con_type> funcs_;
+  std::vector<const math_func *> leaf_; // funcs_ with fcat flattened
+  std::vector<size_t> leaf_base_;
+  std::vector<task> tasks_[3]; // of eval k = 0, 1, 2 and above
+  size_t weight_[3];
 };
 
 template <typename VAL_TYPE, typename INT_TYPE, class CON>
@@ -341,51 +454,59 @@ public:
   virtual int eval(size_t k, const val_type *x,
                    const coo2val_t<val_type, int_type> &cv,
                    func_ctx *ctx = 0) const {
-    using namespace zjucad::matrix;
-    matrix<val_type> r = zeros<val_type>(f_->nf(), 1);
-    if(f_->eval(0, x, coo2val(*cp_[0], &r[0])))
+    // temporaries of every eval
+    func_workspace::scope ws(workspace(ctx));
+    const size_t nf = f_->nf();
+    val_type *r = ws.zeros<val_type>(nf);
+    if(f_->eval(0, x, coo2val(*cp_[0], r)))
       return __LINE__;
     if(w_.get()) {
-      for(size_t i = 0; w_.get() && i < r.size(); ++i)
+      for(size_t i = 0; i < nf; ++i)
         r[i] *= (*w_)[i];
     }
     if(k == 0) {
+      val_type rr = 0;
+      for(size_t i = 0; i < nf; ++i)
+        rr += r[i]*r[i];
       int_type c[] = {0};
-      cv[c] += dot(r, r);
+      cv[c] += rr;
       return 0;
     }
 
-    matrix<val_type> JT_val = zeros<double>(hj::sparse::nnz(JT_), 1);
-    f_->eval(1, x, coo2val(*cp_[1], &JT_val[0]));
+    const size_t JT_nnz = hj::sparse::nnz(JT_);
+    val_type *JT_val = ws.zeros<val_type>(JT_nnz);
+    if(f_->eval(1, x, coo2val(*cp_[1], JT_val)))
+      return __LINE__;
     if(w_.get()) {
       for(size_t fi = 0; fi < JT_.size(2); ++fi) {
         for(size_t nzi = JT_.ptr()[fi]; nzi < JT_.ptr()[fi+1]; ++nzi)
           JT_val[nzi] *= (*w_)[fi];
       }
     }
-    for_hj_sparse::ptr_csc<val_type, int_type> JT
-      (JT_.size(1), JT_.size(2), JT.nnz(), &JT_.ptr()[0], &JT_.idx()[0], &JT_val[0]);
     if(k == 1) {
-      matrix<val_type> JTr = zeros<double>(JT.size(1), 1);
-      hj::sparse::mv(false, JT, r, JTr);
-      for(int_type i = 0; i < JTr.size(); ++i) {// not worth omp
-        int_type c[] = {0, i};
-        cv[c] += JTr[i]*2;
+      const typename coo_scatter_cache<int_type>::ptr sc = scatter(k, cv);
+      val_type *val = cv.val();
+      for(size_t fi = 0; fi < JT_.size(2); ++fi) { // not worth omp
+        for(size_t nzi = JT_.ptr()[fi]; nzi < JT_.ptr()[fi+1]; ++nzi)
+          val[(*sc)[JT_.idx()[nzi]]] += JT_val[nzi]*r[fi]*2;
       }
       return 0;
     }
     if(k == 2) {
-      matrix<val_type> JTJ_val = zeros<double>(hj::sparse::nnz(H_), 1);
+      for_hj_sparse::ptr_csc<val_type, int_type> JT
+        (JT_.size(1), JT_.size(2), JT_nnz, &JT_.ptr()[0], &JT_.idx()[0], JT_val);
+      const size_t H_nnz = hj::sparse::nnz(H_);
+      val_type *JTJ_val = ws.zeros<val_type>(H_nnz);
       for_hj_sparse::ptr_csc<val_type, int_type> JTJ
-        (H_.size(1), H_.size(2), H_.nnz(), &H_.ptr()[0], &H_.idx()[0], &JTJ_val[0]);
-      fast_AAT(JT, JTJ, true);
-      int_type ci;
-      for(ci = 0; ci < H_.size(2); ++ci) { // not worth omp
-        for(size_t nzi = H_.ptr()[ci]; nzi < H_.ptr()[ci+1]; ++nzi) {
-          int_type c[3] = {0, ci, H_.idx()[nzi]};
-          cv[c] += JTJ_val[nzi]*2;
-        }
-      }
+        (H_.size(1), H_.size(2), H_nnz, &H_.ptr()[0], &H_.idx()[0], JTJ_val);
+      if(plan_ok_)
+        AAT_plan_(JT, JTJ);
+      else
+        fast_AAT(JT, JTJ, true);
+      const typename coo_scatter_cache<int_type>::ptr sc = scatter(k, cv);
+      val_type *val = cv.val();
+      for(size_t nzi = 0; nzi < H_nnz; ++nzi) // not worth omp
+        val[(*sc)[nzi]] += JTJ_val[nzi]*2;
     }
     return 0;
   }
@@ -410,6 +531,29 @@ public:
       return hj::sparse::nnz(H_);
   }
 protected:
+  //! @brief offsets of JT*r (k=1) or the nonzeros of H_ (k=2) in cv
+  typename coo_scatter_cache<int_type>::ptr
+  scatter(size_t k, const coo2val_t<val_type, int_type> &cv) const {
+    typename coo_scatter_cache<int_type>::ptr sc = scatter_[k].get(cv);
+    if(sc) return sc;
+    std::vector<int_type> coo;
+    if(k == 1) {
+      for(size_t i = 0; i < JT_.size(1); ++i) {
+        coo.push_back(0);
+        coo.push_back(i);
+      }
+    }
+    if(k == 2) {
+      for(size_t ci = 0; ci < H_.size(2); ++ci) {
+        for(size_t nzi = H_.ptr()[ci]; nzi < H_.ptr()[ci+1]; ++nzi) {
+          coo.push_back(0);
+          coo.push_back(ci);
+          coo.push_back(H_.idx()[nzi]);
+        }
+      }
+    }
+    return scatter_[k].put(cv, k+1, coo);
+  }
 	void init(void) {
     using namespace hj::sparse;
     using namespace zjucad::matrix;
@@ -420,11 +564,15 @@ protected:
     coo2csc(*cp_[1], &JT_.ptr()[0], &JT_.idx()[0]);
     assert(hj::sparse::nnz(H_) == 0);
     AAT<map_by_sorted_vector>(JT_, H_);
+    plan_ok_ = (AAT_plan_.analyze(JT_, H_) == 0);
   }
   std::shared_ptr<const math_func> f_;
   std::shared_ptr<const std::vector<VAL_TYPE> > w_;
   hj::sparse::csc<val_type, int_type> JT_, H_;
+  fast_AAT_plan<int_type> AAT_plan_; // JT*JT^T of every eval
+  bool plan_ok_; // otherwise fast_AAT
   std::shared_ptr<coo_pat<int_type> > cp_[2];
+  coo_scatter_cache<int_type> scatter_[3];
 };
 
 // DDD -> DSS
@@ -449,37 +597,25 @@ public:
   virtual int eval(size_t k, const val_type *x,
                    const coo2val_t<val_type, int_type> &cv,
                    func_ctx *ctx = 0) const {
-    using namespace zjucad::matrix;
-    std::vector<val_type> dx(idx_.size());
-    for(size_t i = 0; i < dx.size(); ++i)
+    func_workspace::scope ws(workspace(ctx));
+    val_type *dx = ws.alloc<val_type>(idx_.size());
+    for(size_t i = 0; i < idx_.size(); ++i)
       dx[i] = x[idx_[i]];
-    std::vector<val_type> v(cp_[k]->nnz(), 0);
-    if(f_->eval(k, &dx[0], coo2val(*cp_[k], &v[0])))
+    const size_t nv = cp_[k]->nnz();
+    val_type *v = ws.zeros<val_type>(nv);
+    if(f_->eval(k, dx, coo2val(*cp_[k], v)))
       return __LINE__;
-    if(k == 0) {
-      for(int32_t fi = 0, vi = 0; fi < nf(); ++fi) {
-        int32_t c[] = {fi};
-        cv[c] += v[vi];
-      }
-    }
-    if(k == 1) {
-      for(int32_t fi = 0, vi = 0; fi < nf(); ++fi) {
-        for(int32_t xi = 0; xi < idx_.size(); ++xi, ++vi) {
-          int32_t c[] = {fi, idx_[xi]};
-          cv[c] += v[vi];
-        }
-      }
-    }
-    if(k == 2) {
-      for(int32_t fi = 0, vi = 0; fi < nf(); ++fi) {
-        for(int32_t xi0 = 0; xi0 < idx_.size(); ++xi0) {
-          for(int32_t xi1 = 0; xi1 < idx_.size(); ++xi1, ++vi) {
-            int32_t c[] = {fi, idx_[xi0], idx_[xi1]};
-            cv[c] += v[vi];
-          }
-        }
+    if(k == 0) { // dense, not worth a scatter map
+      for(int_type fi = 0; fi < nf(); ++fi) {
+        int_type c[] = {fi};
+        cv[c] += v[fi];
       }
+      return 0;
     }
+    const typename coo_scatter_cache<int_type>::ptr sc = scatter(k, cv);
+    val_type *val = cv.val();
+    for(size_t vi = 0; vi < nv; ++vi)
+      val[(*sc)[vi]] += v[vi];
     return 0;
   }
   virtual int patt(size_t k, coo_set<int_type> &cs, const coo_l2g &l2g, func_ctx *ctx = 0) const {
@@ -508,12 +644,40 @@ public:
     if(k == 0)
       return -1;
     if(k == 1)
-      return idx_.size();
+      return nf()*idx_.size();
     if(k == 2)
-      return idx_.size()*idx_.size();
+      return nf()*idx_.size()*idx_.size();
     return -2;
   }
 protected:
+  //! @brief offsets of the dense nonzeros of f_ in cv, in the order
+  //! of cp_[k]
+  typename coo_scatter_cache<int_type>::ptr
+  scatter(size_t k, const coo2val_t<val_type, int_type> &cv) const {
+    typename coo_scatter_cache<int_type>::ptr sc = scatter_[k].get(cv);
+    if(sc) return sc;
+    const int_type n = idx_.size(), nf = this->nf();
+    std::vector<int_type> coo;
+    coo.reserve(nf*powi(n, k)*(k+1));
+    for(int_type fi = 0; fi < nf; ++fi) {
+      if(k == 1) {
+        for(int_type xi = 0; xi < n; ++xi) {
+          coo.push_back(fi);
+          coo.push_back(idx_[xi]);
+        }
+      }
+      if(k == 2) {
+        for(int_type xi0 = 0; xi0 < n; ++xi0) {
+          for(int_type xi1 = 0; xi1 < n; ++xi1) {
+            coo.push_back(fi);
+            coo.push_back(idx_[xi0]);
+            coo.push_back(idx_[xi1]);
+          }
+        }
+      }
+    }
+    return scatter_[k].put(cv, k+1, coo);
+  }
 	void init(void) {
     for(size_t k = 0; k < 3; ++k) { // 0, 1, 2 only
       cp_[k].reset(hj::math_func::patt<int_type>(*f_, k));
@@ -523,12 +687,15 @@ protected:
   std::shared_ptr<coo_pat<int_type> > cp_[3];
   const std::vector<int_type> idx_;
   size_t nx_;
+  coo_scatter_cache<int_type> scatter_[3];
 };
 
 //! NOTICE: w will not be squared sum w_i*f_i
 // -> DDS
 template <typename VAL_TYPE, typename INT_TYPE>
-class sum : public math_func_t<VAL_TYPE, INT_TYPE>
+class sum : public math_func_t<VAL_TYPE, INT_TYPE>,
+            public batch_func_t<VAL_TYPE, INT_TYPE>,
+            public parallel_func
 {
 public:
 	typedef VAL_TYPE val_type;
@@ -550,39 +717,14 @@ public:
   virtual int eval(size_t k, const val_type *x,
                    const coo2val_t<val_type, int_type> &cv,
                    func_ctx *ctx = 0) const {
-    using namespace zjucad::matrix;
-    if(k == 0) {
-      matrix<val_type> r = zeros<val_type>(cp_[0]->nnz(), 1);
-      if(f_->eval(0, x, coo2val(*cp_[0], &r[0])))
-        return __LINE__;
-      if(w_.get()) {
-        for(size_t i = 0; w_.get() && i < r.size(); ++i)
-          r[i] *= (*w_)[i];
-      }
-      int_type c[] = {0};
-      cv[c] += zjucad::matrix::sum(r);
-      return 0;
-    }
-    if(k == 1) {
-      matrix<val_type> g = zeros<val_type>(cp_[1]->nnz(), 1);
-      if(f_->eval(1, x, coo2val(*cp_[1], &g[0])))
-        return __LINE__;
-      for(size_t i = 0; i < g.size(); ++i) {
-        int_type c[] = {0, cache_[1][i*2+1]};
-        cv[c] += g[i]*(w_?(*w_)[cache_[1][i*2+0]]:1);
-      }
-      return 0;
-    }
-    if(k == 2) {
-      matrix<val_type> h = zeros<val_type>(cp_[2]->nnz(), 1);
-      if(f_->eval(2, x, coo2val(*cp_[2], &h[0])))
-        return __LINE__;
-      for(size_t i = 0; i < h.size(); ++i) {
-        int_type c[] = {0, cache_[2][i*3+1], cache_[2][i*3+2]};
-        cv[c] += h[i]*(w_?(*w_)[cache_[2][i*3+0]]:1);
-      }
-      return 0;
-    }
+    return eval_n(k, 1, x, cv, 0, ctx);
+  }
+  //! @brief f is evaluated at the n points in one eval_batch, the
+  //! scatter map is shared by the points
+  virtual int eval_batch(size_t k, size_t n, const val_type *x,
+                         const coo_pat<int_type> &cp, val_type *val,
+                         func_ctx *ctx = 0) const {
+    return eval_n(k, n, x, coo2val(cp, val), cp.nnz(), ctx);
   }
   virtual int patt(size_t k, coo_set<int_type> &cs, const coo_l2g &l2g, func_ctx *ctx = 0) const {
     if(k == 2) {
@@ -603,7 +745,55 @@ public:
     if(k == 2)
       return cp2_->nnz();
   }
+  //! @brief as parallel as f
+  virtual bool parallel_eval(void) const {
+    return hj::math_func::parallel_eval(*f_);
+  }
 protected:
+  //! @brief the n points from x, point p adds to cv.val()+p*stride
+  int eval_n(size_t k, size_t n, const val_type *x,
+             const coo2val_t<val_type, int_type> &cv, size_t stride,
+             func_ctx *ctx) const {
+    if(k > 2)
+      return __LINE__;
+    func_workspace::scope ws(workspace(ctx));
+    const size_t nk = cp_[k]->nnz();
+    val_type *r = ws.zeros<val_type>(n*nk);
+    if(hj::math_func::eval_batch(*f_, k, n, x, *cp_[k], r))
+      return __LINE__;
+    val_type *val = cv.val();
+    if(k == 0) {
+      int_type c[] = {0};
+      const size_t off = cv.offset(c);
+      for(size_t p = 0; p < n; ++p) {
+        const val_type *rp = r+p*nk;
+        val_type s = 0;
+        for(size_t i = 0; i < nk; ++i)
+          s += rp[i]*(w_?(*w_)[i]:1);
+        val[p*stride+off] += s;
+      }
+      return 0;
+    }
+    const typename coo_scatter_cache<int_type>::ptr sc = scatter(k, cv);
+    for(size_t p = 0; p < n; ++p) {
+      const val_type *rp = r+p*nk;
+      val_type *vp = val+p*stride;
+      for(size_t i = 0; i < nk; ++i)
+        vp[(*sc)[i]] += rp[i]*(w_?(*w_)[cache_[k][i*(k+1)+0]]:1);
+    }
+    return 0;
+  }
+
+  //! @brief offsets of the nonzeros of f_ summed over f in cv
+  typename coo_scatter_cache<int_type>::ptr
+  scatter(size_t k, const coo2val_t<val_type, int_type> &cv) const {
+    typename coo_scatter_cache<int_type>::ptr sc = scatter_[k].get(cv);
+    if(sc) return sc;
+    std::vector<int_type> coo(cache_[k]);
+    for(size_t i = 0; i < coo.size(); i += k+1)
+      coo[i] = 0;
+    return scatter_[k].put(cv, k+1, coo);
+  }
 	void init(void) {
     for(size_t k = 0; k < 3; ++k) {
       cp_[k].reset(hj::math_func::patt<int_type>(*f_, k));
@@ -632,6 +822,7 @@ protected:
   std::shared_ptr<const std::vector<VAL_TYPE> > w_;
   std::shared_ptr<coo_pat<int_type> > cp_[3], cp2_;
   std::vector<std::vector<int_type> > cache_;
+  coo_scatter_cache<int_type> scatter_[3];
 };
 
 // sub math_func has dense g and hes, typical use:
@@ -658,9 +849,9 @@ public:
   virtual int eval(size_t k, const val_type *x,
                    const coo2val_t<val_type, int_type> &cv,
                    func_ctx *ctx = 0) const {
-    using namespace zjucad::matrix;
-    matrix<val_type> r = zeros<val_type>(cp_[0]->nnz(), 1);
-    if(f_->eval(0, x, coo2val(*cp_[0], &r[0])))
+    func_workspace::scope ws(workspace(ctx));
+    val_type *r = ws.zeros<val_type>(cp_[0]->nnz());
+    if(f_->eval(0, x, coo2val(*cp_[0], r)))
       return __LINE__;
     if(k == 0) {
       for(int_type i = 0; i < f_->nf(); ++i) {
@@ -669,8 +860,8 @@ public:
       }
       return 0;
     }
-    matrix<val_type> g = zeros<val_type>(cp_[1]->nnz(), 1);
-    if(f_->eval(1, x, coo2val(*cp_[1], &g[0])))
+    val_type *g = ws.zeros<val_type>(cp_[1]->nnz());
+    if(f_->eval(1, x, coo2val(*cp_[1], g)))
       return __LINE__;
     if(k == 1) {
       size_t gi = 0;
@@ -718,6 +909,268 @@ protected:
   size_t nx_;
 };
 
+//! @brief sum over the elements, the columns of elem, of a dense
+//! kernel of the N variables of their nodes.  A node i has the
+//! N/elem.size(1) consecutive variables from i*N/elem.size(1), e.g.
+//! N = 12 for tets on a 3 x n node matrix.
+//!
+//! KERNEL provides
+//!   int operator()(size_t e, const VAL_TYPE *x, VAL_TYPE *f,
+//!                  VAL_TYPE *g, VAL_TYPE *H) const;
+//! which sets f, the gradient g[N] and the column major Hessian
+//! H[N*N] of element e at its local variables x[N], g and H are 0
+//! when not asked for, nonzero return for failure.
+//!
+//! Elements sharing a node get different colors, the elements of a
+//! color run in parallel and add straight to precomputed offsets, so
+//! the result does not depend on the number of threads.
+// -> DDS
+template <typename KERNEL, int N, typename VAL_TYPE = double, typename INT_TYPE = int32_t>
+class element_sum : public math_func_t<VAL_TYPE, INT_TYPE>,
+                    public batch_func_t<VAL_TYPE, INT_TYPE>,
+                    public parallel_func
+{
+public:
+	typedef VAL_TYPE val_type;
+	typedef INT_TYPE int_type;
+  typedef zjucad::matrix::matrix<size_t> matrixst;
+  enum { stencil_size = N, CHUNK = 256 };
+
+  element_sum(const matrixst &elem, size_t nx, const KERNEL &kernel = KERNEL())
+    :kernel_(kernel), nx_(nx) {
+    init(elem);
+  }
+
+	virtual size_t nx(void) const {
+		return nx_;
+	}
+	virtual size_t nf(void) const {
+		return 1;
+	}
+  size_t elements(void) const {
+    return var_.size()/N;
+  }
+  size_t colors(void) const {
+    return color_ptr_.size()-1;
+  }
+
+  virtual int eval(size_t k, const val_type *x,
+                   const coo2val_t<val_type, int_type> &cv,
+                   func_ctx *ctx = 0) const {
+    return eval_n(k, 1, x, cv, 0, ctx);
+  }
+  //! @brief the connectivity, offsets and scatter map are read once
+  //! per element for all the points
+  virtual int eval_batch(size_t k, size_t n, const val_type *x,
+                         const coo_pat<int_type> &cp, val_type *val,
+                         func_ctx *ctx = 0) const {
+    return eval_n(k, n, x, coo2val(cp, val), cp.nnz(), ctx);
+  }
+  virtual int patt(size_t k, coo_set<int_type> &cs, const coo_l2g &l2g, func_ctx *ctx = 0) const {
+    if(k == 2) {
+      int_type c2[2];
+      for(size_t i = 0; i < cp2_->nnz(); ++i) {
+        (*cp2_)(i, c2);
+        int_type c[3] = {0, c2[0], c2[1]};
+        l2g.add(cs, c);
+      }
+    }
+    return 0;
+  }
+  virtual size_t nnz(size_t k) const {
+    if(k == 0 || k == 1)
+      return -1;
+    if(k == 2)
+      return cp2_->nnz();
+    return -2;
+  }
+  virtual bool parallel_eval(void) const {
+    return true;
+  }
+protected:
+  //! @brief the n points from x, point p adds to cv.val()+p*stride
+  int eval_n(size_t k, size_t n, const val_type *x,
+             const coo2val_t<val_type, int_type> &cv, size_t stride,
+             func_ctx *ctx) const {
+    const ptrdiff_t ne = elements();
+    val_type *val = cv.val();
+    int err = 0;
+    if(k == 0) { // partial sums of fixed chunks, independent of threads
+      func_workspace::scope ws(workspace(ctx));
+      const ptrdiff_t nc = (ne+CHUNK-1)/CHUNK;
+      val_type *part = ws.zeros<val_type>(nc*n);
+      ptrdiff_t c;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(c) reduction(+:err) if(nc > 1)
+#endif
+      for(c = 0; c < nc; ++c) {
+        val_type xl[N], f;
+        for(ptrdiff_t e = c*CHUNK; e < std::min(ne, (c+1)*ptrdiff_t(CHUNK)); ++e) {
+          for(size_t p = 0; p < n; ++p) {
+            gather(e, x+p*nx_, xl);
+            if(kernel_(e, xl, &f, 0, 0))
+              ++err;
+            else
+              part[c*n+p] += f;
+          }
+        }
+      }
+      int_type c0[] = {0};
+      const size_t off = cv.offset(c0);
+      for(size_t p = 0; p < n; ++p) {
+        val_type s = 0;
+        for(c = 0; c < nc; ++c)
+          s += part[c*n+p];
+        val[p*stride+off] += s;
+      }
+      return err ? __LINE__ : 0;
+    }
+    if(k > 2)
+      return __LINE__;
+    const typename coo_scatter_cache<int_type>::ptr sc = scatter(k, cv);
+    const size_t *off = sc->begin();
+    for(size_t ci = 0; ci < colors(); ++ci) {
+      ptrdiff_t i;
+#if HJ_MATH_FUNC_USE_OMP
+#pragma omp parallel for private(i) reduction(+:err) if(color_ptr_[ci+1]-color_ptr_[ci] > CHUNK)
+#endif
+      for(i = color_ptr_[ci]; i < ptrdiff_t(color_ptr_[ci+1]); ++i) {
+        const size_t e = order_[i];
+        val_type xl[N], f, g[N], H[N*N];
+        for(size_t p = 0; p < n; ++p) {
+          gather(e, x+p*nx_, xl);
+          if(kernel_(e, xl, &f, g, (k == 2) ? H : 0)) {
+            ++err;
+            continue;
+          }
+          val_type *vp = val+p*stride;
+          if(k == 1) {
+            const int_type *var = &var_[e*N];
+            for(int j = 0; j < N; ++j)
+              vp[off[var[j]]] += g[j];
+          }
+          else {
+            const int_type *hes = &hes_[e*N*N];
+            for(int j = 0; j < N*N; ++j)
+              vp[off[hes[j]]] += H[j];
+          }
+        }
+      }
+    }
+    return err ? __LINE__ : 0;
+  }
+
+  void gather(size_t e, const val_type *x, val_type *xl) const {
+    const int_type *var = &var_[e*N];
+    for(int j = 0; j < N; ++j)
+      xl[j] = x[var[j]];
+  }
+
+  //! @brief offsets of the gradient in variable order (k=1), or of
+  //! the nonzeros of cp2_ (k=2) in cv
+  typename coo_scatter_cache<int_type>::ptr
+  scatter(size_t k, const coo2val_t<val_type, int_type> &cv) const {
+    typename coo_scatter_cache<int_type>::ptr sc = scatter_[k].get(cv);
+    if(sc) return sc;
+    std::vector<int_type> coo;
+    if(k == 1) {
+      coo.reserve(2*nx_);
+      for(size_t xi = 0; xi < nx_; ++xi) {
+        coo.push_back(0);
+        coo.push_back(xi);
+      }
+    }
+    if(k == 2) {
+      coo.reserve(3*cp2_->nnz());
+      int_type c2[2];
+      for(size_t i = 0; i < cp2_->nnz(); ++i) {
+        (*cp2_)(i, c2);
+        coo.push_back(0);
+        coo.push_back(c2[0]);
+        coo.push_back(c2[1]);
+      }
+    }
+    return scatter_[k].put(cv, k+1, coo);
+  }
+
+  void init(const matrixst &elem) {
+    const size_t ne = elem.size(2), nn = elem.size(1);
+    assert(nn > 0 && N % nn == 0);
+    const size_t dim = N/nn;
+    var_.resize(ne*N);
+    size_t nodes = 0;
+    for(size_t e = 0; e < ne; ++e) {
+      for(size_t j = 0; j < nn; ++j) {
+        nodes = std::max(nodes, elem(j, e)+1);
+        for(size_t d = 0; d < dim; ++d)
+          var_[e*N+j*dim+d] = int_type(elem(j, e)*dim+d);
+      }
+    }
+    assert(nodes*dim <= nx_);
+
+    // the Hessian pattern, and where each entry of an element goes
+    coo_set<int_type> cs(2, nx_, nx_, ne*N*N);
+    const coo_l2g l2g;
+    for(size_t e = 0; e < ne; ++e) {
+      for(int j = 0; j < N; ++j) {
+        for(int i = 0; i < N; ++i) {
+          int_type c[2] = {var_[e*N+i], var_[e*N+j]};
+          l2g.add(cs, c);
+        }
+      }
+    }
+    cp2_.reset(cs.get_coo_pat());
+    hes_.resize(ne*N*N);
+    for(size_t e = 0; e < ne; ++e) {
+      for(int j = 0; j < N; ++j) {
+        for(int i = 0; i < N; ++i) {
+          const int_type c[2] = {var_[e*N+i], var_[e*N+j]};
+          hes_[e*N*N+j*N+i] = int_type((*cp2_)(c));
+        }
+      }
+    }
+
+    // greedy coloring, 64 colors a word of the per node masks
+    std::vector<std::vector<uint64_t> > used;
+    std::vector<size_t> color(ne);
+    size_t nc = 0;
+    for(size_t e = 0; e < ne; ++e) {
+      for(size_t b = 0; ; ++b) {
+        if(b == used.size())
+          used.push_back(std::vector<uint64_t>(nodes, 0));
+        uint64_t m = 0;
+        for(size_t j = 0; j < nn; ++j)
+          m |= used[b][elem(j, e)];
+        if(~m == 0) continue;
+        int bit = 0;
+        while(m >> bit & 1) ++bit;
+        color[e] = b*64+bit;
+        for(size_t j = 0; j < nn; ++j)
+          used[b][elem(j, e)] |= uint64_t(1) << bit;
+        nc = std::max(nc, color[e]+1);
+        break;
+      }
+    }
+    color_ptr_.assign(nc+1, 0);
+    for(size_t e = 0; e < ne; ++e)
+      ++color_ptr_[color[e]+1];
+    for(size_t c = 0; c < nc; ++c)
+      color_ptr_[c+1] += color_ptr_[c];
+    order_.resize(ne);
+    std::vector<size_t> pos(color_ptr_.begin(), color_ptr_.end()-1);
+    for(size_t e = 0; e < ne; ++e)
+      order_[pos[color[e]]++] = e;
+  }
+
+  KERNEL kernel_;
+  size_t nx_;
+  std::vector<int_type> var_; // N variables of each element
+  std::vector<int_type> hes_; // N*N offsets in cp2_ of each element
+  std::shared_ptr<coo_pat<int_type> > cp2_;
+  std::vector<size_t> color_ptr_, order_; // elements by color
+  coo_scatter_cache<int_type> scatter_[3];
+};
+
 }}
 
 #endif
@@ -1,7 +1,10 @@
 #ifndef HJ_CACHED_AAT_H_
 #define HJ_CACHED_AAT_H_
 
+#include <vector>
+
 #include "sparse.h"
+#include "fast_AAT.h"
 
 #ifndef cached_AAT_API
 #define cached_AAT_API
@@ -33,6 +36,48 @@ private:
 	void *ctx_;
 };
 
+//! @brief cached_AAT for any value and index type in the header, e.g.
+//! csc<double, int64_t> or csc<float, int>.  With max_cache_level > 0
+//! the pattern of AAT and the fast_AAT_plan are kept as long as the
+//! pattern of A is the same.  AAT gets the pattern when it is not of
+//! the cached one, so pass the same AAT every time.
+template <typename T = double, typename INT_TYPE = idx_type>
+class basic_cached_AAT
+{
+public:
+	void operator()(const csc<T, INT_TYPE> &A, csc<T, INT_TYPE> &AAT,
+					int max_cache_level = 2) {
+		const bool analyze = max_cache_level <= 0 || !same_pattern(A);
+		if(analyze) {
+			AAT_pattern(A, pattern_);
+			plan_.analyze(A, pattern_);
+			ptr_.assign(A.ptr().begin(), A.ptr().end());
+			idx_.assign(A.idx().begin(), A.idx().end());
+		}
+		if(analyze || AAT.size(2) != pattern_.size(2) || AAT.nnz() != pattern_.nnz())
+			AAT = pattern_;
+		plan_(A, AAT);
+	}
+	void clear(void) {
+		pattern_ = csc<T, INT_TYPE>();
+		plan_.clear();
+		ptr_.clear();
+		idx_.clear();
+	}
+
+private:
+	bool same_pattern(const csc<T, INT_TYPE> &A) const {
+		return ptr_.size() == size_t(A.ptr().size()) && idx_.size() == size_t(A.idx().size())
+			&& A.size(1) == pattern_.size(1)
+			&& std::equal(ptr_.begin(), ptr_.end(), A.ptr().begin())
+			&& std::equal(idx_.begin(), idx_.end(), A.idx().begin());
+	}
+
+	csc<T, INT_TYPE> pattern_;
+	fast_AAT_plan<INT_TYPE> plan_;
+	std::vector<INT_TYPE> ptr_, idx_;
+};
+
 }}
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef HJ_SPARSE_CONVERT_H_
 #define HJ_SPARSE_CONVERT_H_
 
+#include <limits>
+
 namespace hj { namespace sparse {
 
 template <typename E, typename T, typename INT_TYPE>
@@ -65,6 +67,90 @@ csc<T2, INT_TYPE2> &convert(const csc_by_vm<T1, INT_TYPE1, MAP_TYPE> &vmM,
 	return cscM;
 }
 
+//! @brief whether the shape and nnz of A are representable by INT_TYPE2
+template <typename INT_TYPE2, typename T, typename INT_TYPE>
+bool index_fits(const csc<T, INT_TYPE> &A)
+{
+	const double lim = double(std::numeric_limits<INT_TYPE2>::max());
+	return double(A.size(1)) <= lim && double(A.size(2)) <= lim && double(A.nnz()) <= lim;
+}
+
+//! @brief csc of other value or index types, e.g. float values for
+//! bandwidth bound iterative solves or 64 bit indices for more than
+//! 2^31 nonzeros.  The indices of A must fit into INT_TYPE2, see
+//! index_fits.
+template <typename T1, typename INT_TYPE1, typename T2, typename INT_TYPE2>
+csc<T2, INT_TYPE2> &convert(const csc<T1, INT_TYPE1> &A, csc<T2, INT_TYPE2> &B)
+{
+	assert(index_fits<INT_TYPE2>(A));
+	const INT_TYPE1 cols = A.size(2), nz = A.ptr()[cols];
+	B.resize(INT_TYPE2(A.size(1)), INT_TYPE2(cols), INT_TYPE2(nz));
+	for(INT_TYPE1 ci = 0; ci <= cols; ++ci)
+		B.ptr()[ci] = static_cast<INT_TYPE2>(A.ptr()[ci]);
+	for(INT_TYPE1 vi = 0; vi < nz; ++vi) {
+		B.idx()[vi] = static_cast<INT_TYPE2>(A.idx()[vi]);
+		B.val()[vi] = static_cast<T2>(A.val()[vi]);
+	}
+	return B;
+}
+
+//! @brief csc to BS x BS blocks, a block holding any entry of A is
+//! stored in full, block rows are sorted
+template <typename T1, typename INT_TYPE1, typename T2, typename INT_TYPE2, int BS>
+bcsc<T2, INT_TYPE2, BS> &convert(const csc<T1, INT_TYPE1> &A, bcsc<T2, INT_TYPE2, BS> &B)
+{
+	assert(A.size(1)%BS == 0 && A.size(2)%BS == 0);
+	const INT_TYPE2 brows = A.size(1)/BS, bcols = A.size(2)/BS;
+	std::vector<INT_TYPE2> pos(brows, -1), ptr(bcols+1, 0), idx;
+	INT_TYPE2 bi, bj, k;
+	for(bj = 0; bj < bcols; ++bj) {	// block pattern of each block column
+		const size_t beg = idx.size();
+		for(INT_TYPE1 vi = A.ptr()[bj*BS]; vi < A.ptr()[bj*BS+BS]; ++vi) {
+			bi = A.idx()[vi]/BS;
+			if(pos[bi] == bj) continue;
+			pos[bi] = bj;
+			idx.push_back(bi);
+		}
+		std::sort(idx.begin()+beg, idx.end());
+		ptr[bj+1] = idx.size();
+	}
+	B.resize(brows, bcols, idx.size());
+	std::copy(ptr.begin(), ptr.end(), &B.ptr()[0]);
+	std::copy(idx.begin(), idx.end(), B.idx().begin());
+	std::fill(B.val().begin(), B.val().end(), T2(0));
+	for(bj = 0; bj < bcols; ++bj) {
+		for(k = ptr[bj]; k < ptr[bj+1]; ++k)
+			pos[idx[k]] = k;
+		for(INT_TYPE2 c = 0; c < BS; ++c) {
+			const INT_TYPE1 j = bj*BS+c;
+			for(INT_TYPE1 vi = A.ptr()[j]; vi < A.ptr()[j+1]; ++vi)
+				B.block(pos[A.idx()[vi]/BS])[A.idx()[vi]%BS+c*BS] = A.val()[vi];
+		}
+	}
+	return B;
+}
+
+//! @brief blocks to csc, zeros inside the blocks are kept
+template <typename T1, typename INT_TYPE1, int BS, typename T2, typename INT_TYPE2>
+csc<T2, INT_TYPE2> &convert(const bcsc<T1, INT_TYPE1, BS> &A, csc<T2, INT_TYPE2> &B)
+{
+	B.resize(A.size(1), A.size(2), A.nnz());
+	INT_TYPE2 vi = 0;
+	for(INT_TYPE1 bj = 0; bj < A.bsize(2); ++bj) {
+		for(INT_TYPE1 c = 0; c < BS; ++c) {
+			for(INT_TYPE1 k = A.ptr()[bj]; k < A.ptr()[bj+1]; ++k) {
+				const T1 *blk = A.block(k);
+				for(INT_TYPE1 r = 0; r < BS; ++r, ++vi) {
+					B.idx()[vi] = A.idx()[k]*BS+r;
+					B.val()[vi] = blk[r+c*BS];
+				}
+			}
+			B.ptr()[bj*BS+c+1] = vi;
+		}
+	}
+	return B;
+}
+
 }}
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 
+#include <vector>
 #include <algorithm>
 #include <iostream>
 
@@ -66,4 +67,227 @@ void fast_AAT(const CSC &A,
 	}
 }
 
+//! @brief the same for BS x BS blocks, AAT is e.g. from AAT_pattern
+template <typename T, typename INT, int BS>
+void fast_AAT(const hj::sparse::bcsc<T, INT, BS> &A,
+			  hj::sparse::bcsc<T, INT, BS> &AAT,
+			  bool is_A_sorted = false,
+			  int which_part = 0)
+{
+  using namespace std;
+
+	if(which_part == -1) {
+		cerr << "not support currently." << endl;
+		return;
+	}
+	fill(AAT.val().begin(), AAT.val().end(), T(0));
+	assert(A.bsize(1) == AAT.bsize(1) && A.bsize(1) == AAT.bsize(2));
+	const INT n = A.bsize(2);
+	INT i, col_i, row_i;
+	for(i = 0; i < n; ++i) {
+		for(col_i = A.ptr()[i]; col_i < A.ptr()[i+1]; ++col_i) {	// for each nz block column
+			const INT col_idx_of_AAT = A.idx()[col_i];
+			const INT nz_beg = AAT.ptr()[col_idx_of_AAT], nz_end = AAT.ptr()[col_idx_of_AAT+1];
+			const T *b = A.block(col_i);
+			for(row_i = A.ptr()[i]; row_i < A.ptr()[i+1]; ++row_i) {	// for each nz block row
+				if(A.idx()[row_i] > col_idx_of_AAT) {
+					if(is_A_sorted) break;
+					else continue;
+				}
+				const INT nz_of_AAT =
+					lower_bound(&AAT.idx()[nz_beg], &AAT.idx()[0]+nz_end, A.idx()[row_i])
+					-&AAT.idx()[0];
+				// += a*b^T
+				const T *a = A.block(row_i);
+				T *c = AAT.block(nz_of_AAT);
+				for(int cj = 0; cj < BS; ++cj)
+					for(int k = 0; k < BS; ++k)
+						for(int ri = 0; ri < BS; ++ri)
+							c[ri+cj*BS] += a[ri+k*BS]*b[cj+k*BS];
+			}
+		}
+	}
+
+	// get another part as transposed blocks
+	for(INT ci = 0; ci < AAT.bsize(2) && which_part == 0; ++ci) {
+		for(INT nzi = AAT.ptr()[ci]; nzi < AAT.ptr()[ci+1]; ++nzi) {
+			const INT ri = AAT.idx()[nzi];
+			if(ri > ci) {
+				const INT offset = lower_bound(&AAT.idx()[AAT.ptr()[ri]], &AAT.idx()[0]+AAT.ptr()[ri+1], ci)-&AAT.idx()[0];
+				const T *u = AAT.block(offset);
+				T *l = AAT.block(nzi);
+				for(int c = 0; c < BS; ++c)
+					for(int r = 0; r < BS; ++r)
+						l[r+c*BS] = u[c+r*BS];
+			}
+		}
+	}
+}
+
+//! @brief fast_AAT split into a symbolic phase, run once for the
+//! patterns of A and AAT, and a numeric phase without searches.
+//!
+//! For each column J of AAT the plan keeps the entries A(J, i) and,
+//! for each of them, the entries A(I, i) of column i with their offsets
+//! in AAT, so the numeric phase is parallel over the columns of AAT and
+//! every thread writes its own columns only.  The other triangle is
+//! copied through precomputed offsets.
+//!
+//! @param which_part: -1 lower, 0 full, 1 upper
+template <typename INT_TYPE>
+class fast_AAT_plan
+{
+public:
+	fast_AAT_plan():which_part_(0) { clear(); }
+	template <typename CSC1, typename CSC2>
+	fast_AAT_plan(const CSC1 &A, const CSC2 &AAT, int which_part = 0) {
+		analyze(A, AAT, which_part);
+	}
+
+	//! @return 0 on success, 1 if the pattern of AAT misses an entry
+	template <typename CSC1, typename CSC2>
+	int analyze(const CSC1 &A, const CSC2 &AAT, int which_part = 0) {
+		using namespace std;
+		which_part_ = which_part;
+		const INT_TYPE m = A.size(1), n = A.size(2);
+		const INT_TYPE *ptr = &A.ptr()[0], *idx = ptr[n] ? &A.idx()[0] : 0;
+		const INT_TYPE *cptr = &AAT.ptr()[0], *cidx = cptr[m] ? &AAT.idx()[0] : 0;
+		assert(AAT.size(1) == m && AAT.size(2) == m);
+		cols_ = m;
+
+		// the entries of A by row: column J of AAT takes A(J, i)
+		row_ptr_.assign(m+1, 0);
+		for(INT_TYPE vi = ptr[0]; vi < ptr[n]; ++vi)
+			++row_ptr_[idx[vi]+1];
+		for(INT_TYPE r = 0; r < m; ++r)
+			row_ptr_[r+1] += row_ptr_[r];
+		const INT_TYPE ng = row_ptr_[m];
+		vector<INT_TYPE> pos(row_ptr_.begin(), row_ptr_.end()-1), group_col(ng);
+		group_val_.resize(ng);
+		for(INT_TYPE c = 0; c < n; ++c)
+			for(INT_TYPE vi = ptr[c]; vi < ptr[c+1]; ++vi) {
+				const INT_TYPE g = pos[idx[vi]]++;
+				group_val_[g] = vi;
+				group_col[g] = c;
+			}
+
+		// count, then fill the terms of each group
+		term_ptr_.assign(ng+1, 0);
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+		for(INT_TYPE J = 0; J < m; ++J)
+			for(INT_TYPE g = row_ptr_[J]; g < row_ptr_[J+1]; ++g) {
+				const INT_TYPE c = group_col[g];
+				size_t cnt = 0;
+				for(INT_TYPE vi = ptr[c]; vi < ptr[c+1]; ++vi)
+					cnt += in_part(idx[vi], J);
+				term_ptr_[g+1] = cnt;
+			}
+		for(INT_TYPE g = 0; g < ng; ++g)
+			term_ptr_[g+1] += term_ptr_[g];
+		term_val_.resize(term_ptr_[ng]);
+		term_dst_.resize(term_ptr_[ng]);
+		int missing = 0;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(dynamic, 256) reduction(+:missing)
+#endif
+		for(INT_TYPE J = 0; J < m; ++J)
+			for(INT_TYPE g = row_ptr_[J]; g < row_ptr_[J+1]; ++g) {
+				const INT_TYPE c = group_col[g];
+				size_t t = term_ptr_[g];
+				for(INT_TYPE vi = ptr[c]; vi < ptr[c+1]; ++vi) {
+					if(!in_part(idx[vi], J)) continue;
+					const INT_TYPE *p = lower_bound(cidx+cptr[J], cidx+cptr[J+1], idx[vi]);
+					if(p == cidx+cptr[J+1] || *p != idx[vi]) {
+						++missing;
+						p = cidx+cptr[J];	// keep the plan harmless
+					}
+					term_val_[t] = vi;
+					term_dst_[t] = INT_TYPE(p-cidx);
+					++t;
+				}
+			}
+
+		// the other triangle of a full AAT
+		mirror_dst_.clear();
+		mirror_src_.clear();
+		for(INT_TYPE J = 0; J < m && which_part == 0; ++J)
+			for(INT_TYPE nzi = cptr[J]; nzi < cptr[J+1]; ++nzi) {
+				const INT_TYPE I = cidx[nzi];
+				if(I <= J) continue;
+				const INT_TYPE *p = lower_bound(cidx+cptr[I], cidx+cptr[I+1], J);
+				if(p == cidx+cptr[I+1] || *p != J) {
+					++missing;
+					continue;
+				}
+				mirror_dst_.push_back(nzi);
+				mirror_src_.push_back(INT_TYPE(p-cidx));
+			}
+		if(missing) {
+			clear();
+			return 1;
+		}
+		return 0;
+	}
+
+	//! @brief AAT = A*A', A and AAT have the patterns of analyze
+	template <typename CSC1, typename CSC2>
+	void operator()(const CSC1 &A, CSC2 &AAT) const {
+		typedef typename CSC2::val_type val_type;
+		assert(INT_TYPE(A.size(1)) == cols_ && INT_TYPE(AAT.size(2)) == cols_);
+		const INT_TYPE *cptr = &AAT.ptr()[0];
+		if(cptr[cols_] == 0) return;
+		const typename CSC1::val_type *val = A.nnz() ? &A.val()[0] : 0;
+		val_type *cval = &AAT.val()[0];
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel
+#endif
+		{
+#if HJ_SPARSE_USE_OMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+			for(INT_TYPE J = 0; J < cols_; ++J) {
+				std::fill(cval+cptr[J], cval+cptr[J+1], val_type(0));
+				for(INT_TYPE g = row_ptr_[J]; g < row_ptr_[J+1]; ++g) {
+					const val_type aJ = val[group_val_[g]];
+					for(size_t t = term_ptr_[g]; t < term_ptr_[g+1]; ++t)
+						cval[term_dst_[t]] += val[term_val_[t]]*aJ;
+				}
+			}
+#if HJ_SPARSE_USE_OMP
+#pragma omp for
+#endif
+			for(INT_TYPE k = 0; k < INT_TYPE(mirror_dst_.size()); ++k)
+				cval[mirror_dst_[k]] = cval[mirror_src_[k]];
+		}
+	}
+
+	//! @brief number of multiply-adds of the numeric phase
+	size_t terms(void) const { return term_val_.size(); }
+
+	void clear(void) {
+		cols_ = 0;
+		row_ptr_.assign(1, 0);
+		group_val_.clear();
+		term_ptr_.assign(1, 0);
+		term_val_.clear();
+		term_dst_.clear();
+		mirror_dst_.clear();
+		mirror_src_.clear();
+	}
+
+private:
+	bool in_part(INT_TYPE I, INT_TYPE J) const {
+		return (which_part_ < 0) ? (I >= J) : (I <= J);
+	}
+
+	int which_part_;
+	INT_TYPE cols_;
+	std::vector<INT_TYPE> row_ptr_, group_val_;	// entries A(J, i) of column J of AAT
+	std::vector<size_t> term_ptr_;
+	std::vector<INT_TYPE> term_val_, term_dst_;	// A(I, i) and the offset of AAT(I, J)
+	std::vector<INT_TYPE> mirror_dst_, mirror_src_;
+};
+
 #endif
@@ -255,6 +255,62 @@ inline INT_TYPE nnz(const csc<T, INT_TYPE> &A) {
 	return A.nnz();
 }
 
+//! @brief bcsc: csc of BS x BS dense blocks, e.g. the Hessian of a
+//! function of 3d vertices.  ptr and idx index block columns and block
+//! rows, the column major blocks follow each other in val.  size and
+//! nnz count scalars, bsize and nnzb count blocks.
+template <typename T = double, typename INT_TYPE = idx_type, int BS = 3>
+class bcsc
+{
+public:
+  typedef T val_type;
+  typedef INT_TYPE int_type;
+  enum { block_size = BS, block_nnz = BS*BS };
+
+	bcsc() { resize(0, 0); }
+	bcsc(INT_TYPE brows, INT_TYPE bcols, INT_TYPE nnzb = 0) {
+		resize(brows, bcols, nnzb);
+	}
+	void resize(INT_TYPE brows, INT_TYPE bcols, INT_TYPE nnzb = 0) {
+		assert(brows >= 0 && bcols >= 0 && nnzb >= 0);
+		brows_ = brows;
+		ptr_.resize(bcols+1);
+		ptr_[0] = 0;
+		idx_.resize(nnzb);
+		val_.resize(nnzb*BS*BS);
+	}
+	size_type size(int dim) const { return BS*bsize(dim); }
+	size_type bsize(int dim) const {
+		return (dim == 1)?brows_:(ptr_.size()-1);
+	}
+
+  size_type nnz(void) const { return val_.size(); }
+  size_type nnzb(void) const { return idx_.size(); }
+
+  //! @brief the k-th block
+  const T *block(INT_TYPE k) const { return &val_[k*BS*BS]; }
+  T *block(INT_TYPE k) { return &val_[k*BS*BS]; }
+
+  const zjucad::matrix::matrix<INT_TYPE> &ptr() const { return ptr_; }
+  zjucad::matrix::matrix<INT_TYPE> &ptr() { return ptr_; }
+
+  const zjucad::matrix::matrix<INT_TYPE> &idx() const { return idx_; }
+  zjucad::matrix::matrix<INT_TYPE> &idx() { return idx_; }
+
+  const zjucad::matrix::matrix<T> &val() const { return val_; }
+  zjucad::matrix::matrix<T> &val() { return val_; }
+
+private:
+	INT_TYPE brows_;
+	zjucad::matrix::matrix<INT_TYPE> ptr_, idx_;
+	zjucad::matrix::matrix<T> val_;
+};
+
+template <typename T, typename INT_TYPE, int BS>
+inline INT_TYPE nnz(const bcsc<T, INT_TYPE, BS> &A) {
+	return A.nnz();
+}
+
 //! @brief csc_by_vm: csc by vector<map_vec>
 
 template <typename VAL_TYPE = double, typename INT_TYPE = idx_type,
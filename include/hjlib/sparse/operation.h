@@ -2,6 +2,7 @@
 #define HJ_SPARSE_OPERATION_H_
 
 #include "format.h"
+#include "spmv.h"
 
 namespace hj { namespace sparse {
 
@@ -74,19 +75,7 @@ M2 &mm(bool transA, const csc<T, INT_TYPE> &A,
 	assert(B().size(1) == (transA?A.size(1):A.size(2)));
 	assert(C().size(1) == (transA?A.size(2):A.size(1))
 		   && C().size(2) == B().size(2));
-#define mm_OP(op) \
-	for(INT_TYPE ci = 0; ci < A.size(2); ++ci) { for(; vi < A.ptr()[ci+1]; ++vi) { \
-		op;\
-	}}
-
-	INT_TYPE vi = A.ptr()[0];
-	if(transA) {
-		mm_OP(C()(ci, colon()) += A.val()[vi]*B()(A.idx()[vi], colon()));
-	}
-	else {
-		mm_OP(C()(A.idx()[vi], colon()) += A.val()[vi]*B()(ci, colon()));
-	}
-#undef mm_OP
+	spmv_dispatch<spmv_raw<csc<T, INT_TYPE>, M1, M2>::value>::mm(transA, A, B(), C());
 	return C();
 }
 
@@ -94,20 +83,7 @@ M2 &mm(bool transA, const csc<T, INT_TYPE> &A,
 template <typename CSC, typename V1, typename V2>
 V2 &mv(bool transA, const CSC &A, const V1 &x, V2 &y)
 {
-#define mv_OP(op) \
-	for(size_type ci = 0; ci < A.size(2); ++ci) { \
-		for(; vi < A.ptr()[ci+1]; ++vi) {		  \
-			op;									  \
-		}}
-
-	typename CSC::int_type vi = A.ptr()[0];
-	if(transA) {
-		mv_OP(y[ci] += A.val()[vi]*x[A.idx()[vi]]);
-	}
-	else {
-		mv_OP(y[A.idx()[vi]] += A.val()[vi]*x[ci]);
-	}
-#undef mv_OP
+	spmv_dispatch<spmv_raw<CSC, V1, V2>::value>::mv(transA, A, x, y);
 	return y;
 }
 
@@ -137,6 +113,138 @@ csc<T2, INT_TYPE2> &trans(const csc<T1, INT_TYPE1> &A,csc<T2, INT_TYPE2> &AT)
 	return AT;
 }
 
+//! @brief transpose of BS x BS blocks
+template <typename T1, typename INT_TYPE1, typename T2, typename INT_TYPE2, int BS>
+bcsc<T2, INT_TYPE2, BS> &trans(const bcsc<T1, INT_TYPE1, BS> &A, bcsc<T2, INT_TYPE2, BS> &AT)
+{
+	const INT_TYPE1 nzb = A.nnzb(), brows = A.bsize(1), bcols = A.bsize(2);
+	AT.resize(bcols, brows, nzb);
+	std::fill(AT.ptr().begin(), AT.ptr().end(), INT_TYPE2(0));
+	for(INT_TYPE1 k = 0; k < nzb; ++k)
+		++AT.ptr()[A.idx()[k]+1];
+	for(INT_TYPE1 i = 0; i < brows; ++i)
+		AT.ptr()[i+1] += AT.ptr()[i];
+	std::vector<INT_TYPE2> pos(AT.ptr().begin(), AT.ptr().end()-1);
+	for(INT_TYPE1 j = 0; j < bcols; ++j) {
+		for(INT_TYPE1 k = A.ptr()[j]; k < A.ptr()[j+1]; ++k) {
+			const INT_TYPE2 kt = pos[A.idx()[k]]++;
+			AT.idx()[kt] = j;
+			const T1 *blk = A.block(k);
+			T2 *blkt = AT.block(kt);
+			for(int c = 0; c < BS; ++c)
+				for(int r = 0; r < BS; ++r)
+					blkt[c+r*BS] = blk[r+c*BS];
+		}
+	}
+	return AT;
+}
+
+//! @brief y += A*x with BS x BS blocks
+template <typename T, typename INT_TYPE, int BS, typename V1, typename V2>
+V2 &mv(bool transA, const bcsc<T, INT_TYPE, BS> &A, const V1 &x, V2 &y)
+{
+	spmv_block(transA, A, x, y);
+	return y;
+}
+
+//! @brief the sorted full block pattern of A*A', with zero values for
+//! fast_AAT.  Found with a marker like the csc one below.
+template <typename T1, typename INT_TYPE1, typename T2, typename INT_TYPE2, int BS>
+bcsc<T2, INT_TYPE2, BS> &AAT_pattern(const bcsc<T1, INT_TYPE1, BS> &A, bcsc<T2, INT_TYPE2, BS> &AAT)
+{
+	const INT_TYPE1 m = A.bsize(1), n = A.bsize(2);
+	// the block columns of A by block row
+	std::vector<INT_TYPE1> row_ptr(m+1, 0), row_col(A.ptr()[n]);
+	for(INT_TYPE1 vi = 0; vi < A.ptr()[n]; ++vi)
+		++row_ptr[A.idx()[vi]+1];
+	for(INT_TYPE1 r = 0; r < m; ++r)
+		row_ptr[r+1] += row_ptr[r];
+	std::vector<INT_TYPE1> pos(row_ptr.begin(), row_ptr.end()-1), mark(m, -1);
+	for(INT_TYPE1 c = 0; c < n; ++c)
+		for(INT_TYPE1 vi = A.ptr()[c]; vi < A.ptr()[c+1]; ++vi)
+			row_col[pos[A.idx()[vi]]++] = c;
+
+	std::vector<INT_TYPE2> ptr(m+1, 0);
+	for(int fill = 0; fill < 2; ++fill) {	// count, then fill
+		std::fill(mark.begin(), mark.end(), INT_TYPE1(-1));
+		for(INT_TYPE1 J = 0; J < m; ++J) {
+			const INT_TYPE2 beg = fill ? ptr[J] : 0;
+			INT_TYPE2 nzi = beg;
+			for(INT_TYPE1 k = row_ptr[J]; k < row_ptr[J+1]; ++k) {
+				const INT_TYPE1 c = row_col[k];
+				for(INT_TYPE1 vi = A.ptr()[c]; vi < A.ptr()[c+1]; ++vi) {
+					const INT_TYPE1 I = A.idx()[vi];
+					if(mark[I] == J) continue;
+					mark[I] = J;
+					if(fill) AAT.idx()[nzi] = I;
+					++nzi;
+				}
+			}
+			if(!fill)
+				ptr[J+1] = nzi;
+			else if(nzi > beg)
+				std::sort(&AAT.idx()[0]+beg, &AAT.idx()[0]+nzi);
+		}
+		if(!fill) {
+			for(INT_TYPE1 J = 0; J < m; ++J)
+				ptr[J+1] += ptr[J];
+			AAT.resize(m, m, ptr[m]);
+			std::copy(ptr.begin(), ptr.end(), &AAT.ptr()[0]);
+		}
+	}
+	std::fill(AAT.val().begin(), AAT.val().end(), T2(0));
+	return AAT;
+}
+
+//! @brief the sorted pattern of A*A', with zero values for
+//! fast_AAT_plan.  Column J is the union of the columns of A with an
+//! entry in row J, found with a marker instead of maps.
+template <typename T1, typename INT_TYPE1, typename T2, typename INT_TYPE2>
+csc<T2, INT_TYPE2> &AAT_pattern(const csc<T1, INT_TYPE1> &A, csc<T2, INT_TYPE2> &AAT)
+{
+	const INT_TYPE1 m = A.size(1), n = A.size(2);
+	// the columns of A by row
+	std::vector<INT_TYPE1> row_ptr(m+1, 0), row_col(A.ptr()[n]);
+	for(INT_TYPE1 vi = 0; vi < A.ptr()[n]; ++vi)
+		++row_ptr[A.idx()[vi]+1];
+	for(INT_TYPE1 r = 0; r < m; ++r)
+		row_ptr[r+1] += row_ptr[r];
+	std::vector<INT_TYPE1> pos(row_ptr.begin(), row_ptr.end()-1), mark(m, -1);
+	for(INT_TYPE1 c = 0; c < n; ++c)
+		for(INT_TYPE1 vi = A.ptr()[c]; vi < A.ptr()[c+1]; ++vi)
+			row_col[pos[A.idx()[vi]]++] = c;
+
+	AAT.resize(m, m);
+	AAT.ptr()[0] = 0;
+	for(int fill = 0; fill < 2; ++fill) {	// count, then fill
+		std::fill(mark.begin(), mark.end(), INT_TYPE1(-1));
+		for(INT_TYPE1 J = 0; J < m; ++J) {
+			const INT_TYPE2 beg = fill ? AAT.ptr()[J] : 0;
+			INT_TYPE2 nzi = beg;
+			for(INT_TYPE1 k = row_ptr[J]; k < row_ptr[J+1]; ++k) {
+				const INT_TYPE1 c = row_col[k];
+				for(INT_TYPE1 vi = A.ptr()[c]; vi < A.ptr()[c+1]; ++vi) {
+					const INT_TYPE1 I = A.idx()[vi];
+					if(mark[I] == J) continue;
+					mark[I] = J;
+					if(fill) AAT.idx()[nzi] = I;
+					++nzi;
+				}
+			}
+			if(!fill)
+				AAT.ptr()[J+1] = AAT.ptr()[J]+nzi;
+			else if(nzi > beg)
+				std::sort(&AAT.idx()[0]+beg, &AAT.idx()[0]+nzi);
+		}
+		if(!fill) {
+			AAT.idx().resize(AAT.ptr()[m]);
+			AAT.val().resize(AAT.ptr()[m]);
+		}
+	}
+	std::fill(AAT.val().begin(), AAT.val().end(), T2(0));
+	return AAT;
+}
+
 //! @brief compute AAT += A*A'
 //! NOTICE AAT must be preallocated
 template <typename T1, typename INT_TYPE1,
@@ -146,8 +254,8 @@ csc_by_vm<T2, INT_TYPE2, MAP_TYPE> &
 acc_AAT(const csc<T1, INT_TYPE1> &A, csc_by_vm<T2, INT_TYPE2, MAP_TYPE> &AAT)
 {
 	assert(A.size(1) == AAT.size(1) && A.size(1) == AAT.size(2));
-	const INT_TYPE2 n = A.size(2);
-	INT_TYPE2 i, col_i = 0, row_i = 0;
+	const INT_TYPE1 n = A.size(2);
+	INT_TYPE1 i, col_i = 0, row_i = 0;
 	for(i = 0; i < n; ++i) {	// vector outer product: vvT(i, j) = vi*vj, for each v
 		for(col_i = A.ptr()[i]; col_i < A.ptr()[i+1]; ++col_i) {	// for each nz column
       //			if(A.val()[col_i] == 0) continue;
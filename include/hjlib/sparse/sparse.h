@@ -4,5 +4,6 @@
 #include "format.h"
 #include "convert.h"
 #include "operation.h"
+#include "triplet.h"
 
 #endif
@@ -0,0 +1,489 @@
+#ifndef HJ_SPARSE_SPMV_H_
+#define HJ_SPARSE_SPMV_H_
+
+#include <vector>
+#include <algorithm>
+
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/remove_const.hpp>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+#include <zjucad/matrix/itr_matrix.h>
+
+#include "format.h"
+
+//! @brief parallel y += op(A)*x kernels on the raw csc arrays, used by
+//! mv and mm in operation.h when the vectors are contiguous.
+//!
+//! op(A) = A^T is a gather: every column of A is a dot product with x,
+//! the columns are split among threads by nnz.  op(A) = A scatters into
+//! y, it runs on per thread copies of y which are summed up, or as a
+//! gather on the cached row structure of spmv_plan.
+//!
+//! The values of A may be float with double vectors, they are widened
+//! when loaded and the sums are in double, which halves the bandwidth
+//! of A in iterative solvers.
+
+#ifndef HJ_SPARSE_USE_OMP
+#  ifdef _OPENMP
+#    define HJ_SPARSE_USE_OMP 1
+#  else
+#    define HJ_SPARSE_USE_OMP 0
+#  endif
+#endif
+
+//! minimal nnz to go parallel
+#ifndef HJ_SPARSE_OMP_NNZ
+#  define HJ_SPARSE_OMP_NNZ (1<<15)
+#endif
+
+namespace hj { namespace sparse {
+
+inline int spmv_max_threads(void) {
+#if HJ_SPARSE_USE_OMP && defined(_OPENMP)
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+//! @brief columns [b, e) of the p-th of np parts with equal nnz
+template <typename INT>
+void spmv_partition(const INT *ptr, INT n, int np, int p, INT &b, INT &e)
+{
+	const double nz = double(ptr[n]-ptr[0]);
+	b = (p == 0) ? 0 : INT(std::lower_bound(ptr, ptr+n, ptr[0]+INT(nz*p/np))-ptr);
+	e = (p+1 == np) ? n : INT(std::lower_bound(ptr, ptr+n, ptr[0]+INT(nz*(p+1)/np))-ptr);
+}
+
+//! @brief sum of val[perm[k]]*x[idx[k]] for k in [b, e), no perm if 0
+template <typename T, typename TA, typename INT>
+T spmv_dot(const TA *val, const INT *perm, const INT *idx, INT b, INT e, const T *x)
+{
+	T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	INT k = b;
+	if(perm) {
+		for(; k+4 <= e; k += 4) {
+			s0 += val[perm[k]]*x[idx[k]];
+			s1 += val[perm[k+1]]*x[idx[k+1]];
+			s2 += val[perm[k+2]]*x[idx[k+2]];
+			s3 += val[perm[k+3]]*x[idx[k+3]];
+		}
+		for(; k < e; ++k) s0 += val[perm[k]]*x[idx[k]];
+	}
+	else {
+		for(; k+4 <= e; k += 4) {
+			s0 += val[k]*x[idx[k]];
+			s1 += val[k+1]*x[idx[k+1]];
+			s2 += val[k+2]*x[idx[k+2]];
+			s3 += val[k+3]*x[idx[k+3]];
+		}
+		for(; k < e; ++k) s0 += val[k]*x[idx[k]];
+	}
+	return (s0+s1)+(s2+s3);
+}
+
+//! @brief spmv_dot, specialized for the vector types with SIMD gathers
+template <typename T, typename INT>
+struct spmv_kernel {
+	template <typename TA>
+	static T dot(const TA *val, const INT *perm, const INT *idx, INT b, INT e, const T *x) {
+		return spmv_dot(val, perm, idx, b, e, x);
+	}
+};
+
+#ifdef __AVX2__
+template <typename INT, int SIZE = sizeof(INT)>
+struct spmv_avx2_gather;
+
+template <typename INT>
+struct spmv_avx2_gather<INT, 4> {
+	static __m256d load(const double *x, const INT *i) {
+		return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x, _mm_loadu_si128((const __m128i *)i),
+										 _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+	}
+	static __m256d load(const float *x, const INT *i) {
+		return _mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), x, _mm_loadu_si128((const __m128i *)i),
+													 _mm_castsi128_ps(_mm_set1_epi32(-1)), 4));
+	}
+};
+
+template <typename INT>
+struct spmv_avx2_gather<INT, 8> {
+	static __m256d load(const double *x, const INT *i) {
+		return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), x, _mm256_loadu_si256((const __m256i *)i),
+										 _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+	}
+	static __m256d load(const float *x, const INT *i) {
+		return _mm256_cvtps_pd(_mm256_mask_i64gather_ps(_mm_setzero_ps(), x, _mm256_loadu_si256((const __m256i *)i),
+														_mm_castsi128_ps(_mm_set1_epi32(-1)), 4));
+	}
+};
+
+inline __m256d spmv_avx2_load(const double *val) { return _mm256_loadu_pd(val); }
+inline __m256d spmv_avx2_load(const float *val) { return _mm256_cvtps_pd(_mm_loadu_ps(val)); }
+
+template <typename INT>
+struct spmv_kernel<double, INT> {
+	template <typename TA>
+	static double dot(const TA *val, const INT *perm, const INT *idx, INT b, INT e, const double *x) {
+		return spmv_dot(val, perm, idx, b, e, x);
+	}
+	static double dot(const double *val, const INT *perm, const INT *idx, INT b, INT e, const double *x) {
+		return simd(val, perm, idx, b, e, x);
+	}
+	static double dot(const float *val, const INT *perm, const INT *idx, INT b, INT e, const double *x) {
+		return simd(val, perm, idx, b, e, x);
+	}
+
+private:
+	template <typename TA>
+	static double simd(const TA *val, const INT *perm, const INT *idx, INT b, INT e, const double *x) {
+		typedef spmv_avx2_gather<INT> G;
+		__m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+		INT k = b;
+		for(; k+8 <= e; k += 8) {
+			const __m256d v0 = perm ? G::load(val, perm+k) : spmv_avx2_load(val+k);
+			const __m256d v1 = perm ? G::load(val, perm+k+4) : spmv_avx2_load(val+k+4);
+			s0 = _mm256_add_pd(s0, _mm256_mul_pd(v0, G::load(x, idx+k)));
+			s1 = _mm256_add_pd(s1, _mm256_mul_pd(v1, G::load(x, idx+k+4)));
+		}
+		double t[4];
+		_mm256_storeu_pd(t, _mm256_add_pd(s0, s1));
+		double s = 0;
+		for(; k < e; ++k) s += (perm ? val[perm[k]] : val[k])*x[idx[k]];
+		return (t[0]+t[1])+(t[2]+t[3])+s;
+	}
+};
+#endif
+
+//! @brief y += A^T*x, A is the csc (n, ptr, idx, val[perm]) with n
+//! columns, perm may be 0
+template <typename TA, typename T, typename INT>
+void spmv_gather(INT n, const INT *ptr, const INT *idx, const TA *val, const INT *perm,
+				 const T *x, T *y)
+{
+	const int np = (ptr[n]-ptr[0] >= HJ_SPARSE_OMP_NNZ) ? spmv_max_threads() : 1;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for if(np > 1) schedule(static, 1)
+#endif
+	for(int p = 0; p < np; ++p) {
+		INT b, e;
+		spmv_partition(ptr, n, np, p, b, e);
+		for(INT ci = b; ci < e; ++ci)
+			y[ci] += spmv_kernel<T, INT>::dot(val, perm, idx, ptr[ci], ptr[ci+1], x);
+	}
+}
+
+//! @brief y += A*x for a rows x n csc A
+template <typename TA, typename T, typename INT>
+void spmv_scatter(INT rows, INT n, const INT *ptr, const INT *idx, const TA *val,
+				  const T *x, T *y)
+{
+	const INT nz = ptr[n]-ptr[0];
+	const int np = spmv_max_threads();
+	// the copies of y cost 2*rows per thread
+	if(!HJ_SPARSE_USE_OMP || np == 1 || nz < HJ_SPARSE_OMP_NNZ || double(rows)*np > 2.0*nz) {
+		for(INT ci = 0; ci < n; ++ci) {
+			const T xc = x[ci];
+			for(INT vi = ptr[ci]; vi < ptr[ci+1]; ++vi)
+				y[idx[vi]] += val[vi]*xc;
+		}
+		return;
+	}
+	std::vector<T> buf(size_t(rows)*(np-1), T(0));
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+	for(int p = 0; p < np; ++p) {
+		T *yp = p ? &buf[size_t(rows)*(p-1)] : y;
+		INT b, e;
+		spmv_partition(ptr, n, np, p, b, e);
+		for(INT ci = b; ci < e; ++ci) {
+			const T xc = x[ci];
+			for(INT vi = ptr[ci]; vi < ptr[ci+1]; ++vi)
+				yp[idx[vi]] += val[vi]*xc;
+		}
+	}
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for
+#endif
+	for(INT i = 0; i < rows; ++i) {
+		T s = 0;
+		for(int p = 1; p < np; ++p) s += buf[size_t(rows)*(p-1)+i];
+		y[i] += s;
+	}
+}
+
+//! @brief y += op(A)*x for a bcsc A, the block version of spmv_gather
+//! and spmv_scatter on any vectors with operator[]
+template <typename BCSC, typename V1, typename V2>
+void spmv_block(bool transA, const BCSC &A, const V1 &x, V2 &y)
+{
+	typedef typename BCSC::val_type T;
+	typedef typename BCSC::int_type INT;
+	enum { BS = BCSC::block_size };
+	const INT n = INT(A.bsize(2)), rows = INT(A.size(1));
+	if(A.nnzb() == 0) return;
+	const INT *ptr = &A.ptr()[0], *idx = &A.idx()[0];
+	const T *val = &A.val()[0];
+	const INT nz = INT(A.nnz());
+	int np = (nz >= HJ_SPARSE_OMP_NNZ) ? spmv_max_threads() : 1;
+	if(transA) {
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for if(np > 1) schedule(static, 1)
+#endif
+		for(int p = 0; p < np; ++p) {
+			INT b, e;
+			spmv_partition(ptr, n, np, p, b, e);
+			for(INT bj = b; bj < e; ++bj) {
+				T s[BS] = {0};
+				for(INT k = ptr[bj]; k < ptr[bj+1]; ++k) {
+					const T *blk = val+k*BS*BS;
+					const INT r0 = idx[k]*BS;
+					for(int c = 0; c < BS; ++c)
+						for(int r = 0; r < BS; ++r)
+							s[c] += blk[r+c*BS]*x[r0+r];
+				}
+				for(int c = 0; c < BS; ++c)
+					y[bj*BS+c] += s[c];
+			}
+		}
+		return;
+	}
+	// the copies of y cost 2*rows per thread
+	if(!HJ_SPARSE_USE_OMP || double(rows)*np > 2.0*nz)
+		np = 1;
+	std::vector<T> buf(size_t(rows)*(np-1), T(0));
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for if(np > 1) schedule(static, 1)
+#endif
+	for(int p = 0; p < np; ++p) {
+		T *yp = p ? &buf[size_t(rows)*(p-1)] : 0;
+		INT b, e;
+		spmv_partition(ptr, n, np, p, b, e);
+		for(INT bj = b; bj < e; ++bj) {
+			T xc[BS];
+			for(int c = 0; c < BS; ++c) xc[c] = x[bj*BS+c];
+			for(INT k = ptr[bj]; k < ptr[bj+1]; ++k) {
+				const T *blk = val+k*BS*BS;
+				const INT r0 = idx[k]*BS;
+				for(int r = 0; r < BS; ++r) {
+					T s = 0;
+					for(int c = 0; c < BS; ++c) s += blk[r+c*BS]*xc[c];
+					if(yp) yp[r0+r] += s;
+					else y[r0+r] += s;
+				}
+			}
+		}
+	}
+	if(np == 1) return;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for
+#endif
+	for(INT i = 0; i < rows; ++i) {
+		T s = 0;
+		for(int p = 1; p < np; ++p) s += buf[size_t(rows)*(p-1)+i];
+		y[i] += s;
+	}
+}
+
+//! @brief how mv and mm get at the elements of a vector, only
+//! contiguous ones take the raw kernels
+template <typename V>
+struct spmv_vector {
+	enum { value = 0 };
+	typedef void value_type;
+};
+
+template <typename T, typename A, bool tmp>
+struct spmv_vector<zjucad::matrix::matrix<T, zjucad::matrix::column_major, A, tmp> > {
+	enum { value = 1 };
+	typedef T value_type;
+};
+
+template <typename T>
+struct spmv_vector<zjucad::matrix::itr_matrix<T*> > {
+	enum { value = 1 };
+	typedef typename boost::remove_const<T>::type value_type;
+};
+
+template <typename T, typename A>
+struct spmv_vector<std::vector<T, A> > {
+	enum { value = 1 };
+	typedef T value_type;
+};
+
+//! @brief whether the raw kernels take the values TA of A with
+//! vectors of T
+template <typename TA, typename T>
+struct spmv_mixed {
+	enum { value = boost::is_same<TA, T>::value };
+};
+
+template <>
+struct spmv_mixed<float, double> {
+	enum { value = 1 };
+};
+
+//! @brief whether y += op(A)*x may use the raw kernels
+template <typename CSC, typename V1, typename V2>
+struct spmv_raw {
+	enum { value = spmv_vector<V1>::value && spmv_vector<V2>::value
+		   && boost::is_same<typename spmv_vector<V1>::value_type,
+							 typename spmv_vector<V2>::value_type>::value
+		   && spmv_mixed<typename CSC::val_type, typename spmv_vector<V2>::value_type>::value };
+};
+
+//! @brief y += op(A)*x on raw arrays
+template <typename CSC, typename T>
+void spmv(bool transA, const CSC &A, const T *x, T *y)
+{
+	typedef typename CSC::int_type INT;
+	const INT n = INT(A.size(2));
+	const INT *ptr = &A.ptr()[0];
+	if(ptr[n] == ptr[0]) return;
+	if(transA)
+		spmv_gather(n, ptr, &A.idx()[0], &A.val()[0], (const INT *)0, x, y);
+	else
+		spmv_scatter(INT(A.size(1)), n, ptr, &A.idx()[0], &A.val()[0], x, y);
+}
+
+//! @brief C += op(A)*B on raw column major arrays, B and C have k
+//! columns
+template <typename CSC, typename T>
+void spmm(bool transA, const CSC &A, idx_type k, const T *B, idx_type ldb, T *C, idx_type ldc)
+{
+	typedef typename CSC::int_type INT;
+	const INT n = INT(A.size(2));
+	const INT *ptr = &A.ptr()[0], *idx = &A.idx()[0];
+	if(ptr[n] == ptr[0]) return;
+	const typename CSC::val_type *val = &A.val()[0];
+	if(transA || k < spmv_max_threads()) {
+		for(idx_type j = 0; j < k; ++j)
+			spmv(transA, A, B+j*ldb, C+j*ldc);
+		return;
+	}
+	// one column of C per thread
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for
+#endif
+	for(idx_type j = 0; j < k; ++j) {
+		const T *x = B+j*ldb;
+		T *y = C+j*ldc;
+		for(INT ci = 0; ci < n; ++ci) {
+			const T xc = x[ci];
+			for(INT vi = ptr[ci]; vi < ptr[ci+1]; ++vi)
+				y[idx[vi]] += val[vi]*xc;
+		}
+	}
+}
+
+//! @brief raw kernels or the plain loops
+template <bool RAW>
+struct spmv_dispatch {
+	template <typename CSC, typename V1, typename V2>
+	static void mv(bool transA, const CSC &A, const V1 &x, V2 &y) {
+#define spmv_OP(op) \
+		for(size_type ci = 0; ci < A.size(2); ++ci) \
+			for(; vi < A.ptr()[ci+1]; ++vi) { op; }
+
+		typename CSC::int_type vi = A.ptr()[0];
+		if(transA) {
+			spmv_OP(y[ci] += A.val()[vi]*x[A.idx()[vi]]);
+		}
+		else {
+			spmv_OP(y[A.idx()[vi]] += A.val()[vi]*x[ci]);
+		}
+	}
+	template <typename CSC, typename M1, typename M2>
+	static void mm(bool transA, const CSC &A, const M1 &B, M2 &C) {
+		using zjucad::matrix::colon;
+		typename CSC::int_type vi = A.ptr()[0];
+		if(transA) {
+			spmv_OP(C(ci, colon()) += A.val()[vi]*B(A.idx()[vi], colon()));
+		}
+		else {
+			spmv_OP(C(A.idx()[vi], colon()) += A.val()[vi]*B(ci, colon()));
+		}
+#undef spmv_OP
+	}
+};
+
+template <>
+struct spmv_dispatch<true> {
+	template <typename CSC, typename V1, typename V2>
+	static void mv(bool transA, const CSC &A, const V1 &x, V2 &y) {
+		if(x.size() == 0 || y.size() == 0) return;
+		spmv(transA, A, &x[0], &y[0]);
+	}
+	template <typename CSC, typename M1, typename M2>
+	static void mm(bool transA, const CSC &A, const M1 &B, M2 &C) {
+		if(B.size() == 0 || C.size() == 0) return;
+		spmm(transA, A, C.size(2), &B[0], B.size(1), &C[0], C.size(1));
+	}
+};
+
+//! @brief the row structure of a csc A, with which y += A*x is a row
+//! parallel gather.  Only the pattern is kept, the values are read from
+//! A through perm, so A.val() may change between calls.
+template <typename INT_TYPE = idx_type>
+class spmv_plan
+{
+public:
+	typedef INT_TYPE int_type;
+
+	spmv_plan():rows_(0), cols_(0) {}
+	template <typename CSC>
+	explicit spmv_plan(const CSC &A) { analyze(A); }
+
+	template <typename CSC>
+	void analyze(const CSC &A) {
+		rows_ = A.size(1);
+		cols_ = A.size(2);
+		const INT_TYPE *ptr = &A.ptr()[0];
+		const INT_TYPE nz = ptr[cols_]-ptr[0];
+		ptr_.assign(rows_+1, 0);
+		idx_.resize(nz);
+		perm_.resize(nz);
+		if(nz == 0) return;
+		const INT_TYPE *idx = &A.idx()[0];
+		for(INT_TYPE vi = ptr[0]; vi < ptr[cols_]; ++vi)
+			++ptr_[idx[vi]+1];
+		for(INT_TYPE ri = 0; ri < rows_; ++ri)
+			ptr_[ri+1] += ptr_[ri];
+		std::vector<INT_TYPE> pos(ptr_.begin(), ptr_.end()-1);
+		for(INT_TYPE ci = 0; ci < cols_; ++ci)
+			for(INT_TYPE vi = ptr[ci]; vi < ptr[ci+1]; ++vi) {
+				const INT_TYPE k = pos[idx[vi]]++;
+				idx_[k] = ci;
+				perm_[k] = vi;
+			}
+	}
+
+	//! @brief y += op(A)*x, A must have the pattern given to analyze
+	template <typename CSC, typename T>
+	void mv(bool transA, const CSC &A, const T *x, T *y) const {
+		assert(A.size(1) == rows_ && A.size(2) == cols_);
+		if(transA || idx_.empty())
+			spmv(transA, A, x, y);
+		else
+			spmv_gather(rows_, &ptr_[0], &idx_[0], &A.val()[0], &perm_[0], x, y);
+	}
+
+	size_type size(int dim) const { return (dim == 1) ? rows_ : cols_; }
+
+private:
+	INT_TYPE rows_, cols_;
+	std::vector<INT_TYPE> ptr_, idx_, perm_;
+};
+
+}}
+
+#endif
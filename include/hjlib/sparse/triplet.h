@@ -0,0 +1,280 @@
+#ifndef HJ_SPARSE_TRIPLET_H_
+#define HJ_SPARSE_TRIPLET_H_
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "format.h"
+#include "spmv.h"
+
+//! @brief assembly of a csc from (row, col, val) triplets without maps.
+//!
+//! Every thread, OpenMP or not and at any level of nesting, appends
+//! to its own buffer, e.g.
+//!
+//!   triplets<double, int> tri(n, n);
+//! #pragma omp parallel for
+//!   for(int e = 0; e < elements; ++e)
+//!     for(...) tri.add(r, c, v);
+//!   csc<double, int> H;
+//!   tri.compress(H);
+//!
+//! compress sorts all triplets by row and then stably by column with
+//! two parallel counting sorts, and sums up duplicates, so the result
+//! has sorted unique rows in each column.
+
+namespace hj { namespace sparse {
+
+inline int triplet_thread_num(void) {
+#if HJ_SPARSE_USE_OMP && defined(_OPENMP)
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+#if __cplusplus >= 201103L
+#  define HJ_SPARSE_TLS thread_local
+#elif defined(_MSC_VER)
+#  define HJ_SPARSE_TLS __declspec(thread)
+#else
+#  define HJ_SPARSE_TLS __thread
+#endif
+
+//! @brief the buffer a thread used last, of the triplets with serial
+//! number id.  Its address tells the threads apart.
+struct triplet_cache {
+	size_t id;
+	void *buf;
+};
+
+inline triplet_cache &triplet_local_cache(void) {
+	static HJ_SPARSE_TLS triplet_cache c = {0, 0};
+	return c;
+}
+
+//! @brief a serial number never given before, from 1
+inline size_t triplet_serial(void) {
+	static size_t next = 0;
+	size_t s;
+#if HJ_SPARSE_USE_OMP
+#pragma omp critical (hj_sparse_triplets)
+#endif
+	s = ++next;
+	return s;
+}
+
+template <typename T = double, typename INT_TYPE = idx_type>
+class triplets
+{
+public:
+	typedef T val_type;
+	typedef INT_TYPE int_type;
+
+	struct entry {
+		INT_TYPE row, col;
+		T val;
+	};
+
+	//! @brief triplets appended by one thread
+	struct buffer {
+		void add(INT_TYPE r, INT_TYPE c, const T &v) {
+			const entry e = {r, c, v};
+			data.push_back(e);
+		}
+		void reserve(size_t n) { data.reserve(n); }
+		size_t size(void) const { return data.size(); }
+		void clear(void) { data.clear(); }
+
+		std::vector<entry> data;
+		const void *owner;	// triplet_local_cache of the thread
+		int rank;			// its OpenMP thread number
+		char pad_[64];	// keep the buffers of two threads apart
+	};
+
+	triplets(INT_TYPE rows = 0, INT_TYPE cols = 0)
+		:rows_(rows), cols_(cols), id_(triplet_serial()), reserve_(0) {}
+	triplets(const triplets &t)
+		:rows_(t.rows_), cols_(t.cols_), id_(triplet_serial()),
+		 reserve_(t.reserve_), bufs_(t.bufs_) {}
+	triplets &operator = (const triplets &t) {
+		rows_ = t.rows_;
+		cols_ = t.cols_;
+		id_ = triplet_serial();
+		reserve_ = t.reserve_;
+		bufs_ = t.bufs_;
+		return *this;
+	}
+
+	void resize(INT_TYPE rows, INT_TYPE cols) {
+		rows_ = rows;
+		cols_ = cols;
+		clear();
+	}
+	size_type size(int dim) const { return (dim == 1) ? rows_ : cols_; }
+
+	//! @brief the buffer of the calling thread, made on its first add.
+	//! Without HJ_SPARSE_USE_OMP only one thread may add at a time.
+	buffer &local(void) {
+		triplet_cache &c = triplet_local_cache();
+		if(c.id != id_) {
+#if HJ_SPARSE_USE_OMP
+#pragma omp critical (hj_sparse_triplets)
+#endif
+			{
+				size_t t = 0;
+				while(t < bufs_.size() && bufs_[t].owner != &c) ++t;
+				if(t == bufs_.size()) {	// deque keeps the other buffers in place
+					bufs_.push_back(buffer());
+					bufs_.back().owner = &c;
+					bufs_.back().rank = triplet_thread_num();
+					bufs_.back().reserve(reserve_);
+				}
+				c.id = id_;
+				c.buf = &bufs_[t];
+			}
+		}
+		return *static_cast<buffer *>(c.buf);
+	}
+	void add(INT_TYPE r, INT_TYPE c, const T &v) {
+		assert(r >= 0 && r < rows_ && c >= 0 && c < cols_);
+		local().add(r, c, v);
+	}
+	//! @param n: expected triplets per thread
+	void reserve(size_t n) {
+		reserve_ = n;
+		for(size_t t = 0; t < bufs_.size(); ++t)
+			bufs_[t].reserve(n);
+	}
+	size_t nnz(void) const {
+		size_t n = 0;
+		for(size_t t = 0; t < bufs_.size(); ++t)
+			n += bufs_[t].size();
+		return n;
+	}
+	void clear(void) {
+		for(size_t t = 0; t < bufs_.size(); ++t)
+			bufs_[t].clear();
+	}
+
+	//! @brief A = sum of the triplets, rows are sorted in each column
+	template <typename T2, typename INT_TYPE2>
+	csc<T2, INT_TYPE2> &compress(csc<T2, INT_TYPE2> &A) const {
+		const int K = std::max(int(bufs_.size()), 1);
+		const size_t n = nnz();
+		std::vector<entry> e1(n), e2(n);
+		std::vector<size_t> beg(K+1, 0), col_beg;
+		std::vector<const entry *> in(K, static_cast<const entry *>(0));
+
+		// by row, from the thread buffers in the order of the thread
+		// numbers, so that duplicates are summed in the same order for
+		// the same schedule
+		std::vector<std::pair<int, size_t> > order(bufs_.size());
+		for(size_t k = 0; k < bufs_.size(); ++k)
+			order[k] = std::make_pair(bufs_[k].rank, k);
+		std::sort(order.begin(), order.end());
+		for(size_t k = 0; k < bufs_.size(); ++k) {
+			const buffer &b = bufs_[order[k].second];
+			beg[k+1] = beg[k]+b.size();
+			in[k] = b.size() ? &b.data[0] : 0;
+		}
+		counting_sort(K, beg, in, &entry::row, rows_, n ? &e1[0] : 0, 0);
+
+		// stable by column, from K equal chunks
+		const int KC = spmv_max_threads();
+		beg.resize(KC+1);
+		in.resize(KC);
+		for(int k = 0; k < KC; ++k) {
+			beg[k+1] = n*(k+1)/KC;
+			in[k] = n ? &e1[0]+beg[k] : 0;
+		}
+		counting_sort(KC, beg, in, &entry::col, cols_, n ? &e2[0] : 0, &col_beg);
+
+		// sum up duplicates
+		A.resize(rows_, cols_);
+		A.ptr()[0] = 0;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+		for(INT_TYPE c = 0; c < cols_; ++c) {
+			INT_TYPE u = 0;
+			for(size_t i = col_beg[c]; i < col_beg[c+1]; ++i)
+				u += (i == col_beg[c] || e2[i].row != e2[i-1].row);
+			A.ptr()[c+1] = u;
+		}
+		for(INT_TYPE c = 0; c < cols_; ++c)
+			A.ptr()[c+1] += A.ptr()[c];
+		A.idx().resize(A.ptr()[cols_]);
+		A.val().resize(A.ptr()[cols_]);
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+		for(INT_TYPE c = 0; c < cols_; ++c) {
+			INT_TYPE o = A.ptr()[c]-1;
+			for(size_t i = col_beg[c]; i < col_beg[c+1]; ++i) {
+				if(i == col_beg[c] || e2[i].row != e2[i-1].row) {
+					A.idx()[++o] = e2[i].row;
+					A.val()[o] = e2[i].val;
+				}
+				else
+					A.val()[o] += e2[i].val;
+			}
+		}
+		return A;
+	}
+
+private:
+	//! @brief stable sort of the K chunks [beg[k], beg[k+1]) starting
+	//! at in[k] by the member key < nkeys into out.  The chunks are
+	//! counted in G groups of consecutive chunks, G is cut down so that
+	//! the G*nkeys counters take no more than the entries.
+	static void counting_sort(int K, const std::vector<size_t> &beg,
+							  const std::vector<const entry *> &in, INT_TYPE entry::*key,
+							  INT_TYPE nkeys, entry *out, std::vector<size_t> *key_beg) {
+		const size_t n = beg[K];
+		int G = K;
+		if(size_t(G)*nkeys > n)
+			G = int(std::max<size_t>(1, n/std::max<size_t>(nkeys, 1)));
+		std::vector<size_t> cnt(size_t(G)*nkeys, 0);	// cnt[g*nkeys+key]
+		int g;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(static, 1) if(G > 1)
+#endif
+		for(g = 0; g < G; ++g) {
+			size_t *cg = cnt.empty() ? 0 : &cnt[size_t(g)*nkeys];
+			for(int k = K*g/G; k < K*(g+1)/G; ++k)
+				for(size_t i = 0; i < beg[k+1]-beg[k]; ++i)
+					++cg[in[k][i].*key];
+		}
+		// key major, then group order
+		size_t s = 0;
+		if(key_beg) key_beg->resize(nkeys+1);
+		for(INT_TYPE j = 0; j < nkeys; ++j) {
+			if(key_beg) (*key_beg)[j] = s;
+			for(g = 0; g < G; ++g) {
+				const size_t c = cnt[size_t(g)*nkeys+j];
+				cnt[size_t(g)*nkeys+j] = s;
+				s += c;
+			}
+		}
+		if(key_beg) (*key_beg)[nkeys] = s;
+#if HJ_SPARSE_USE_OMP
+#pragma omp parallel for schedule(static, 1) if(G > 1)
+#endif
+		for(g = 0; g < G; ++g) {
+			size_t *og = cnt.empty() ? 0 : &cnt[size_t(g)*nkeys];
+			for(int k = K*g/G; k < K*(g+1)/G; ++k)
+				for(size_t i = 0; i < beg[k+1]-beg[k]; ++i)
+					out[og[in[k][i].*key]++] = in[k][i];
+		}
+	}
+
+	INT_TYPE rows_, cols_;
+	size_t id_, reserve_;
+	std::deque<buffer> bufs_;	// in the order of the first add of each thread
+};
+
+}}
+
+#endif
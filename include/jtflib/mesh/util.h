@@ -226,13 +226,15 @@ namespace jtf{
       using namespace zjucad::matrix;
       assert(tet().size(1) == 3);
       if(tet().size(2) == 4) {
-          matrix<typename E::value_type> edges
+          matrix<typename E::value_type, fixed<3, 3> > edges
               = tet()(colon(), colon(1, 3)) - tet()(colon(), 0)*
               ones<typename E::value_type>(1, 3);
-          return cal_tet_vol(edges);
+          return det(edges)/6.0;
+        }
+      if(tet().size(2) == 3) { // fix by jtf, here tet means three edges (3*3)
+          const matrix<typename E::value_type, fixed<3, 3> > edges = tet();
+          return det(edges)/6.0;
         }
-      if(tet().size(2) == 3) // fix by jtf, here tet means three edges (3*3)
-        return dot(cross(tet()(colon(), 0), tet()(colon(), 1)), tet()(colon(), 2))/6.0;
     }
 
     template <typename val_type>
@@ -0,0 +1,536 @@
+#ifndef HJ_BUILTIN_AMG_H_
+#define HJ_BUILTIN_AMG_H_
+
+#include <stddef.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#include "builtin_iterative.h"
+#include "builtin_chol.h"
+
+//! @brief smoothed aggregation algebraic multigrid for SPD matrices
+//! such as mesh Laplacians and elasticity Hessians.
+//!
+//! compute builds the hierarchy: the nodes, i.e. blocks of block_size
+//! unknowns, are aggregated over the graph of strong connections, the
+//! tentative prolongator is piecewise constant for each component, it
+//! is smoothed by one damped Jacobi step and the coarse matrix is
+//! P^T*A*P.  The coarsest level is factorized by builtin_chol.
+//!
+//! apply is one symmetric V-cycle, so builtin_amg is a preconditioner
+//! for pcg, solve iterates V-cycles alone:
+//!
+//!   builtin_amg<int> amg(3);	// xyz of each vertex
+//!   amg.init(n, ptr, idx);
+//!   amg.compute(val);
+//!   pcg(A, amg, b, x, 1e-8, 100);
+//!
+//! With reuse the aggregates of the first compute are kept, a later
+//! compute, e.g. of the next Newton step, only redoes the numeric part.
+//!
+//! The smoother is a hybrid Gauss-Seidel, Gauss-Seidel inside chunks of
+//! rows which are updated in parallel, Jacobi between them.
+
+template <typename INT_TYPE = ptrdiff_t>
+class builtin_amg : public builtin_precond<INT_TYPE>
+{
+public:
+	//! @brief rows x cols csr, of symmetric A also the csc
+	struct matrix {
+		matrix():rows(0), cols(0) {}
+		void apply(const double *x, double *y) const {
+			const INT_TYPE n = rows;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 256) if(val.size() >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+			for(INT_TYPE i = 0; i < n; ++i) {
+				double s = 0;
+				for(INT_TYPE k = ptr[i]; k < ptr[i+1]; ++k)
+					s += val[k]*x[col[k]];
+				y[i] = s;
+			}
+		}
+		size_t size(void) const { return rows; }
+		INT_TYPE rows, cols;
+		std::vector<INT_TYPE> ptr, col;
+		std::vector<double> val;
+	};
+
+	builtin_amg(int block_size = 1, bool reuse = true)
+		:block_size_(block_size), reuse_(reuse), theta_(0.02), coarse_size_(1000),
+		 max_levels_(12), pre_(1), post_(1),
+		 coarse_analysed_(false), coarse_direct_(false) {}
+
+	//! @brief strength threshold of the finest level,
+	//! |A_ij| >= theta*sqrt(|A_ii|*|A_jj|)
+	void set_theta(double theta) { theta_ = theta; }
+	//! @brief stop coarsening at this size
+	void set_coarse_size(INT_TYPE n) { coarse_size_ = n; }
+	void set_max_levels(int l) { max_levels_ = l; }
+	//! @brief smoothing sweeps before and after the coarse correction
+	void set_sweeps(int pre, int post) { pre_ = pre; post_ = post; }
+	//! @brief keep the aggregates of the first compute
+	void set_reuse(bool reuse) { reuse_ = reuse; }
+
+	virtual void init(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx);
+	//! @return 1 if a diagonal entry of a level is missing, not
+	//! positive or not finite
+	virtual int compute(const double *val);
+	virtual void apply(const double *r, double *z) const;
+
+	//! @brief V-cycles x += M*(b-A*x) from the initial x
+	iterative_result solve(const double *b, double *x, double tol, size_t max_iter) const;
+
+	size_t levels(void) const { return levels_.size(); }
+	const matrix &A(size_t l) const { return levels_[l].A; }
+	//! @brief sum of the nonzeros of all levels over those of A
+	double operator_complexity(void) const;
+
+private:
+	struct level {
+		matrix A, P, R;
+		std::vector<double> dinv;
+		std::vector<INT_TYPE> agg;	// aggregate of each node
+		INT_TYPE naggs;
+		mutable std::vector<double> x, b, r, tmp;
+	};
+
+	int setup_level(size_t l, bool grow);
+	void aggregate(const matrix &A, int bs, double theta,
+				   std::vector<INT_TYPE> &agg, INT_TYPE &naggs) const;
+	void prolongator(const level &L, int bs, matrix &P) const;
+	void vcycle(size_t l, const double *b, double *x) const;
+	void smooth(const level &L, const double *b, double *x, bool forward) const;
+
+	static void transpose(const matrix &A, matrix &AT);
+	static void multiply(const matrix &A, const matrix &B, matrix &C);
+	static double spectral_radius(const matrix &A, const std::vector<double> &dinv);
+
+	int block_size_;
+	bool reuse_;
+	double theta_;
+	INT_TYPE coarse_size_;
+	int max_levels_, pre_, post_;
+
+	std::vector<INT_TYPE> full_slot_;	// A.val[e] = Lval[full_slot_[e]]
+	std::vector<level> levels_;
+	builtin_chol<INT_TYPE> coarse_;
+	bool coarse_analysed_, coarse_direct_;
+};
+
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::init(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx)
+{
+	builtin_precond<INT_TYPE>::init(n, ptr, idx);
+	const lower_pattern<INT_TYPE> &L = this->L_;
+	levels_.assign(1, level());
+	matrix &A = levels_[0].A;
+	A.rows = A.cols = n;
+	A.ptr.assign(n+1, 0);
+	for(INT_TYPE j = 0; j < n; ++j)
+		for(INT_TYPE k = L.ptr[j]; k < L.ptr[j+1]; ++k) {
+			++A.ptr[L.row[k]+1];
+			if(L.row[k] != j) ++A.ptr[j+1];
+		}
+	for(INT_TYPE i = 0; i < n; ++i) A.ptr[i+1] += A.ptr[i];
+	A.col.resize(A.ptr[n]);
+	A.val.resize(A.ptr[n]);
+	full_slot_.resize(A.ptr[n]);
+	std::vector<INT_TYPE> pos(A.ptr.begin(), A.ptr.end()-1);
+	// column j of L gives row j of the upper part, in increasing order
+	for(INT_TYPE j = 0; j < n; ++j)
+		for(INT_TYPE k = L.ptr[j]; k < L.ptr[j+1]; ++k) {
+			const INT_TYPE i = L.row[k];
+			INT_TYPE p = pos[i]++;
+			A.col[p] = j;
+			full_slot_[p] = k;
+			if(i != j) {
+				p = pos[j]++;
+				A.col[p] = i;
+				full_slot_[p] = k;
+			}
+		}
+}
+
+template <typename INT_TYPE>
+int builtin_amg<INT_TYPE>::compute(const double *val)
+{
+	if(levels_.empty()) return 1;
+	std::vector<double> Lval;
+	this->L_.gather(val, Lval);
+	matrix &A = levels_[0].A;
+	for(size_t e = 0; e < full_slot_.size(); ++e)
+		A.val[e] = Lval[full_slot_[e]];
+	const size_t nlevels = levels_.size();
+	const bool keep = reuse_ && nlevels > 1;
+	if(!keep) levels_.resize(1);
+	for(size_t l = 0; ; ++l) {
+		const int rtn = setup_level(l, !keep);
+		if(rtn < 0) return 1;
+		if(rtn == 0) {
+			levels_.resize(l+1);
+			break;
+		}
+	}
+	// the pattern of the coarsest level only changes with the aggregates
+	const matrix &C = levels_.back().A;
+	if(!keep || levels_.size() != nlevels || coarse_.size() != C.rows)
+		coarse_analysed_ = !coarse_.analyse(C.rows, &C.ptr[0], C.col.empty() ? 0 : &C.col[0],
+											builtin_chol<INT_TYPE>::NESTED_DISSECTION);
+	coarse_direct_ = coarse_analysed_ && !coarse_.factorize(C.val.empty() ? 0 : &C.val[0]);
+	return 0;
+}
+
+//! @brief the numeric part of level l+1, with grow it may be added
+//! @return 1 if level l+1 is set up, 0 if l is the coarsest, -1 if a
+//! diagonal entry is missing, not positive or not finite, i.e. A is
+//! not SPD and the smoother and the prolongator are undefined
+template <typename INT_TYPE>
+int builtin_amg<INT_TYPE>::setup_level(size_t l, bool grow)
+{
+	level &L = levels_[l];
+	const INT_TYPE n = L.A.rows;
+	const int bs = (n%block_size_ == 0) ? block_size_ : 1;
+	L.dinv.assign(n, 0);
+	for(INT_TYPE i = 0; i < n; ++i) {
+		for(INT_TYPE k = L.A.ptr[i]; k < L.A.ptr[i+1]; ++k)
+			if(L.A.col[k] == i && L.A.val[k] > 0) L.dinv[i] = 1/L.A.val[k];
+		if(!(L.dinv[i] > 0 && L.dinv[i] <= std::numeric_limits<double>::max()))
+			return -1;
+	}
+	L.x.resize(n);
+	L.b.resize(n);
+	L.r.resize(n);
+	L.tmp.resize(n);
+
+	const bool keep = levels_.size() > l+1;
+	if(!keep) {
+		if(!grow || n <= coarse_size_ || int(l)+1 >= max_levels_) return 0;
+		// the threshold halves on each level as in Vanek et al.
+		aggregate(L.A, bs, theta_*std::pow(0.5, double(l)), L.agg, L.naggs);
+		// too slow coarsening does not pay off
+		if(L.naggs == 0 || double(L.naggs)*bs > 0.9*n) return 0;
+	}
+	matrix AP;
+	prolongator(L, bs, L.P);
+	transpose(L.P, L.R);
+	multiply(L.A, L.P, AP);
+	if(!keep) levels_.resize(l+2);
+	level &C = levels_[l+1];
+	multiply(levels_[l].R, AP, C.A);
+	return 1;
+}
+
+//! @brief aggregates of the nodes over the strong connections: the
+//! roots whose strong neighbours are all free, then the left nodes
+//! join a neighbouring aggregate, the rest form new ones.
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::aggregate(const matrix &A, int bs, double theta,
+									  std::vector<INT_TYPE> &agg, INT_TYPE &naggs) const
+{
+	const INT_TYPE nn = A.rows/bs;
+	// |A_IJ|^2 of the node blocks and the strong graph
+	std::vector<double> d(nn, 0), s(nn, 0);
+	std::vector<INT_TYPE> sptr(nn+1, 0), sadj, touched;
+	for(INT_TYPE I = 0; I < nn; ++I)
+		for(INT_TYPE i = I*bs; i < (I+1)*bs; ++i)
+			for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k)
+				if(A.col[k]/bs == I) d[I] += A.val[k]*A.val[k];
+	for(INT_TYPE I = 0; I < nn; ++I) d[I] = std::sqrt(d[I]);
+	const double t2 = theta*theta;
+	for(INT_TYPE I = 0; I < nn; ++I) {
+		touched.clear();
+		for(INT_TYPE i = I*bs; i < (I+1)*bs; ++i)
+			for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k) {
+				const INT_TYPE J = A.col[k]/bs;
+				if(J == I) continue;
+				if(s[J] == 0) touched.push_back(J);
+				s[J] += A.val[k]*A.val[k];
+			}
+		for(size_t t = 0; t < touched.size(); ++t) {
+			const INT_TYPE J = touched[t];
+			if(s[J] >= t2*d[I]*d[J] && s[J] > 0) sadj.push_back(J);
+			s[J] = 0;
+		}
+		sptr[I+1] = sadj.size();
+	}
+
+	const INT_TYPE FREE = -1;
+	agg.assign(nn, FREE);
+	naggs = 0;
+	for(INT_TYPE I = 0; I < nn; ++I) {
+		if(agg[I] != FREE) continue;
+		bool free = true;
+		for(INT_TYPE k = sptr[I]; k < sptr[I+1] && free; ++k)
+			free = (agg[sadj[k]] == FREE);
+		if(!free) continue;
+		agg[I] = naggs;
+		for(INT_TYPE k = sptr[I]; k < sptr[I+1]; ++k)
+			agg[sadj[k]] = naggs;
+		++naggs;
+	}
+	std::vector<INT_TYPE> agg1(agg);
+	for(INT_TYPE I = 0; I < nn; ++I) {
+		if(agg[I] != FREE) continue;
+		for(INT_TYPE k = sptr[I]; k < sptr[I+1]; ++k)
+			if(agg1[sadj[k]] != FREE) {
+				agg[I] = agg1[sadj[k]];
+				break;
+			}
+	}
+	for(INT_TYPE I = 0; I < nn; ++I) {
+		if(agg[I] != FREE) continue;
+		agg[I] = naggs;
+		for(INT_TYPE k = sptr[I]; k < sptr[I+1]; ++k)
+			if(agg[sadj[k]] == FREE) agg[sadj[k]] = naggs;
+		++naggs;
+	}
+}
+
+//! @brief P = (I-w*D^{-1}*A)*T, w = 4/(3*rho(D^{-1}*A)), T has the
+//! orthonormal columns of the aggregates for each component
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::prolongator(const level &L, int bs, matrix &P) const
+{
+	const matrix &A = L.A;
+	const INT_TYPE n = A.rows, nc = L.naggs*bs;
+	std::vector<double> t(n);
+	{
+		std::vector<INT_TYPE> cnt(L.naggs, 0);
+		for(INT_TYPE I = 0; I < n/bs; ++I) ++cnt[L.agg[I]];
+		for(INT_TYPE i = 0; i < n; ++i) t[i] = 1/std::sqrt(double(cnt[L.agg[i/bs]]));
+	}
+	const double w = 4/(3*spectral_radius(A, L.dinv));
+	P.rows = n;
+	P.cols = nc;
+	P.ptr.assign(n+1, 0);
+	P.col.clear();
+	P.val.clear();
+	std::vector<double> acc(nc, 0);
+	std::vector<INT_TYPE> mark(nc, -1), touched;
+	for(INT_TYPE i = 0; i < n; ++i) {
+		touched.clear();
+		const INT_TYPE ci = L.agg[i/bs]*bs+i%bs;
+		mark[ci] = i;
+		acc[ci] = t[i];
+		touched.push_back(ci);
+		const double f = w*L.dinv[i];
+		for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k) {
+			const INT_TYPE j = A.col[k], cj = L.agg[j/bs]*bs+j%bs;
+			if(mark[cj] != i) {
+				mark[cj] = i;
+				acc[cj] = 0;
+				touched.push_back(cj);
+			}
+			acc[cj] -= f*A.val[k]*t[j];
+		}
+		std::sort(touched.begin(), touched.end());
+		for(size_t k = 0; k < touched.size(); ++k) {
+			P.col.push_back(touched[k]);
+			P.val.push_back(acc[touched[k]]);
+		}
+		P.ptr[i+1] = P.col.size();
+	}
+}
+
+template <typename INT_TYPE>
+double builtin_amg<INT_TYPE>::spectral_radius(const matrix &A, const std::vector<double> &dinv)
+{
+	const size_t n = A.rows;
+	std::vector<double> v(n), y(n);
+	for(size_t i = 0; i < n; ++i) v[i] = 1+0.5*std::sin(double(i));
+	double rho = 1;
+	for(int it = 0; it < 15; ++it) {
+		const double vn = std::sqrt(iterative_dot(n, &v[0], &v[0]));
+		if(vn == 0) break;
+		A.apply(&v[0], &y[0]);
+		for(size_t i = 0; i < n; ++i) y[i] *= dinv[i]/vn;
+		rho = std::sqrt(iterative_dot(n, &y[0], &y[0]));
+		v.swap(y);
+	}
+	return std::max(rho, 1e-12);
+}
+
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::transpose(const matrix &A, matrix &AT)
+{
+	AT.rows = A.cols;
+	AT.cols = A.rows;
+	AT.ptr.assign(A.cols+1, 0);
+	for(size_t k = 0; k < A.col.size(); ++k) ++AT.ptr[A.col[k]+1];
+	for(INT_TYPE j = 0; j < A.cols; ++j) AT.ptr[j+1] += AT.ptr[j];
+	AT.col.resize(A.col.size());
+	AT.val.resize(A.col.size());
+	std::vector<INT_TYPE> pos(AT.ptr.begin(), AT.ptr.end()-1);
+	for(INT_TYPE i = 0; i < A.rows; ++i)
+		for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k) {
+			const INT_TYPE p = pos[A.col[k]]++;
+			AT.col[p] = i;
+			AT.val[p] = A.val[k];
+		}
+}
+
+//! @brief C = A*B by rows, the columns of a row of C are sorted
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::multiply(const matrix &A, const matrix &B, matrix &C)
+{
+	const INT_TYPE n = A.rows;
+	C.rows = n;
+	C.cols = B.cols;
+	C.ptr.assign(n+1, 0);
+#ifdef _OPENMP
+#pragma omp parallel if(A.val.size() >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+	{
+		std::vector<INT_TYPE> mark(B.cols, -1);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+		for(INT_TYPE i = 0; i < n; ++i) {
+			INT_TYPE c = 0;
+			for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k)
+				for(INT_TYPE q = B.ptr[A.col[k]]; q < B.ptr[A.col[k]+1]; ++q)
+					if(mark[B.col[q]] != i) {
+						mark[B.col[q]] = i;
+						++c;
+					}
+			C.ptr[i+1] = c;
+		}
+	}
+	for(INT_TYPE i = 0; i < n; ++i) C.ptr[i+1] += C.ptr[i];
+	C.col.resize(C.ptr[n]);
+	C.val.resize(C.ptr[n]);
+#ifdef _OPENMP
+#pragma omp parallel if(A.val.size() >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+	{
+		std::vector<INT_TYPE> pos(B.cols, -1);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+		for(INT_TYPE i = 0; i < n; ++i) {
+			const INT_TYPE beg = C.ptr[i];
+			INT_TYPE end = beg;
+			for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k)
+				for(INT_TYPE q = B.ptr[A.col[k]]; q < B.ptr[A.col[k]+1]; ++q) {
+					const INT_TYPE j = B.col[q];
+					if(pos[j] < beg) {
+						pos[j] = end;
+						C.col[end] = j;
+						C.val[end++] = A.val[k]*B.val[q];
+					}
+					else
+						C.val[pos[j]] += A.val[k]*B.val[q];
+				}
+			// sort the row by column
+			std::vector<std::pair<INT_TYPE, double> > row(end-beg);
+			for(INT_TYPE p = beg; p < end; ++p)
+				row[p-beg] = std::make_pair(C.col[p], C.val[p]);
+			std::sort(row.begin(), row.end());
+			for(INT_TYPE p = beg; p < end; ++p) {
+				C.col[p] = row[p-beg].first;
+				C.val[p] = row[p-beg].second;
+			}
+		}
+	}
+}
+
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::smooth(const level &L, const double *b, double *x, bool forward) const
+{
+	const INT_TYPE CHUNK = 4096;
+	const matrix &A = L.A;
+	const INT_TYPE n = A.rows, nchunks = (n+CHUNK-1)/CHUNK;
+	if(nchunks > 1) std::copy(x, x+n, L.tmp.begin());
+	const double *xold = (nchunks > 1) ? &L.tmp[0] : x;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) if(nchunks > 1)
+#endif
+	for(INT_TYPE c = 0; c < nchunks; ++c) {
+		const INT_TYPE lo = c*CHUNK, hi = std::min(n, lo+CHUNK);
+		for(INT_TYPE r = 0; r < hi-lo; ++r) {
+			const INT_TYPE i = forward ? lo+r : hi-1-r;
+			double s = b[i];
+			for(INT_TYPE k = A.ptr[i]; k < A.ptr[i+1]; ++k) {
+				const INT_TYPE j = A.col[k];
+				if(j == i) continue;
+				s -= A.val[k]*((j >= lo && j < hi) ? x[j] : xold[j]);
+			}
+			x[i] = s*L.dinv[i];
+		}
+	}
+}
+
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::vcycle(size_t l, const double *b, double *x) const
+{
+	const level &L = levels_[l];
+	const size_t n = L.A.rows;
+	if(l+1 == levels_.size()) {
+		if(coarse_direct_) {
+			std::copy(b, b+n, x);
+			coarse_.solve(x, 1, INT_TYPE(n));
+			return;
+		}
+		std::fill(x, x+n, 0.0);
+		for(int s = 0; s < 10; ++s) {
+			smooth(L, b, x, true);
+			smooth(L, b, x, false);
+		}
+		return;
+	}
+	std::fill(x, x+n, 0.0);
+	for(int s = 0; s < pre_; ++s) smooth(L, b, x, true);
+	iterative_residual(L.A, b, x, &L.r[0]);
+	const level &C = levels_[l+1];
+	L.R.apply(&L.r[0], &C.b[0]);
+	vcycle(l+1, &C.b[0], &C.x[0]);
+	L.P.apply(&C.x[0], &L.r[0]);
+	iterative_axpby(n, 1, &L.r[0], 1, x);
+	for(int s = 0; s < post_; ++s) smooth(L, b, x, false);
+}
+
+template <typename INT_TYPE>
+void builtin_amg<INT_TYPE>::apply(const double *r, double *z) const
+{
+	vcycle(0, r, z);
+}
+
+template <typename INT_TYPE>
+iterative_result builtin_amg<INT_TYPE>::solve(const double *b, double *x, double tol,
+											  size_t max_iter) const
+{
+	const matrix &A = levels_[0].A;
+	const size_t n = A.rows;
+	iterative_result res;
+	const double bn = std::sqrt(iterative_dot(n, b, b));
+	std::vector<double> r(n), e(n);
+	for(;; ++res.iterations) {
+		const double rn = iterative_residual(A, b, x, &r[0]);
+		res.residual = (bn > 0) ? rn/bn : rn;
+		if(res.residual <= tol) {
+			res.status = iterative_result::CONVERGED;
+			break;
+		}
+		if(res.iterations == max_iter) break;
+		vcycle(0, &r[0], &e[0]);
+		iterative_axpby(n, 1, &e[0], 1, x);
+	}
+	return res;
+}
+
+template <typename INT_TYPE>
+double builtin_amg<INT_TYPE>::operator_complexity(void) const
+{
+	double nnz = 0;
+	for(size_t l = 0; l < levels_.size(); ++l) nnz += levels_[l].A.val.size();
+	return levels_.empty() ? 0 : nnz/levels_[0].A.val.size();
+}
+
+#endif
@@ -0,0 +1,881 @@
+#ifndef HJ_BUILTIN_CHOL_H_
+#define HJ_BUILTIN_CHOL_H_
+
+#include <stddef.h>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#include <boost/type_traits/is_same.hpp>
+
+#include <zjucad/matrix/builtin_blas.h>
+#include <zjucad/matrix/mmap.h>
+
+//! @brief supernodal Cholesky factorization P*A*P^T = L*L^T of a sparse
+//! SPD matrix without external libraries.
+//!
+//! analyse orders the matrix by nested dissection, postorders the
+//! elimination tree, finds the relaxed supernodes and their row
+//! structures, and plans the updates between supernodes and the
+//! scatter of the values of A.  factorize only runs the numeric phase,
+//! so a matrix of the same pattern is refactorized without analyse.
+//!
+//! The numeric phase is left looking: a supernode gathers the updates
+//! of its descendants and factors its dense panel, it only writes its
+//! own panel.  The supernodes are scheduled over the supernodal
+//! elimination tree, a node starts when all its children are done,
+//! small subtrees are run by one thread.
+//!
+//! A may hold the lower or the upper triangle or both, with both only
+//! the lower triangle is used.
+//!
+//! With set_out_of_core a factor larger than the memory budget lives
+//! in a mapped scratch file private to the process.  Once the panels
+//! passed by factorize or solve take more than the budget they are
+//! dropped from memory, later reads stream them in from the file again.
+
+template <typename INT_TYPE = ptrdiff_t>
+class builtin_chol
+{
+public:
+	typedef INT_TYPE int_type;
+	enum { NATURAL = 0, NESTED_DISSECTION = 1 };
+
+	builtin_chol():n_(0), ns_(0), lower_(true), Lx_(0), budget_(0) {}
+	~builtin_chol() { close_scratch(); }
+
+	//! @brief keep the factor in a file in dir when it takes more than
+	//! budget bytes, see mapped_file::create_temp.  Call it before
+	//! analyse, an empty dir keeps the factor in memory.
+	void set_out_of_core(const std::string &dir, size_t budget) {
+		scratch_dir_ = dir;
+		budget_ = budget;
+	}
+	bool out_of_core(void) const { return Lfile_.data() != 0; }
+
+	//! @param ptr, idx: the n x n csc pattern of A
+	//! @return 0 on success
+	int analyse(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx,
+				int ordering = NESTED_DISSECTION);
+
+	//! @param val: the values of the pattern given to analyse
+	//! @return 0 on success, 1 if A is not positive definite
+	template <typename T>
+	int factorize(const T *val);
+
+	//! @brief B = A^{-1}*B, B is n x k column major.  The columns are
+	//! solved in panels of up to 32 by gemm on the off diagonal blocks
+	//! of the supernodes, the panels are spread over the threads.
+	void solve(double *B, INT_TYPE k, INT_TYPE ldb) const;
+
+	INT_TYPE size(void) const { return n_; }
+	INT_TYPE supernodes(void) const { return ns_; }
+	size_t nnz_L(void) const;
+
+private:
+	//! vertices of a dissection part taking the positions [end-v.size(), end)
+	struct part {
+		std::vector<INT_TYPE> v;
+		INT_TYPE end;
+	};
+
+	// for entry k of A, whether it is in the used triangle
+	bool used(INT_TYPE i, INT_TYPE j) const { return lower_ ? i >= j : i <= j; }
+
+	void order(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx, int ordering);
+	void nested_dissection(const std::vector<INT_TYPE> &adj_ptr, const std::vector<INT_TYPE> &adj);
+	INT_TYPE bfs(const std::vector<INT_TYPE> &adj_ptr, const std::vector<INT_TYPE> &adj,
+				 INT_TYPE root, INT_TYPE tag, std::vector<INT_TYPE> &lev,
+				 std::vector<INT_TYPE> &queue) const;
+	void upper_pattern(const INT_TYPE *ptr, const INT_TYPE *idx,
+					   std::vector<INT_TYPE> &uptr, std::vector<INT_TYPE> &uidx) const;
+	static void etree(INT_TYPE n, const std::vector<INT_TYPE> &uptr, const std::vector<INT_TYPE> &uidx,
+					  std::vector<INT_TYPE> &parent);
+	void schedule(void);
+
+	int allocate(void);
+	void close_scratch(void);
+	bool spill(INT_TYPE a, INT_TYPE b, INT_TYPE first) const;
+
+	int factor_supernode(INT_TYPE s, const double *val);
+	static int factor_panel(INT_TYPE nr, INT_TYPE nc, double *a);
+	void solve_panel(double *B, INT_TYPE k, INT_TYPE ldb, std::vector<double> &W,
+					 std::vector<double> &X, std::vector<double> &Y) const;
+
+	INT_TYPE n_, ns_;
+	bool lower_;
+	std::vector<INT_TYPE> perm_, iperm_;		// new to old, old to new
+
+	// supernode s has the columns [first_[s], first_[s+1]) and the
+	// rows rows_[rptr_[s] ...], its panel starts at Lx_[xptr_[s]]
+	std::vector<INT_TYPE> first_, col2sn_, sparent_, rptr_, rows_;
+	std::vector<size_t> xptr_;
+	double *Lx_;
+
+	// Lx_ is Lmem_, or the mapping of a file in scratch_dir_
+	std::vector<double> Lmem_;
+	zjucad::matrix::mapped_file Lfile_;
+	std::string scratch_dir_;
+	size_t budget_;
+
+	// descendant d updates s with its rows [p0, end), of which [p0, p1)
+	// are columns of s
+	std::vector<size_t> uptr_;
+	std::vector<INT_TYPE> ud_, up0_, up1_;
+
+	// entry asrc_[k] of A goes to Lx_[adst_[k]], grouped by supernode
+	std::vector<size_t> aptr_, asrc_, adst_;
+
+	// the units of the schedule: a supernode, or a whole small subtree
+	// [sub_first_[s], s] when small_[s]
+	std::vector<INT_TYPE> sub_first_, unit_parent_, units_, unit_children_;
+	std::vector<char> small_;
+};
+
+template <typename INT_TYPE>
+size_t builtin_chol<INT_TYPE>::nnz_L(void) const
+{
+	size_t nz = 0;
+	for(INT_TYPE s = 0; s < ns_; ++s) {
+		const size_t nc = first_[s+1]-first_[s], nr = rptr_[s+1]-rptr_[s];
+		nz += nc*nr-nc*(nc-1)/2;
+	}
+	return nz;
+}
+
+template <typename INT_TYPE>
+INT_TYPE builtin_chol<INT_TYPE>::bfs(
+	const std::vector<INT_TYPE> &adj_ptr, const std::vector<INT_TYPE> &adj,
+	INT_TYPE root, INT_TYPE tag, std::vector<INT_TYPE> &lev,
+	std::vector<INT_TYPE> &queue) const
+{
+	// visits the vertices labeled tag in perm_ with lev -1
+	queue.clear();
+	queue.push_back(root);
+	lev[root] = 0;
+	for(size_t h = 0; h < queue.size(); ++h) {
+		const INT_TYPE v = queue[h];
+		for(INT_TYPE k = adj_ptr[v]; k < adj_ptr[v+1]; ++k) {
+			const INT_TYPE u = adj[k];
+			if(lev[u] != -1 || perm_[u] != tag) continue;
+			lev[u] = lev[v]+1;
+			queue.push_back(u);
+		}
+	}
+	return lev[queue.back()];
+}
+
+//! perm_ is used as the part label of each vertex during the
+//! dissection, iperm_ gets the order
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::nested_dissection(
+	const std::vector<INT_TYPE> &adj_ptr, const std::vector<INT_TYPE> &adj)
+{
+	const INT_TYPE n = n_, LEAF = 64;
+	std::vector<part> stack(1);
+	stack[0].end = n;
+	stack[0].v.resize(n);
+	for(INT_TYPE i = 0; i < n; ++i) stack[0].v[i] = i;
+	std::vector<INT_TYPE> lev(n, -1), queue;
+	INT_TYPE tag = 0;
+	perm_.assign(n, 0);
+	while(!stack.empty()) {
+		part p;
+		p.v.swap(stack.back().v);
+		p.end = stack.back().end;
+		stack.pop_back();
+		const INT_TYPE sz = p.v.size(), beg = p.end-sz;
+		if(sz <= LEAF) {
+			for(INT_TYPE i = 0; i < sz; ++i) iperm_[p.v[i]] = beg+i;
+			continue;
+		}
+		++tag;
+		for(INT_TYPE i = 0; i < sz; ++i) perm_[p.v[i]] = tag;
+
+		// a pseudo peripheral vertex, then its level structure
+		bfs(adj_ptr, adj, p.v[0], tag, lev, queue);
+		const INT_TYPE far = queue.back();
+		for(size_t i = 0; i < queue.size(); ++i) lev[queue[i]] = -1;
+		const INT_TYPE depth = bfs(adj_ptr, adj, far, tag, lev, queue);
+		const INT_TYPE reached = queue.size();
+
+		part a, b;
+		if(reached < sz) {	// split off the component
+			a.v = queue;
+			for(INT_TYPE i = 0; i < sz; ++i)
+				if(lev[p.v[i]] == -1) b.v.push_back(p.v[i]);
+		}
+		else if(depth < 2) {	// no separator worth it
+			for(INT_TYPE i = 0; i < sz; ++i) iperm_[queue[i]] = beg+i;
+		}
+		else {
+			// the level with the median, only its vertices next to the
+			// following level separate
+			std::vector<INT_TYPE> cnt(depth+1, 0);
+			for(INT_TYPE i = 0; i < sz; ++i) ++cnt[lev[queue[i]]];
+			INT_TYPE L = 1, acc = cnt[0];
+			while(L < depth-1 && acc+cnt[L] < sz/2) acc += cnt[L++];
+			std::vector<INT_TYPE> sep;
+			for(INT_TYPE i = 0; i < sz; ++i) {
+				const INT_TYPE v = queue[i];
+				if(lev[v] < L) a.v.push_back(v);
+				else if(lev[v] > L) b.v.push_back(v);
+				else {
+					bool cut = false;
+					for(INT_TYPE k = adj_ptr[v]; k < adj_ptr[v+1] && !cut; ++k)
+						cut = perm_[adj[k]] == tag && lev[adj[k]] == L+1;
+					if(cut) sep.push_back(v);
+					else a.v.push_back(v);
+				}
+			}
+			const INT_TYPE sbeg = p.end-INT_TYPE(sep.size());
+			for(size_t i = 0; i < sep.size(); ++i) iperm_[sep[i]] = sbeg+INT_TYPE(i);
+		}
+		for(size_t i = 0; i < queue.size(); ++i) lev[queue[i]] = -1;
+		if(!a.v.empty()) {
+			a.end = beg+INT_TYPE(a.v.size());
+			b.end = a.end+INT_TYPE(b.v.size());
+			stack.push_back(part());
+			stack.back().v.swap(a.v);
+			stack.back().end = a.end;
+			if(!b.v.empty()) {
+				stack.push_back(part());
+				stack.back().v.swap(b.v);
+				stack.back().end = b.end;
+			}
+		}
+	}
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::order(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx, int ordering)
+{
+	iperm_.resize(n);
+	if(ordering == NESTED_DISSECTION) {
+		// the graph of A+A^T without the diagonal
+		std::vector<INT_TYPE> adj_ptr(n+1, 0), adj, mark(n, -1);
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k)
+				if(idx[k] != j) {
+					++adj_ptr[idx[k]+1];
+					++adj_ptr[j+1];
+				}
+		for(INT_TYPE i = 0; i < n; ++i) adj_ptr[i+1] += adj_ptr[i];
+		std::vector<INT_TYPE> tmp(adj_ptr[n]), pos(adj_ptr.begin(), adj_ptr.end()-1);
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k)
+				if(idx[k] != j) {
+					tmp[pos[idx[k]]++] = j;
+					tmp[pos[j]++] = idx[k];
+				}
+		// without duplicates
+		adj.reserve(tmp.size());
+		for(INT_TYPE i = 0; i < n; ++i) {
+			const INT_TYPE b = adj.size();
+			for(INT_TYPE k = adj_ptr[i]; k < adj_ptr[i+1]; ++k)
+				if(mark[tmp[k]] != i) {
+					mark[tmp[k]] = i;
+					adj.push_back(tmp[k]);
+				}
+			adj_ptr[i] = b;
+		}
+		adj_ptr[n] = adj.size();
+		nested_dissection(adj_ptr, adj);
+	}
+	else {
+		for(INT_TYPE i = 0; i < n; ++i) iperm_[i] = i;
+	}
+	perm_.resize(n);
+	for(INT_TYPE i = 0; i < n; ++i) perm_[iperm_[i]] = i;
+}
+
+//! the upper triangle of P*A*P^T by column, duplicates are kept
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::upper_pattern(
+	const INT_TYPE *ptr, const INT_TYPE *idx,
+	std::vector<INT_TYPE> &uptr, std::vector<INT_TYPE> &uidx) const
+{
+	const INT_TYPE n = n_;
+	uptr.assign(n+1, 0);
+	for(INT_TYPE j = 0; j < n; ++j)
+		for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k)
+			if(idx[k] != j && used(idx[k], j))
+				++uptr[std::max(iperm_[idx[k]], iperm_[j])+1];
+	for(INT_TYPE i = 0; i < n; ++i) uptr[i+1] += uptr[i];
+	uidx.resize(uptr[n]);
+	std::vector<INT_TYPE> pos(uptr.begin(), uptr.end()-1);
+	for(INT_TYPE j = 0; j < n; ++j)
+		for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k)
+			if(idx[k] != j && used(idx[k], j)) {
+				const INT_TYPE a = iperm_[idx[k]], b = iperm_[j];
+				uidx[pos[std::max(a, b)]++] = std::min(a, b);
+			}
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::etree(
+	INT_TYPE n, const std::vector<INT_TYPE> &uptr, const std::vector<INT_TYPE> &uidx,
+	std::vector<INT_TYPE> &parent)
+{
+	std::vector<INT_TYPE> anc(n, -1);
+	parent.assign(n, -1);
+	for(INT_TYPE k = 0; k < n; ++k)
+		for(INT_TYPE p = uptr[k]; p < uptr[k+1]; ++p)
+			for(INT_TYPE i = uidx[p], next; i != -1 && i < k; i = next) {
+				next = anc[i];
+				anc[i] = k;
+				if(next == -1) parent[i] = k;
+			}
+}
+
+template <typename INT_TYPE>
+int builtin_chol<INT_TYPE>::analyse(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx, int ordering)
+{
+	n_ = n;
+	INT_TYPE nlower = 0, nupper = 0;
+	for(INT_TYPE j = 0; j < n; ++j)
+		for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+			if(idx[k] < 0 || idx[k] >= n) return 1;
+			nlower += idx[k] > j;
+			nupper += idx[k] < j;
+		}
+	lower_ = nlower > 0 || nupper == 0;
+
+	order(n, ptr, idx, ordering);
+	std::vector<INT_TYPE> uptr, uidx, parent;
+	upper_pattern(ptr, idx, uptr, uidx);
+	etree(n, uptr, uidx, parent);
+
+	{	// postorder the elimination tree
+		std::vector<INT_TYPE> head(n, -1), next(n, -1), post, stack;
+		for(INT_TYPE j = n-1; j >= 0; --j)
+			if(parent[j] != -1) {
+				next[j] = head[parent[j]];
+				head[parent[j]] = j;
+			}
+		post.reserve(n);
+		for(INT_TYPE r = 0; r < n; ++r) {
+			if(parent[r] != -1) continue;
+			stack.push_back(r);
+			while(!stack.empty()) {
+				const INT_TYPE j = stack.back();
+				if(head[j] != -1) {
+					const INT_TYPE c = head[j];
+					head[j] = next[c];
+					stack.push_back(c);
+				}
+				else {
+					stack.pop_back();
+					post.push_back(j);
+				}
+			}
+		}
+		std::vector<INT_TYPE> perm(n);
+		for(INT_TYPE k = 0; k < n; ++k) perm[k] = perm_[post[k]];
+		perm_.swap(perm);
+		for(INT_TYPE k = 0; k < n; ++k) iperm_[perm_[k]] = k;
+	}
+	upper_pattern(ptr, idx, uptr, uidx);
+	etree(n, uptr, uidx, parent);
+
+	// off diagonal counts of the columns of L by the row subtrees
+	std::vector<INT_TYPE> cnt(n, 0), mark(n, -1), nchild(n, 0);
+	for(INT_TYPE k = 0; k < n; ++k) {
+		mark[k] = k;
+		for(INT_TYPE p = uptr[k]; p < uptr[k+1]; ++p)
+			for(INT_TYPE i = uidx[p]; mark[i] != k; i = parent[i]) {
+				++cnt[i];
+				mark[i] = k;
+			}
+	}
+	for(INT_TYPE j = 0; j < n; ++j)
+		if(parent[j] != -1) ++nchild[parent[j]];
+
+	// fundamental supernodes, then a child is merged into its parent
+	// when the range of its columns is just before the parent's and the
+	// explicit zeros are few, as the relaxed supernodes of CHOLMOD
+	const INT_TYPE MAX_WIDTH = 256;
+	std::vector<INT_TYPE> fund;
+	for(INT_TYPE j = 0; j < n; ++j)
+		if(j == 0 || parent[j-1] != j || cnt[j-1] != cnt[j]+1 || nchild[j] != 1)
+			fund.push_back(j);
+	fund.push_back(n);
+	std::vector<INT_TYPE> gnr;		// rows of each merged supernode
+	std::vector<double> gnz;		// its nonzeros without the merged zeros
+	first_.clear();
+	for(size_t f = 0; f+1 < fund.size(); ++f) {
+		INT_TYPE gf = fund[f], nc = fund[f+1]-gf, nr = cnt[gf]+1;
+		double nz = 0;
+		for(INT_TYPE j = gf; j < fund[f+1]; ++j) nz += cnt[j]+1;
+		while(!first_.empty()) {
+			const INT_TYPE cf = first_.back(), cnc = gf-cf, p = parent[gf-1];
+			if(p == -1 || p >= fund[f+1]) break;	// not a child
+			const double mnc = cnc+nc, mnr = cnc+nr, mnz = nz+gnz.back();
+			const double zeros = 1-mnz/(mnc*mnr-mnc*(mnc-1)/2);
+			if(mnc > MAX_WIDTH
+			   || !(mnc <= 4 || (mnc <= 16 && zeros < 0.8) || (mnc <= 48 && zeros < 0.1) || zeros < 0.05))
+				break;
+			gf = cf;
+			nc = INT_TYPE(mnc);
+			nr = INT_TYPE(mnr);
+			nz = mnz;
+			first_.pop_back();
+			gnr.pop_back();
+			gnz.pop_back();
+		}
+		first_.push_back(gf);
+		gnr.push_back(nr);
+		gnz.push_back(nz);
+	}
+	ns_ = first_.size();
+	first_.push_back(n);
+	col2sn_.resize(n);
+	for(INT_TYPE s = 0; s < ns_; ++s)
+		std::fill(col2sn_.begin()+first_[s], col2sn_.begin()+first_[s+1], s);
+	sparent_.assign(ns_, -1);
+	for(INT_TYPE s = 0; s < ns_; ++s) {
+		const INT_TYPE p = parent[first_[s+1]-1];
+		if(p != -1) sparent_[s] = col2sn_[p];
+	}
+
+	// row structures: the lower part of A and the rows of the children
+	rptr_.assign(ns_+1, 0);
+	for(INT_TYPE s = 0; s < ns_; ++s)
+		rptr_[s+1] = rptr_[s]+gnr[s];
+	rows_.resize(rptr_[ns_]);
+	{
+		std::vector<INT_TYPE> lptr(n+1, 0), lidx(uidx.size());
+		for(size_t p = 0; p < uidx.size(); ++p) ++lptr[uidx[p]+1];
+		for(INT_TYPE i = 0; i < n; ++i) lptr[i+1] += lptr[i];
+		std::vector<INT_TYPE> pos(lptr.begin(), lptr.end()-1);
+		for(INT_TYPE r = 0; r < n; ++r)
+			for(INT_TYPE p = uptr[r]; p < uptr[r+1]; ++p)
+				lidx[pos[uidx[p]]++] = r;
+		std::vector<INT_TYPE> shead(ns_, -1), snext(ns_, -1);
+		for(INT_TYPE s = ns_-1; s >= 0; --s)
+			if(sparent_[s] != -1) {
+				snext[s] = shead[sparent_[s]];
+				shead[sparent_[s]] = s;
+			}
+		std::fill(mark.begin(), mark.end(), -1);
+		for(INT_TYPE s = 0; s < ns_; ++s) {
+			const INT_TYPE f = first_[s], l = first_[s+1];
+			INT_TYPE o = rptr_[s];
+			for(INT_TYPE j = f; j < l; ++j) {
+				rows_[o++] = j;
+				mark[j] = s;
+			}
+			const INT_TYPE b = o;
+			for(INT_TYPE j = f; j < l; ++j)
+				for(INT_TYPE p = lptr[j]; p < lptr[j+1]; ++p)
+					if(mark[lidx[p]] != s) {
+						mark[lidx[p]] = s;
+						rows_[o++] = lidx[p];
+					}
+			for(INT_TYPE c = shead[s]; c != -1; c = snext[c])
+				for(INT_TYPE p = rptr_[c]+first_[c+1]-first_[c]; p < rptr_[c+1]; ++p)
+					if(mark[rows_[p]] != s) {
+						mark[rows_[p]] = s;
+						rows_[o++] = rows_[p];
+					}
+			assert(o == rptr_[s+1]);
+			std::sort(rows_.begin()+b, rows_.begin()+o);
+		}
+	}
+
+	xptr_.assign(ns_+1, 0);
+	for(INT_TYPE s = 0; s < ns_; ++s)
+		xptr_[s+1] = xptr_[s]+size_t(first_[s+1]-first_[s])*(rptr_[s+1]-rptr_[s]);
+	if(allocate()) return 1;
+
+	// the updates of the descendants, grouped by the updated supernode
+	uptr_.assign(ns_+1, 0);
+	for(int fill = 0; fill < 2; ++fill) {
+		std::vector<size_t> pos(uptr_.begin(), uptr_.end()-1);
+		for(INT_TYPE d = 0; d < ns_; ++d) {
+			INT_TYPE p = rptr_[d]+first_[d+1]-first_[d];
+			while(p < rptr_[d+1]) {
+				const INT_TYPE s = col2sn_[rows_[p]], p0 = p;
+				while(p < rptr_[d+1] && rows_[p] < first_[s+1]) ++p;
+				if(fill) {
+					const size_t u = pos[s]++;
+					ud_[u] = d;
+					up0_[u] = p0-rptr_[d];
+					up1_[u] = p-rptr_[d];
+				}
+				else
+					++uptr_[s+1];
+			}
+		}
+		if(!fill) {
+			for(INT_TYPE s = 0; s < ns_; ++s) uptr_[s+1] += uptr_[s];
+			ud_.resize(uptr_[ns_]);
+			up0_.resize(uptr_[ns_]);
+			up1_.resize(uptr_[ns_]);
+		}
+	}
+
+	// where the entries of A go
+	aptr_.assign(ns_+1, 0);
+	for(int fill = 0; fill < 2; ++fill) {
+		std::vector<size_t> pos(aptr_.begin(), aptr_.end()-1);
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+				if(!used(idx[k], j)) continue;
+				const INT_TYPE a = iperm_[idx[k]], b = iperm_[j];
+				const INT_TYPE r = std::max(a, b), c = std::min(a, b), s = col2sn_[c];
+				if(!fill) {
+					++aptr_[s+1];
+					continue;
+				}
+				const INT_TYPE *rs = &rows_[rptr_[s]], *re = rs+(rptr_[s+1]-rptr_[s]);
+				const size_t o = pos[s]++;
+				asrc_[o] = k;
+				adst_[o] = xptr_[s]+size_t(c-first_[s])*(re-rs)+(std::lower_bound(rs, re, r)-rs);
+			}
+		if(!fill) {
+			for(INT_TYPE s = 0; s < ns_; ++s) aptr_[s+1] += aptr_[s];
+			asrc_.resize(aptr_[ns_]);
+			adst_.resize(aptr_[ns_]);
+		}
+	}
+
+	schedule();
+	return 0;
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::schedule(void)
+{
+	std::vector<double> work(ns_, 0);
+	double total = 0;
+	sub_first_.resize(ns_);
+	for(INT_TYPE s = 0; s < ns_; ++s) sub_first_[s] = s;
+	for(INT_TYPE s = 0; s < ns_; ++s) {	// children come first
+		const double nc = first_[s+1]-first_[s], nr = rptr_[s+1]-rptr_[s];
+		work[s] += nr*nc*nc+(nr-nc)*(nr-nc)*nc;
+		total += nr*nc*nc+(nr-nc)*(nr-nc)*nc;
+		if(sparent_[s] != -1) {
+			work[sparent_[s]] += work[s];
+			sub_first_[sparent_[s]] = std::min(sub_first_[sparent_[s]], sub_first_[s]);
+		}
+	}
+#ifdef _OPENMP
+	const int np = omp_get_max_threads();
+#else
+	const int np = 1;
+#endif
+	const double small = total/(8.0*np);
+	small_.assign(ns_, 0);
+	units_.clear();
+	for(INT_TYPE s = 0; s < ns_; ++s) {
+		small_[s] = work[s] <= small;
+		const INT_TYPE p = sparent_[s];
+		if(!small_[s] || p == -1 || work[p] > small)
+			units_.push_back(s);
+	}
+	unit_parent_.assign(ns_, -1);
+	unit_children_.assign(ns_, 0);
+	for(size_t u = 0; u < units_.size(); ++u) {
+		const INT_TYPE p = sparent_[units_[u]];
+		unit_parent_[units_[u]] = p;
+		if(p != -1) ++unit_children_[p];
+	}
+}
+
+template <typename INT_TYPE>
+int builtin_chol<INT_TYPE>::allocate(void)
+{
+	close_scratch();
+	const size_t bytes = xptr_[ns_]*sizeof(double);
+	if(scratch_dir_.empty() || bytes <= budget_) {
+		Lmem_.resize(xptr_[ns_]);
+		Lx_ = Lmem_.empty() ? 0 : &Lmem_[0];
+		return 0;
+	}
+	std::vector<double>().swap(Lmem_);
+	if(Lfile_.create_temp(scratch_dir_.c_str(), bytes)) return 1;
+	Lx_ = reinterpret_cast<double *>(Lfile_.data());
+	return 0;
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::close_scratch(void)
+{
+	Lx_ = 0;
+	Lfile_.close();
+}
+
+//! @brief with the factor in a file, drop the panels of
+//! the supernodes [first, b] if those of [a, b] take more than the
+//! budget
+//! @return whether they were dropped
+template <typename INT_TYPE>
+bool builtin_chol<INT_TYPE>::spill(INT_TYPE a, INT_TYPE b, INT_TYPE first) const
+{
+	if(!Lfile_.data() || a > b) return false;
+	if((xptr_[b+1]-xptr_[a])*sizeof(double) <= budget_) return false;
+	Lfile_.release(xptr_[first]*sizeof(double), (xptr_[b+1]-xptr_[first])*sizeof(double));
+	return true;
+}
+
+template <typename INT_TYPE>
+int builtin_chol<INT_TYPE>::factor_panel(INT_TYPE nr, INT_TYPE nc, double *a)
+{
+	using zjucad::matrix::idx_type;
+	const INT_TYPE NB = 32;
+	for(INT_TYPE j0 = 0; j0 < nc; j0 += NB) {
+		const INT_TYPE jb = std::min(NB, nc-j0);
+		if(j0)
+			zjucad::matrix::builtin_gemm(false, true, idx_type(nr-j0), idx_type(jb), idx_type(j0),
+										 -1.0, a+j0, idx_type(nr), a+j0, idx_type(nr),
+										 1.0, a+j0+size_t(j0)*nr, idx_type(nr));
+		for(INT_TYPE j = j0; j < j0+jb; ++j) {
+			double *aj = a+size_t(j)*nr;
+			for(INT_TYPE k = j0; k < j; ++k) {
+				const double *ak = a+size_t(k)*nr;
+				const double ajk = ak[j];
+				for(INT_TYPE i = j; i < nr; ++i) aj[i] -= ak[i]*ajk;
+			}
+			if(!(aj[j] > 0)) return 1;
+			aj[j] = std::sqrt(aj[j]);
+			const double inv = 1/aj[j];
+			for(INT_TYPE i = j+1; i < nr; ++i) aj[i] *= inv;
+		}
+	}
+	return 0;
+}
+
+template <typename INT_TYPE>
+int builtin_chol<INT_TYPE>::factor_supernode(INT_TYPE s, const double *val)
+{
+	using zjucad::matrix::idx_type;
+	const INT_TYPE f = first_[s], nc = first_[s+1]-f, nr = rptr_[s+1]-rptr_[s];
+	const INT_TYPE *rs = &rows_[rptr_[s]];
+	double *panel = &Lx_[xptr_[s]];
+	std::fill(panel, panel+size_t(nc)*nr, 0.0);
+	for(size_t k = aptr_[s]; k < aptr_[s+1]; ++k)
+		Lx_[adst_[k]] += val[asrc_[k]];
+
+	std::vector<double> C;
+	std::vector<INT_TYPE> rel;
+	for(size_t u = uptr_[s]; u < uptr_[s+1]; ++u) {
+		const INT_TYPE d = ud_[u], p0 = up0_[u], p1 = up1_[u];
+		const INT_TYPE ncd = first_[d+1]-first_[d], nrd = rptr_[d+1]-rptr_[d];
+		const INT_TYPE m = nrd-p0, k2 = p1-p0;
+		const INT_TYPE *rd = &rows_[rptr_[d]]+p0;
+		const double *Ld = &Lx_[xptr_[d]]+p0;
+		// C = Ld(p0:, :)*Ld(p0:p1, :)^T
+		C.resize(size_t(m)*k2);
+		if(double(m)*k2*ncd < 4096) {
+			std::fill(C.begin(), C.end(), 0.0);
+			for(INT_TYPE c = 0; c < ncd; ++c) {
+				const double *l = Ld+size_t(c)*nrd;
+				for(INT_TYPE j = 0; j < k2; ++j) {
+					const double lj = l[j];
+					double *cj = &C[size_t(j)*m];
+					for(INT_TYPE i = j; i < m; ++i) cj[i] += l[i]*lj;
+				}
+			}
+		}
+		else
+			zjucad::matrix::builtin_gemm(false, true, idx_type(m), idx_type(k2), idx_type(ncd),
+										 1.0, Ld, idx_type(nrd), Ld, idx_type(nrd),
+										 0.0, &C[0], idx_type(m));
+		// the rows of d are a subset of the rows of s
+		rel.resize(m);
+		for(INT_TYPE i = 0, p = 0; i < m; ++i) {
+			while(rs[p] != rd[i]) ++p;
+			rel[i] = p;
+		}
+		for(INT_TYPE j = 0; j < k2; ++j) {
+			double *pj = panel+size_t(rd[j]-f)*nr;
+			const double *cj = &C[size_t(j)*m];
+			for(INT_TYPE i = j; i < m; ++i) pj[rel[i]] -= cj[i];
+		}
+	}
+	return factor_panel(nr, nc, panel);
+}
+
+template <typename INT_TYPE>
+template <typename T>
+int builtin_chol<INT_TYPE>::factorize(const T *val)
+{
+	std::vector<double> dval;
+	const double *v = 0;
+	if(boost::is_same<T, double>::value)
+		v = reinterpret_cast<const double *>(val);
+	else {
+		const size_t nz = asrc_.empty() ? 0 : *std::max_element(asrc_.begin(), asrc_.end())+1;
+		dval.assign(val, val+nz);
+		v = dval.empty() ? 0 : &dval[0];
+	}
+	int bad = 0;
+	INT_TYPE from = 0;	// the first panel kept in memory
+#ifdef _OPENMP
+	const INT_TYPE nu = units_.size();
+	std::vector<INT_TYPE> pending(unit_children_);
+#pragma omp parallel if(nu > 1)
+	{
+#pragma omp single
+		{
+			for(INT_TYPE u = 0; u < nu; ++u) {
+				if(unit_children_[units_[u]]) continue;
+#pragma omp task firstprivate(u)
+				{
+					// run the unit, then its parent when this was the
+					// last child
+					for(INT_TYPE s = units_[u]; s != -1; ) {
+						const INT_TYPE b = small_[s] ? sub_first_[s] : s;
+						int rtn = 0;
+						for(INT_TYPE t = b; t <= s && !rtn; ++t)
+							rtn = factor_supernode(t, v);
+						const INT_TYPE p = unit_parent_[s];
+#pragma omp critical (builtin_chol)
+						{
+							if(rtn) bad = 1;
+							// the descendants read again are dropped too
+							if(s >= from && spill(from, s, 0)) from = s+1;
+							s = (p != -1 && --pending[p] == 0 && !bad) ? p : -1;
+						}
+					}
+				}
+			}
+		}
+	}
+#else
+	for(INT_TYPE s = 0; s < ns_ && !bad; ++s) {
+		bad = factor_supernode(s, v);
+		if(spill(from, s, 0)) from = s+1;
+	}
+#endif
+	return bad;
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::solve(double *B, INT_TYPE k, INT_TYPE ldb) const
+{
+	const INT_TYPE KB = 32;
+	INT_TYPE threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	// panels of up to KB columns, at least one for each thread
+	const INT_TYPE kb = std::max(INT_TYPE(1), std::min(KB, (k+threads-1)/threads));
+	const INT_TYPE np = (k+kb-1)/kb;
+#ifdef _OPENMP
+#pragma omp parallel if(np > 1)
+#endif
+	{
+		std::vector<double> W, X, Y;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+		for(INT_TYPE p = 0; p < np; ++p)
+			solve_panel(B+size_t(p)*kb*ldb, std::min(kb, k-p*kb), ldb, W, X, Y);
+	}
+}
+
+template <typename INT_TYPE>
+void builtin_chol<INT_TYPE>::solve_panel(double *B, INT_TYPE k, INT_TYPE ldb, std::vector<double> &W,
+										 std::vector<double> &X, std::vector<double> &Y) const
+{
+	using zjucad::matrix::idx_type;
+	const INT_TYPE n = n_;
+	W.resize(size_t(n)*k);
+	for(INT_TYPE r = 0; r < k; ++r)
+		for(INT_TYPE i = 0; i < n; ++i)
+			W[i+size_t(r)*n] = B[perm_[i]+size_t(r)*ldb];
+	// L*Y = B, X are the rows of the columns of s, Y the rest
+	for(INT_TYPE s = 0, from = 0; s < ns_; ++s) {
+		if(s && spill(from, s-1, from)) from = s;
+		const INT_TYPE f = first_[s], nc = first_[s+1]-f, nr = rptr_[s+1]-rptr_[s], m = nr-nc;
+		const INT_TYPE *rs = &rows_[rptr_[s]]+nc;
+		const double *L = &Lx_[xptr_[s]];
+		X.resize(size_t(nc)*k);
+		for(INT_TYPE r = 0; r < k; ++r) {
+			double *x = &X[size_t(r)*nc];
+			std::copy(&W[f+size_t(r)*n], &W[f+size_t(r)*n]+nc, x);
+			for(INT_TYPE j = 0; j < nc; ++j) {
+				const double *l = L+size_t(j)*nr;
+				const double xj = (x[j] /= l[j]);
+				for(INT_TYPE i = j+1; i < nc; ++i) x[i] -= l[i]*xj;
+			}
+			std::copy(x, x+nc, &W[f+size_t(r)*n]);
+		}
+		if(m == 0) continue;
+		if(k < 4 || double(m)*nc*k < 4096) {
+			for(INT_TYPE r = 0; r < k; ++r) {
+				double *w = &W[size_t(r)*n];
+				for(INT_TYPE j = 0; j < nc; ++j) {
+					const double *l = L+size_t(j)*nr+nc, xj = X[j+size_t(r)*nc];
+					for(INT_TYPE i = 0; i < m; ++i) w[rs[i]] -= l[i]*xj;
+				}
+			}
+			continue;
+		}
+		Y.resize(size_t(m)*k);
+		zjucad::matrix::builtin_gemm(false, false, idx_type(m), idx_type(k), idx_type(nc),
+									 1.0, L+nc, idx_type(nr), &X[0], idx_type(nc),
+									 0.0, &Y[0], idx_type(m));
+		for(INT_TYPE r = 0; r < k; ++r) {
+			double *w = &W[size_t(r)*n];
+			const double *y = &Y[size_t(r)*m];
+			for(INT_TYPE i = 0; i < m; ++i) w[rs[i]] -= y[i];
+		}
+	}
+	// L^T*X = Y
+	for(INT_TYPE s = ns_-1, to = ns_-1; s >= 0; --s) {
+		if(s+1 < ns_ && spill(s+1, to, s+1)) to = s;
+		const INT_TYPE f = first_[s], nc = first_[s+1]-f, nr = rptr_[s+1]-rptr_[s], m = nr-nc;
+		const INT_TYPE *rs = &rows_[rptr_[s]]+nc;
+		const double *L = &Lx_[xptr_[s]];
+		X.resize(size_t(nc)*k);
+		for(INT_TYPE r = 0; r < k; ++r)
+			std::copy(&W[f+size_t(r)*n], &W[f+size_t(r)*n]+nc, &X[size_t(r)*nc]);
+		if(m && (k < 4 || double(m)*nc*k < 4096)) {
+			for(INT_TYPE r = 0; r < k; ++r) {
+				const double *w = &W[size_t(r)*n];
+				for(INT_TYPE j = 0; j < nc; ++j) {
+					const double *l = L+size_t(j)*nr+nc;
+					double t = 0;
+					for(INT_TYPE i = 0; i < m; ++i) t += l[i]*w[rs[i]];
+					X[j+size_t(r)*nc] -= t;
+				}
+			}
+		}
+		else if(m) {
+			Y.resize(size_t(m)*k);
+			for(INT_TYPE r = 0; r < k; ++r) {
+				const double *w = &W[size_t(r)*n];
+				double *y = &Y[size_t(r)*m];
+				for(INT_TYPE i = 0; i < m; ++i) y[i] = w[rs[i]];
+			}
+			zjucad::matrix::builtin_gemm(true, false, idx_type(nc), idx_type(k), idx_type(m),
+										 -1.0, L+nc, idx_type(nr), &Y[0], idx_type(m),
+										 1.0, &X[0], idx_type(nc));
+		}
+		for(INT_TYPE r = 0; r < k; ++r) {
+			double *x = &X[size_t(r)*nc];
+			for(INT_TYPE j = nc-1; j >= 0; --j) {
+				const double *l = L+size_t(j)*nr;
+				double t = x[j];
+				for(INT_TYPE i = j+1; i < nc; ++i) t -= l[i]*x[i];
+				x[j] = t/l[j];
+			}
+			std::copy(x, x+nc, &W[f+size_t(r)*n]);
+		}
+	}
+	for(INT_TYPE r = 0; r < k; ++r)
+		for(INT_TYPE i = 0; i < n; ++i)
+			B[perm_[i]+size_t(r)*ldb] = W[i+size_t(r)*n];
+}
+
+#endif
@@ -0,0 +1,658 @@
+#ifndef HJ_BUILTIN_ITERATIVE_H_
+#define HJ_BUILTIN_ITERATIVE_H_
+
+#include <stddef.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+//! @brief PCG, MINRES and BiCGSTAB on any operator with
+//!
+//!   size_t size(void) const;
+//!   void apply(const double *x, double *y) const;	// y = A*x
+//!
+//! and any preconditioner with apply(r, z), z = M^{-1}*r.
+//! csc_operator wraps the arrays of a csc matrix, e.g. an
+//! hj::sparse::csc through make_csc_operator, function_operator wraps a
+//! matrix free callback:
+//!
+//!   struct hessian { void operator()(const double *x, double *y) const; };
+//!   function_operator<hessian> H(n, hessian());
+//!   iterative_result r = pcg(H, identity_precond(), b, x, 1e-3, 200);
+//!
+//! x is the initial guess, so a previous solution warm starts the
+//! solve, and tol is relative to |b|, an inexact Newton method passes
+//! its forcing term.
+
+//! minimal vector size to go parallel
+#ifndef HJ_ITERATIVE_OMP_SIZE
+#  define HJ_ITERATIVE_OMP_SIZE 4096
+#endif
+
+struct iterative_result
+{
+	enum { CONVERGED = 0, MAX_ITER = 1, BREAKDOWN = 2 };
+	iterative_result():iterations(0), residual(0), status(MAX_ITER) {}
+	size_t iterations;
+	double residual;	// |b-A*x|/|b|
+	int status;
+};
+
+inline double iterative_dot(size_t n, const double *a, const double *b)
+{
+	double s = 0;
+	const ptrdiff_t m = n;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:s) if(n >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+	for(ptrdiff_t i = 0; i < m; ++i) s += a[i]*b[i];
+	return s;
+}
+
+//! y = a*x+b*y
+inline void iterative_axpby(size_t n, double a, const double *x, double b, double *y)
+{
+	const ptrdiff_t m = n;
+#ifdef _OPENMP
+#pragma omp parallel for if(n >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+	for(ptrdiff_t i = 0; i < m; ++i) y[i] = a*x[i]+b*y[i];
+}
+
+//! z = x+a*y
+inline void iterative_xpay(size_t n, const double *x, double a, const double *y, double *z)
+{
+	const ptrdiff_t m = n;
+#ifdef _OPENMP
+#pragma omp parallel for if(n >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+	for(ptrdiff_t i = 0; i < m; ++i) z[i] = x[i]+a*y[i];
+}
+
+//! r = b-A*x, @return |r|
+template <typename OP>
+double iterative_residual(const OP &A, const double *b, const double *x, double *r)
+{
+	const size_t n = A.size();
+	A.apply(x, r);
+	iterative_axpby(n, 1, b, -1, r);
+	return std::sqrt(iterative_dot(n, r, r));
+}
+
+//! @brief y = A*x on the arrays of a csc matrix.  A is gathered by row
+//! through a permutation to val, so the values may change between
+//! calls.  With symmetric, a matrix holding only its lower or only its
+//! upper triangle is mirrored.
+template <typename INT_TYPE = ptrdiff_t>
+class csc_operator
+{
+public:
+	csc_operator():n_(0), val_(0) {}
+	csc_operator(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx, const double *val,
+				 bool symmetric = true) {
+		init(n, ptr, idx, val, symmetric);
+	}
+
+	void init(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx, const double *val,
+			  bool symmetric = true) {
+		n_ = n;
+		val_ = val;
+		INT_TYPE nlower = 0, nupper = 0;
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+				nlower += idx[k] > j;
+				nupper += idx[k] < j;
+			}
+		const bool mirror = symmetric && ((nlower == 0) != (nupper == 0));
+		rptr_.assign(n+1, 0);
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+				++rptr_[idx[k]+1];
+				if(mirror && idx[k] != j) ++rptr_[j+1];
+			}
+		for(INT_TYPE i = 0; i < n; ++i) rptr_[i+1] += rptr_[i];
+		col_.resize(rptr_[n]);
+		perm_.resize(rptr_[n]);
+		std::vector<INT_TYPE> pos(rptr_.begin(), rptr_.end()-1);
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+				INT_TYPE p = pos[idx[k]]++;
+				col_[p] = j;
+				perm_[p] = k;
+				if(mirror && idx[k] != j) {
+					p = pos[j]++;
+					col_[p] = idx[k];
+					perm_[p] = k;
+				}
+			}
+	}
+	//! @brief the values of the pattern given to init
+	void set_values(const double *val) { val_ = val; }
+
+	size_t size(void) const { return n_; }
+	void apply(const double *x, double *y) const {
+		const INT_TYPE n = n_;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 256) if(perm_.size() >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+		for(INT_TYPE i = 0; i < n; ++i) {
+			double s = 0;
+			for(INT_TYPE k = rptr_[i]; k < rptr_[i+1]; ++k)
+				s += val_[perm_[k]]*x[col_[k]];
+			y[i] = s;
+		}
+	}
+
+private:
+	INT_TYPE n_;
+	const double *val_;
+	std::vector<INT_TYPE> rptr_, col_, perm_;
+};
+
+//! @brief csc_operator of a square csc<double> with ptr(), idx(), val()
+template <typename CSC>
+csc_operator<typename CSC::int_type> make_csc_operator(const CSC &A, bool symmetric = true)
+{
+	return csc_operator<typename CSC::int_type>(
+		A.size(2), &A.ptr()[0], A.nnz() ? &A.idx()[0] : 0, A.nnz() ? &A.val()[0] : 0, symmetric);
+}
+
+//! @brief matrix free operator, f(x, y) computes y = A*x
+template <typename F>
+class function_operator
+{
+public:
+	function_operator(size_t n, const F &f):n_(n), f_(f) {}
+	size_t size(void) const { return n_; }
+	void apply(const double *x, double *y) const { f_(x, y); }
+private:
+	size_t n_;
+	F f_;
+};
+
+//! @brief the lower triangle of a symmetric csc with sorted unique rows
+//! in each column, A may hold the lower, the upper or both triangles.
+//! Entry src[e] of A is added to slot[e] of val.
+template <typename INT_TYPE>
+struct lower_pattern
+{
+	void init(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx) {
+		INT_TYPE nlower = 0;
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k)
+				nlower += idx[k] > j;
+		std::vector<std::pair<INT_TYPE, INT_TYPE> > ent;	// (column, row) of each used k
+		std::vector<INT_TYPE> used;
+		for(INT_TYPE j = 0; j < n; ++j)
+			for(INT_TYPE k = ptr[j]; k < ptr[j+1]; ++k) {
+				const INT_TYPE i = idx[k];
+				if(nlower ? i < j : i > j) continue;
+				ent.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
+				used.push_back(k);
+			}
+		std::vector<size_t> order(ent.size());
+		for(size_t e = 0; e < order.size(); ++e) order[e] = e;
+		std::sort(order.begin(), order.end(), less_entry(ent));
+		this->n = n;
+		this->ptr.assign(n+1, 0);
+		row.clear();
+		src.resize(ent.size());
+		slot.resize(ent.size());
+		for(size_t o = 0; o < order.size(); ++o) {
+			const size_t e = order[o];
+			if(o == 0 || ent[e] != ent[order[o-1]]) {
+				row.push_back(ent[e].second);
+				++this->ptr[ent[e].first+1];
+			}
+			src[o] = used[e];
+			slot[o] = row.size()-1;
+		}
+		for(INT_TYPE j = 0; j < n; ++j) this->ptr[j+1] += this->ptr[j];
+	}
+	//! @brief Lval = the values of the lower triangle
+	void gather(const double *val, std::vector<double> &Lval) const {
+		Lval.assign(row.size(), 0);
+		for(size_t e = 0; e < src.size(); ++e) Lval[slot[e]] += val[src[e]];
+	}
+
+	struct less_entry {
+		less_entry(const std::vector<std::pair<INT_TYPE, INT_TYPE> > &e):ent(&e) {}
+		bool operator()(size_t a, size_t b) const { return (*ent)[a] < (*ent)[b]; }
+		const std::vector<std::pair<INT_TYPE, INT_TYPE> > *ent;
+	};
+
+	INT_TYPE n;
+	std::vector<INT_TYPE> ptr, row;
+	std::vector<size_t> src, slot;
+};
+
+//! @brief a preconditioner of the pattern of a csc, compute sets it up
+//! for the values
+template <typename INT_TYPE = ptrdiff_t>
+class builtin_precond
+{
+public:
+	virtual ~builtin_precond() {}
+	virtual void init(INT_TYPE n, const INT_TYPE *ptr, const INT_TYPE *idx) {
+		L_.init(n, ptr, idx);
+	}
+	//! @return 0 on success
+	virtual int compute(const double *val) = 0;
+	virtual void apply(const double *r, double *z) const = 0;
+
+protected:
+	//! the diagonal of Lval, 0 if missing
+	void diagonal(const std::vector<double> &Lval, std::vector<double> &d) const {
+		d.assign(L_.n, 0);
+		for(INT_TYPE j = 0; j < L_.n; ++j)
+			if(L_.ptr[j] < L_.ptr[j+1] && L_.row[L_.ptr[j]] == j)
+				d[j] = Lval[L_.ptr[j]];
+	}
+	lower_pattern<INT_TYPE> L_;
+};
+
+struct identity_precond
+{
+	identity_precond(size_t n = 0):n_(n) {}
+	void apply(const double *r, double *z) const { std::copy(r, r+n_, z); }
+	size_t n_;
+};
+
+//! @brief M = diag(A)
+template <typename INT_TYPE = ptrdiff_t>
+class jacobi_precond : public builtin_precond<INT_TYPE>
+{
+public:
+	virtual int compute(const double *val) {
+		std::vector<double> Lval;
+		this->L_.gather(val, Lval);
+		this->diagonal(Lval, inv_);
+		for(size_t i = 0; i < inv_.size(); ++i)
+			inv_[i] = (inv_[i] != 0) ? 1/inv_[i] : 1;
+		return 0;
+	}
+	virtual void apply(const double *r, double *z) const {
+		const ptrdiff_t n = inv_.size();
+#ifdef _OPENMP
+#pragma omp parallel for if(n >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+		for(ptrdiff_t i = 0; i < n; ++i) z[i] = inv_[i]*r[i];
+	}
+private:
+	std::vector<double> inv_;
+};
+
+//! @brief M = the BS x BS diagonal blocks of A, e.g. the 3x3 blocks of
+//! the vertices of a mesh.  A singular block falls back to its
+//! diagonal, a last partial block is diagonal.
+template <typename INT_TYPE = ptrdiff_t, int BS = 3>
+class block_jacobi_precond : public builtin_precond<INT_TYPE>
+{
+public:
+	virtual int compute(const double *val) {
+		const lower_pattern<INT_TYPE> &L = this->L_;
+		const INT_TYPE n = L.n, nb = n/BS;
+		std::vector<double> Lval;
+		L.gather(val, Lval);
+		inv_.assign(size_t(nb)*BS*BS, 0);
+		this->diagonal(Lval, dinv_);
+		for(INT_TYPE i = 0; i < n; ++i)
+			dinv_[i] = (dinv_[i] != 0) ? 1/dinv_[i] : 1;
+		for(INT_TYPE b = 0; b < nb; ++b) {
+			double a[BS*BS] = {0};
+			for(INT_TYPE c = 0; c < BS; ++c) {
+				const INT_TYPE j = b*BS+c;
+				for(INT_TYPE k = L.ptr[j]; k < L.ptr[j+1] && L.row[k] < (b+1)*BS; ++k) {
+					const INT_TYPE r = L.row[k]-b*BS;
+					a[r+c*BS] = a[c+r*BS] = Lval[k];
+				}
+			}
+			if(invert(a, &inv_[size_t(b)*BS*BS])) {
+				std::fill(&inv_[size_t(b)*BS*BS], &inv_[size_t(b)*BS*BS]+BS*BS, 0.0);
+				for(int c = 0; c < BS; ++c)
+					inv_[size_t(b)*BS*BS+c*(BS+1)] = dinv_[b*BS+c];
+			}
+		}
+		return 0;
+	}
+	virtual void apply(const double *r, double *z) const {
+		const ptrdiff_t n = dinv_.size(), nb = n/BS;
+#ifdef _OPENMP
+#pragma omp parallel for if(n >= HJ_ITERATIVE_OMP_SIZE)
+#endif
+		for(ptrdiff_t b = 0; b < nb; ++b) {
+			const double *m = &inv_[size_t(b)*BS*BS], *rb = r+b*BS;
+			for(int i = 0; i < BS; ++i) {
+				double s = 0;
+				for(int j = 0; j < BS; ++j) s += m[i+j*BS]*rb[j];
+				z[b*BS+i] = s;
+			}
+		}
+		for(ptrdiff_t i = nb*BS; i < n; ++i) z[i] = dinv_[i]*r[i];
+	}
+
+private:
+	//! Gauss-Jordan with partial pivoting, @return 1 if singular
+	static int invert(const double *a, double *inv) {
+		double m[BS][2*BS];
+		for(int i = 0; i < BS; ++i)
+			for(int j = 0; j < BS; ++j) {
+				m[i][j] = a[i+j*BS];
+				m[i][BS+j] = (i == j);
+			}
+		double scale = 0;
+		for(int i = 0; i < BS*BS; ++i) scale = std::max(scale, std::fabs(a[i]));
+		for(int c = 0; c < BS; ++c) {
+			int p = c;
+			for(int i = c+1; i < BS; ++i)
+				if(std::fabs(m[i][c]) > std::fabs(m[p][c])) p = i;
+			if(!(std::fabs(m[p][c]) > scale*1e-14)) return 1;
+			for(int j = 0; j < 2*BS; ++j) std::swap(m[c][j], m[p][j]);
+			const double d = 1/m[c][c];
+			for(int j = 0; j < 2*BS; ++j) m[c][j] *= d;
+			for(int i = 0; i < BS; ++i) {
+				if(i == c || m[i][c] == 0) continue;
+				const double f = m[i][c];
+				for(int j = 0; j < 2*BS; ++j) m[i][j] -= f*m[c][j];
+			}
+		}
+		for(int i = 0; i < BS; ++i)
+			for(int j = 0; j < BS; ++j)
+				inv[i+j*BS] = m[i][BS+j];
+		return 0;
+	}
+
+	std::vector<double> inv_, dinv_;
+};
+
+//! @brief incomplete Cholesky without fill, M = L*L^T on the pattern of
+//! the lower triangle of A.  A breakdown retries with the diagonal
+//! shifted by (1+alpha).  The triangular solves are sequential.
+template <typename INT_TYPE = ptrdiff_t>
+class ic0_precond : public builtin_precond<INT_TYPE>
+{
+public:
+	virtual int compute(const double *val) {
+		const lower_pattern<INT_TYPE> &L = this->L_;
+		std::vector<double> A;
+		L.gather(val, A);
+		for(double alpha = 0; alpha < 1e6; alpha = std::max(1e-3, alpha*4)) {
+			Lx_ = A;
+			for(INT_TYPE j = 0; j < L.n; ++j)
+				if(L.ptr[j] < L.ptr[j+1] && L.row[L.ptr[j]] == j)
+					Lx_[L.ptr[j]] *= 1+alpha;
+			if(!factor()) return 0;
+		}
+		return 1;
+	}
+	virtual void apply(const double *r, double *z) const {
+		const lower_pattern<INT_TYPE> &L = this->L_;
+		std::copy(r, r+L.n, z);
+		for(INT_TYPE j = 0; j < L.n; ++j) {	// L*y = r
+			const double y = (z[j] /= Lx_[L.ptr[j]]);
+			for(INT_TYPE k = L.ptr[j]+1; k < L.ptr[j+1]; ++k)
+				z[L.row[k]] -= Lx_[k]*y;
+		}
+		for(INT_TYPE j = L.n-1; j >= 0; --j) {	// L^T*z = y
+			double s = z[j];
+			for(INT_TYPE k = L.ptr[j]+1; k < L.ptr[j+1]; ++k)
+				s -= Lx_[k]*z[L.row[k]];
+			z[j] = s/Lx_[L.ptr[j]];
+		}
+	}
+
+private:
+	//! right looking on the pattern, @return 1 on a breakdown
+	int factor(void) {
+		const lower_pattern<INT_TYPE> &L = this->L_;
+		for(INT_TYPE j = 0; j < L.n; ++j) {
+			const INT_TYPE b = L.ptr[j], e = L.ptr[j+1];
+			if(b == e || L.row[b] != j || !(Lx_[b] > 0)) return 1;
+			const double d = std::sqrt(Lx_[b]);
+			Lx_[b] = d;
+			for(INT_TYPE k = b+1; k < e; ++k) Lx_[k] /= d;
+			// L(i, c) -= L(i, j)*L(c, j) for the rows i >= c of column j
+			for(INT_TYPE kc = b+1; kc < e; ++kc) {
+				const INT_TYPE c = L.row[kc];
+				INT_TYPE p = L.ptr[c];
+				for(INT_TYPE ki = kc; ki < e; ++ki) {
+					const INT_TYPE i = L.row[ki];
+					while(p < L.ptr[c+1] && L.row[p] < i) ++p;
+					if(p == L.ptr[c+1]) break;
+					if(L.row[p] == i) Lx_[p] -= Lx_[ki]*Lx_[kc];
+				}
+			}
+		}
+		return 0;
+	}
+
+	std::vector<double> Lx_;
+};
+
+//! @brief symmetric SOR, M = (D+w*L)*D^{-1}*(D+w*L^T)/(w*(2-w)), w = 1
+//! is symmetric Gauss-Seidel.  The sweeps are sequential.
+template <typename INT_TYPE = ptrdiff_t>
+class ssor_precond : public builtin_precond<INT_TYPE>
+{
+public:
+	ssor_precond(double omega = 1):omega_(omega) {}
+	virtual int compute(const double *val) {
+		this->L_.gather(val, Lx_);
+		this->diagonal(Lx_, d_);
+		for(size_t i = 0; i < d_.size(); ++i)
+			if(!(d_[i] > 0)) return 1;
+		return 0;
+	}
+	virtual void apply(const double *r, double *z) const {
+		const lower_pattern<INT_TYPE> &L = this->L_;
+		const double w = omega_;
+		std::copy(r, r+L.n, z);
+		for(INT_TYPE j = 0; j < L.n; ++j) {	// (D+w*L)*y = r
+			const double y = (z[j] /= d_[j]);
+			for(INT_TYPE k = L.ptr[j]+1; k < L.ptr[j+1]; ++k)
+				z[L.row[k]] -= w*Lx_[k]*y;
+		}
+		for(INT_TYPE j = 0; j < L.n; ++j) z[j] *= d_[j];
+		for(INT_TYPE j = L.n-1; j >= 0; --j) {	// (D+w*L^T)*z = D*y
+			double s = z[j];
+			for(INT_TYPE k = L.ptr[j]+1; k < L.ptr[j+1]; ++k)
+				s -= w*Lx_[k]*z[L.row[k]];
+			z[j] = s/d_[j];
+		}
+		const double f = w*(2-w);
+		for(INT_TYPE j = 0; j < L.n; ++j) z[j] *= f;
+	}
+private:
+	double omega_;
+	std::vector<double> Lx_, d_;
+};
+
+//! @brief preconditioned conjugate gradient for SPD A and M
+template <typename OP, typename PREC>
+iterative_result pcg(const OP &A, const PREC &M, const double *b, double *x,
+					 double tol, size_t max_iter)
+{
+	const size_t n = A.size();
+	iterative_result res;
+	const double bn = std::sqrt(iterative_dot(n, b, b));
+	if(bn == 0) {
+		std::fill(x, x+n, 0.0);
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	std::vector<double> r(n), z(n), p(n), q(n);
+	double rn = iterative_residual(A, b, x, &r[0]);
+	res.residual = rn/bn;
+	if(res.residual <= tol) {
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	M.apply(&r[0], &z[0]);
+	p = z;
+	double rz = iterative_dot(n, &r[0], &z[0]);
+	for(res.iterations = 1; res.iterations <= max_iter; ++res.iterations) {
+		A.apply(&p[0], &q[0]);
+		const double pq = iterative_dot(n, &p[0], &q[0]);
+		if(!(pq > 0)) {
+			res.status = iterative_result::BREAKDOWN;
+			break;
+		}
+		const double alpha = rz/pq;
+		iterative_axpby(n, alpha, &p[0], 1, x);
+		iterative_axpby(n, -alpha, &q[0], 1, &r[0]);
+		rn = std::sqrt(iterative_dot(n, &r[0], &r[0]));
+		res.residual = rn/bn;
+		if(res.residual <= tol) {
+			res.status = iterative_result::CONVERGED;
+			return res;
+		}
+		M.apply(&r[0], &z[0]);
+		const double rz1 = iterative_dot(n, &r[0], &z[0]);
+		iterative_axpby(n, 1, &z[0], rz1/rz, &p[0]);
+		rz = rz1;
+	}
+	res.iterations = std::min(res.iterations, max_iter);
+	return res;
+}
+
+//! @brief preconditioned MINRES for symmetric, possibly indefinite A
+//! and SPD M, after Paige and Saunders
+template <typename OP, typename PREC>
+iterative_result minres(const OP &A, const PREC &M, const double *b, double *x,
+						double tol, size_t max_iter)
+{
+	const size_t n = A.size();
+	iterative_result res;
+	const double bn = std::sqrt(iterative_dot(n, b, b));
+	if(bn == 0) {
+		std::fill(x, x+n, 0.0);
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	std::vector<double> r1(n), r2(n), y(n), v(n), w(n, 0), w1(n, 0), w2(n, 0);
+	res.residual = iterative_residual(A, b, x, &r1[0])/bn;
+	if(res.residual <= tol) {
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	// the estimate phibar is in the norm of M^{-1}, scale tol by it
+	M.apply(b, &y[0]);
+	const double bMn = std::sqrt(std::max(0.0, iterative_dot(n, b, &y[0])));
+	M.apply(&r1[0], &y[0]);
+	const double beta1 = std::sqrt(std::max(0.0, iterative_dot(n, &r1[0], &y[0])));
+	r2 = r1;
+	double oldb = 0, beta = beta1, dbar = 0, epsln = 0, phibar = beta1, cs = -1, sn = 0;
+	const double eps = std::numeric_limits<double>::epsilon();
+	for(res.iterations = 1; res.iterations <= max_iter; ++res.iterations) {
+		if(!(beta > 0)) {
+			res.status = iterative_result::BREAKDOWN;
+			break;
+		}
+		const double s = 1/beta;
+		for(size_t i = 0; i < n; ++i) v[i] = s*y[i];
+		A.apply(&v[0], &y[0]);
+		if(res.iterations >= 2) iterative_axpby(n, -beta/oldb, &r1[0], 1, &y[0]);
+		const double alfa = iterative_dot(n, &v[0], &y[0]);
+		iterative_axpby(n, -alfa/beta, &r2[0], 1, &y[0]);
+		r1.swap(r2);
+		r2 = y;
+		M.apply(&r2[0], &y[0]);
+		oldb = beta;
+		beta = std::sqrt(std::max(0.0, iterative_dot(n, &r2[0], &y[0])));
+		const double oldeps = epsln, delta = cs*dbar+sn*alfa, gbar = sn*dbar-cs*alfa;
+		epsln = sn*beta;
+		dbar = -cs*beta;
+		const double gamma = std::max(std::sqrt(gbar*gbar+beta*beta), eps);
+		cs = gbar/gamma;
+		sn = beta/gamma;
+		const double phi = cs*phibar;
+		phibar *= sn;
+		const double denom = 1/gamma;
+		w1.swap(w2);
+		w2.swap(w);
+		for(size_t i = 0; i < n; ++i) w[i] = (v[i]-oldeps*w1[i]-delta*w2[i])*denom;
+		iterative_axpby(n, phi, &w[0], 1, x);
+		if(phibar <= tol*bMn) {
+			res.residual = iterative_residual(A, b, x, &y[0])/bn;
+			if(res.residual <= tol) {
+				res.status = iterative_result::CONVERGED;
+				return res;
+			}
+			M.apply(&r2[0], &y[0]);	// y is still needed
+		}
+	}
+	res.iterations = std::min(res.iterations, max_iter);
+	std::vector<double> r(n);
+	res.residual = iterative_residual(A, b, x, &r[0])/bn;
+	return res;
+}
+
+//! @brief right preconditioned BiCGSTAB for general A
+template <typename OP, typename PREC>
+iterative_result bicgstab(const OP &A, const PREC &M, const double *b, double *x,
+						  double tol, size_t max_iter)
+{
+	const size_t n = A.size();
+	iterative_result res;
+	const double bn = std::sqrt(iterative_dot(n, b, b));
+	if(bn == 0) {
+		std::fill(x, x+n, 0.0);
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	std::vector<double> r(n), rhat(n), p(n, 0), v(n, 0), ph(n), s(n), sh(n), t(n);
+	res.residual = iterative_residual(A, b, x, &r[0])/bn;
+	if(res.residual <= tol) {
+		res.status = iterative_result::CONVERGED;
+		return res;
+	}
+	rhat = r;
+	double rho = 1, alpha = 1, omega = 1;
+	for(res.iterations = 1; res.iterations <= max_iter; ++res.iterations) {
+		const double rho1 = iterative_dot(n, &rhat[0], &r[0]);
+		if(rho1 == 0 || omega == 0) {
+			res.status = iterative_result::BREAKDOWN;
+			break;
+		}
+		const double beta = (rho1/rho)*(alpha/omega);
+		for(size_t i = 0; i < n; ++i) p[i] = r[i]+beta*(p[i]-omega*v[i]);
+		M.apply(&p[0], &ph[0]);
+		A.apply(&ph[0], &v[0]);
+		const double rv = iterative_dot(n, &rhat[0], &v[0]);
+		if(rv == 0) {
+			res.status = iterative_result::BREAKDOWN;
+			break;
+		}
+		alpha = rho1/rv;
+		iterative_xpay(n, &r[0], -alpha, &v[0], &s[0]);
+		const double sn = std::sqrt(iterative_dot(n, &s[0], &s[0]));
+		if(sn/bn <= tol) {
+			iterative_axpby(n, alpha, &ph[0], 1, x);
+			res.residual = sn/bn;
+			res.status = iterative_result::CONVERGED;
+			return res;
+		}
+		M.apply(&s[0], &sh[0]);
+		A.apply(&sh[0], &t[0]);
+		const double tt = iterative_dot(n, &t[0], &t[0]);
+		omega = (tt > 0) ? iterative_dot(n, &t[0], &s[0])/tt : 0;
+		iterative_axpby(n, alpha, &ph[0], 1, x);
+		iterative_axpby(n, omega, &sh[0], 1, x);
+		iterative_xpay(n, &s[0], -omega, &t[0], &r[0]);
+		res.residual = std::sqrt(iterative_dot(n, &r[0], &r[0]))/bn;
+		if(res.residual <= tol) {
+			res.status = iterative_result::CONVERGED;
+			return res;
+		}
+		rho = rho1;
+	}
+	res.iterations = std::min(res.iterations, max_iter);
+	return res;
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef HJ_BUILTIN_LINEAR_SOLVER_H_
+#define HJ_BUILTIN_LINEAR_SOLVER_H_
+
+//! linear_solver_factory, which creates solvers from a csc of any value
+//! and index type, and the in-tree solvers it dispatches to.
+//! linear_solver.h alone holds the interfaces.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <limits>
+
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <sys/time.h>
+#endif
+
+#include "linear_solver.h"
+#include "builtin_chol.h"
+#include "builtin_iterative.h"
+#include "builtin_amg.h"
+
+class linear_solver_factory
+{
+public:
+	/**
+	 * create from a csc of other value or index types, e.g. float
+	 * values or 64 bit indices, see create_reusable.
+	 *
+	 * @return 0 if nnz or the size does not fit into 32 bit indices
+	 */
+	template <typename T, typename INT_TYPE>
+	static linear_solver *create(
+					const T* val, const INT_TYPE* idx,
+					const INT_TYPE* ptr, const size_t nnz,
+					const size_t row, const size_t col,
+					boost::property_tree::ptree & opts);
+
+	/**
+	 * create a solver which keeps the pattern for refactor.
+	 *
+	 * "linear_solver/type.value" "direct" with
+	 * "linear_solver/name.value" "builtin_chol" selects the in-tree
+	 * supernodal Cholesky of builtin_chol.h, which takes any index
+	 * type, "builtin_chol/ordering.value" "<nd, natural>".  With
+	 * "builtin_chol/memory_budget.value" in MB its factor goes to an
+	 * unnamed scratch file in "builtin_chol/scratch_dir.value", by
+	 * default TMPDIR, when larger.
+	 *
+	 * "linear_solver/type.value" "iterative" with
+	 * "linear_solver/name.value" "<builtin_pcg, builtin_minres,
+	 * builtin_bicgstab, builtin_amg>" selects the Krylov solvers of
+	 * builtin_iterative.h or the V-cycles of builtin_amg.h, see
+	 * builtin_iterative_solver.  The
+	 * solvers in the library take double values and 32 bit indices,
+	 * the arrays are converted and kept by the returned solver.
+	 *
+	 * @return 0 on failure, for an unknown builtin_ name, or if nnz or
+	 * the size does not fit into 32 bit indices for a library solver
+	 */
+	template <typename T, typename INT_TYPE>
+	static refactorable_linear_solver *create_reusable(
+					const T* val, const INT_TYPE* idx,
+					const INT_TYPE* ptr, const size_t nnz,
+					const size_t row, const size_t col,
+					boost::property_tree::ptree & opts);
+};
+
+//! @brief wall clock in seconds
+inline double linear_solver_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER f, t;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&t);
+	return double(t.QuadPart)/double(f.QuadPart);
+#else
+	timeval t;
+	gettimeofday(&t, 0);
+	return t.tv_sec+t.tv_usec*1e-6;
+#endif
+}
+
+//! @brief keeps the pattern and the converted values for the solvers
+//! of the library.  refactor goes to the inner solver when it is
+//! refactorable, otherwise the inner solver is created again from the
+//! kept pattern.
+class reusable_linear_solver : public refactorable_linear_solver
+{
+public:
+	reusable_linear_solver():slv_(0), rows_(0) {}
+	virtual ~reusable_linear_solver() { delete slv_; }
+
+	virtual int solve(const double *b, double *x, size_t rhs, boost::property_tree::ptree &opts) {
+		if(!slv_) return 1;
+		const double t = linear_solver_clock();
+		const int rtn = slv_->solve(b, x, rhs, opts);
+		timing_.solve = linear_solver_clock()-t;
+		return rtn;
+	}
+	virtual int refactor(const double *val, boost::property_tree::ptree &opts) {
+		val_.assign(val, val+val_.size());
+		return factorize(opts);
+	}
+	//! @brief refactor with values of another type
+	template <typename T>
+	int refactor(const T *val, boost::property_tree::ptree &opts) {
+		val_.assign(val, val+val_.size());
+		return factorize(opts);
+	}
+	virtual linear_solver_timing timing(void) const {
+		refactorable_linear_solver *r = dynamic_cast<refactorable_linear_solver *>(slv_);
+		if(!r) return timing_;
+		linear_solver_timing t = r->timing();
+		t.solve = timing_.solve;
+		return t;
+	}
+
+	//! @brief the solver of the library
+	linear_solver *inner(void) const { return slv_; }
+
+private:
+	friend class linear_solver_factory;
+
+	int factorize(boost::property_tree::ptree &opts) {
+		refactorable_linear_solver *r = dynamic_cast<refactorable_linear_solver *>(slv_);
+		if(r) return r->refactor(val_.empty() ? 0 : &val_[0], opts);
+		const double t = linear_solver_clock();
+		delete slv_;
+		slv_ = linear_solver::create(val_.empty() ? 0 : &val_[0], idx_.empty() ? 0 : &idx_[0], &ptr_[0],
+									 val_.size(), rows_, ptr_.size()-1, opts);
+		timing_.analyse = 0;
+		timing_.factor = linear_solver_clock()-t;
+		return slv_ ? 0 : 1;
+	}
+
+	std::vector<double> val_;
+	std::vector<int32_t> idx_, ptr_;
+	linear_solver *slv_;
+	size_t rows_;
+	linear_solver_timing timing_;
+};
+
+//! @brief the in-tree supernodal Cholesky as a linear_solver
+template <typename INT_TYPE>
+class builtin_chol_solver : public refactorable_linear_solver
+{
+public:
+	builtin_chol_solver():factored_(false) {}
+
+	//! @return 0 on success
+	template <typename T>
+	int create(const T *val, const INT_TYPE *idx, const INT_TYPE *ptr,
+			   size_t row, size_t col, boost::property_tree::ptree &opts) {
+		if(row != col) return 1;
+		const std::string ord = opts.get<std::string>("builtin_chol/ordering.value", "nd");
+		const double budget = opts.get<double>("builtin_chol/memory_budget.value", 0);
+		if(budget > 0)
+			chol_.set_out_of_core(opts.get<std::string>("builtin_chol/scratch_dir.value", scratch_dir()),
+								  size_t(budget*1024*1024));
+		const double t = linear_solver_clock();
+		if(chol_.analyse(INT_TYPE(col), ptr, idx,
+						 ord == "natural" ? builtin_chol<INT_TYPE>::NATURAL
+						 : builtin_chol<INT_TYPE>::NESTED_DISSECTION))
+			return 1;
+		timing_.analyse = linear_solver_clock()-t;
+		return factorize(val);
+	}
+	//! @return 1 if the last factorization failed
+	virtual int solve(const double *b, double *x, size_t rhs, boost::property_tree::ptree &) {
+		if(!factored_) return 1;
+		const double t = linear_solver_clock();
+		const size_t n = chol_.size();
+		std::copy(b, b+n*rhs, x);
+		chol_.solve(x, INT_TYPE(rhs), INT_TYPE(n));
+		timing_.solve = linear_solver_clock()-t;
+		return 0;
+	}
+	virtual int refactor(const double *val, boost::property_tree::ptree &) {
+		return factorize(val);
+	}
+	virtual linear_solver_timing timing(void) const { return timing_; }
+
+	const builtin_chol<INT_TYPE> &chol(void) const { return chol_; }
+
+private:
+	template <typename T>
+	int factorize(const T *val) {
+		const double t = linear_solver_clock();
+		const int rtn = chol_.factorize(val);
+		timing_.factor = linear_solver_clock()-t;
+		factored_ = (rtn == 0);
+		return rtn;
+	}
+
+	//! the temporary directory
+	static std::string scratch_dir(void) {
+		const char *dir = getenv("TMPDIR");
+#ifdef _WIN32
+		if(!dir) dir = getenv("TEMP");
+		if(!dir) return ".";
+#endif
+		return dir ? dir : "/tmp";
+	}
+
+	builtin_chol<INT_TYPE> chol_;
+	linear_solver_timing timing_;
+	bool factored_;
+};
+
+//! @brief the Krylov solvers of builtin_iterative.h as a linear_solver,
+//! "builtin_amg" runs V-cycles of the amg preconditioner alone.
+//! A matrix holding only its lower or only its upper triangle is read
+//! as symmetric and mirrored for every method, builtin_bicgstab
+//! included, so a nonsymmetric matrix must hold both triangles.
+//!
+//! "builtin_iterative/pc.value" "<none, jacobi, block_jacobi, ic0, ssor, amg>"
+//! "builtin_iterative/ssor_omega.value" 1
+//! "builtin_iterative/amg_block_size.value" 1, e.g. 3 for xyz of vertices
+//! "builtin_iterative/amg_reuse.value" 1, refactor keeps the aggregates
+//! "builtin_iterative/tol.value" 1e-8, relative to |b|, may change
+//! between solves for inexact Newton
+//! "builtin_iterative/max_iter.value" 1000
+//! "builtin_iterative/warm_start.value" 1, start from the last solution
+//!
+//! solve puts "builtin_iterative/iterations.value" and the largest
+//! relative "builtin_iterative/residual.value" of the rhs into opts,
+//! and returns 0 if all of them converged.
+template <typename INT_TYPE>
+class builtin_iterative_solver : public refactorable_linear_solver
+{
+public:
+	enum { PCG, MINRES, BICGSTAB, AMG };
+
+	builtin_iterative_solver():method_(PCG), pc_(0) {}
+	virtual ~builtin_iterative_solver() { delete pc_; }
+
+	//! @return 0 on success, 1 for an unknown "linear_solver/name.value"
+	template <typename T>
+	int create(const T *val, const INT_TYPE *idx, const INT_TYPE *ptr,
+			   size_t nnz, size_t row, size_t col, boost::property_tree::ptree &opts) {
+		if(row != col) return 1;
+		const std::string name = opts.get<std::string>("linear_solver/name.value", "");
+		if(name == "builtin_pcg") method_ = PCG;
+		else if(name == "builtin_minres") method_ = MINRES;
+		else if(name == "builtin_bicgstab") method_ = BICGSTAB;
+		else if(name == "builtin_amg") method_ = AMG;
+		else return 1;
+		const double t = linear_solver_clock();
+		ptr_.assign(ptr, ptr+col+1);
+		idx_.assign(idx, idx+nnz);
+		val_.resize(nnz);
+		A_.init(INT_TYPE(col), &ptr_[0], idx_.empty() ? 0 : &idx_[0], 0);
+		const std::string pc = (method_ == AMG) ? std::string("amg")
+			: opts.get<std::string>("builtin_iterative/pc.value", "jacobi");
+		if(pc == "jacobi") pc_ = new jacobi_precond<INT_TYPE>;
+		else if(pc == "block_jacobi") pc_ = new block_jacobi_precond<INT_TYPE, 3>;
+		else if(pc == "ic0") pc_ = new ic0_precond<INT_TYPE>;
+		else if(pc == "ssor")
+			pc_ = new ssor_precond<INT_TYPE>(opts.get<double>("builtin_iterative/ssor_omega.value", 1));
+		else if(pc == "amg")
+			pc_ = new builtin_amg<INT_TYPE>(opts.get<int>("builtin_iterative/amg_block_size.value", 1),
+											opts.get<int>("builtin_iterative/amg_reuse.value", 1) != 0);
+		else if(pc != "none") return 1;
+		if(pc_) pc_->init(INT_TYPE(col), &ptr_[0], idx_.empty() ? 0 : &idx_[0]);
+		timing_.analyse = linear_solver_clock()-t;
+		return factorize(val);
+	}
+	virtual int solve(const double *b, double *x, size_t rhs, boost::property_tree::ptree &opts) {
+		const double t = linear_solver_clock();
+		const size_t n = A_.size();
+		const double tol = opts.get<double>("builtin_iterative/tol.value", 1e-8);
+		const size_t max_iter = opts.get<size_t>("builtin_iterative/max_iter.value", 1000);
+		if(opts.get<int>("builtin_iterative/warm_start.value", 1) && last_.size() == n*rhs)
+			std::copy(last_.begin(), last_.end(), x);
+		else
+			std::fill(x, x+n*rhs, 0.0);
+		size_t iterations = 0;
+		double residual = 0;
+		int rtn = 0;
+		for(size_t c = 0; c < rhs; ++c) {
+			const iterative_result r = solve(b+c*n, x+c*n, tol, max_iter);
+			iterations += r.iterations;
+			residual = std::max(residual, r.residual);
+			if(r.status != iterative_result::CONVERGED) rtn = 1;
+		}
+		last_.assign(x, x+n*rhs);
+		opts.put("builtin_iterative/iterations.value", iterations);
+		opts.put("builtin_iterative/residual.value", residual);
+		timing_.solve = linear_solver_clock()-t;
+		return rtn;
+	}
+	virtual int refactor(const double *val, boost::property_tree::ptree &) {
+		return factorize(val);
+	}
+	virtual linear_solver_timing timing(void) const { return timing_; }
+
+private:
+	//! @brief take the values and set up the preconditioner
+	template <typename T>
+	int factorize(const T *val) {
+		const double t = linear_solver_clock();
+		val_.assign(val, val+val_.size());
+		A_.set_values(val_.empty() ? 0 : &val_[0]);
+		const int rtn = pc_ ? pc_->compute(val_.empty() ? 0 : &val_[0]) : 0;
+		timing_.factor = linear_solver_clock()-t;
+		return rtn;
+	}
+	iterative_result solve(const double *b, double *x, double tol, size_t max_iter) const {
+		if(pc_) return solve(*pc_, b, x, tol, max_iter);
+		return solve(identity_precond(A_.size()), b, x, tol, max_iter);
+	}
+	template <typename PREC>
+	iterative_result solve(const PREC &M, const double *b, double *x, double tol, size_t max_iter) const {
+		if(method_ == AMG)
+			return static_cast<const builtin_amg<INT_TYPE> *>(pc_)->solve(b, x, tol, max_iter);
+		if(method_ == MINRES) return minres(A_, M, b, x, tol, max_iter);
+		if(method_ == BICGSTAB) return bicgstab(A_, M, b, x, tol, max_iter);
+		return pcg(A_, M, b, x, tol, max_iter);
+	}
+
+	int method_;
+	std::vector<INT_TYPE> ptr_, idx_;
+	std::vector<double> val_, last_;
+	csc_operator<INT_TYPE> A_;
+	builtin_precond<INT_TYPE> *pc_;
+	linear_solver_timing timing_;
+};
+
+template <typename T, typename INT_TYPE>
+linear_solver *linear_solver_factory::create(
+	const T* val, const INT_TYPE* idx,
+	const INT_TYPE* ptr, const size_t nnz,
+	const size_t row, const size_t col,
+	boost::property_tree::ptree & opts)
+{
+	return create_reusable(val, idx, ptr, nnz, row, col, opts);
+}
+
+template <typename T, typename INT_TYPE>
+refactorable_linear_solver *linear_solver_factory::create_reusable(
+	const T* val, const INT_TYPE* idx,
+	const INT_TYPE* ptr, const size_t nnz,
+	const size_t row, const size_t col,
+	boost::property_tree::ptree & opts)
+{
+	if(opts.get<std::string>("linear_solver/type.value", "") == "direct"
+	   && opts.get<std::string>("linear_solver/name.value", "") == "builtin_chol") {
+		builtin_chol_solver<INT_TYPE> *slv = new builtin_chol_solver<INT_TYPE>;
+		if(slv->create(val, idx, ptr, row, col, opts)) {
+			delete slv;
+			return 0;
+		}
+		return slv;
+	}
+	if(opts.get<std::string>("linear_solver/type.value", "") == "iterative"
+	   && opts.get<std::string>("linear_solver/name.value", "").compare(0, 8, "builtin_") == 0) {
+		builtin_iterative_solver<INT_TYPE> *slv = new builtin_iterative_solver<INT_TYPE>;
+		if(slv->create(val, idx, ptr, nnz, row, col, opts)) {
+			delete slv;
+			return 0;
+		}
+		return slv;
+	}
+	const size_t lim = size_t(std::numeric_limits<int32_t>::max());
+	if(nnz > lim || row > lim || col > lim)
+		return 0;
+	reusable_linear_solver *slv = new reusable_linear_solver;
+	slv->val_.assign(val, val+nnz);
+	slv->idx_.assign(idx, idx+nnz);
+	slv->ptr_.assign(ptr, ptr+col+1);
+	slv->rows_ = row;
+	if(slv->factorize(opts)) {
+		delete slv;
+		return 0;
+	}
+	return slv;
+}
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef HJ_LINEAR_SOLVER_H_
 #define HJ_LINEAR_SOLVER_H_
 
+#include <stdint.h>
+
+#include <cstddef>
+
 #include <boost/property_tree/ptree.hpp>
 
 class linear_solver
@@ -22,10 +26,35 @@ public:
 					const int32_t* ptr, const size_t nnz,
 					const size_t row,	const size_t col,
 					boost::property_tree::ptree & opts);
+	//! other value and index types, refactor and the in-tree solvers
+	//! are created by linear_solver_factory of builtin_linear_solver.h
 
 	virtual int solve(const double *b, double *x, size_t rhs, boost::property_tree::ptree &opts) = 0;
 
 	virtual ~linear_solver(){}
 };
 
+//! @brief seconds spent in each phase, phases a solver does not
+//! separate are counted as factor
+struct linear_solver_timing
+{
+	linear_solver_timing():analyse(0), factor(0), solve(0) {}
+	double analyse, factor, solve;
+};
+
+//! @brief a solver which takes new values of the pattern it was
+//! created with, keeping the ordering and symbolic factorization
+class refactorable_linear_solver : public linear_solver
+{
+public:
+	/**
+	 * @param val the values in the order of the pattern at creation
+	 * @return 0 on success
+	 */
+	virtual int refactor(const double *val, boost::property_tree::ptree &opts) = 0;
+
+	//! @brief the time of the last analyse, factor and solve
+	virtual linear_solver_timing timing(void) const = 0;
+};
+
 #endif
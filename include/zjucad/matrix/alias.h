@@ -0,0 +1,218 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_ALIAS_H_
+#define _ZJUCAD_MATRIX_ALIAS_H_
+
+//! @brief alias analysis for assign() in matrix_expression.h.
+//!
+//! expr_alias<E>::check tells how an expression reads the matrix being
+//! assigned:
+//!   alias_none:        not at all, or through an unknown expression
+//!   alias_elementwise: element i is only read to produce element i of
+//!                      the same shape, e.g. a = a*0.5 + b
+//!   alias_other:       any other access, e.g. a = trans(a), a = a*b,
+//!                      a = a(colon(2, 4)), which needs a temporary.
+//! Unknown expressions are treated as alias_none, as assign always did.
+
+#include <algorithm>
+
+namespace zjucad { namespace matrix {
+
+template <typename T, typename F, typename A, bool tmp> struct matrix;
+template <typename ITR> class itr_matrix;
+template <typename E, typename F> struct matrix_each_element;
+template <typename E1, typename E2, typename F> struct matrix_matrix_each_element;
+template <typename E, typename F> struct matrix_scalar_function;
+template <typename E, typename F> struct scalar_matrix_function;
+template <typename E1, typename E2> struct matrix_matrix_multiplies;
+template <typename E> struct matrix_trans;
+template <typename T, typename E> struct matrix_convert;
+
+template <typename E> class idx_cv_i;
+template <typename E1, typename E2> class idx_cv_J;
+template <typename E, typename R> class idx_cv_range;
+template <typename E, typename R> class idx_cv_iv;
+template <typename E> class idx_i_cv;
+template <typename E1, typename E2> class idx_J_cv;
+template <typename E, typename R> class idx_range_cv;
+template <typename E, typename R> class idx_iv_cv;
+template <typename E, typename R> class idx_range_i;
+template <typename E, typename R1, typename R2> class idx_range_range;
+template <typename E, typename E1> class idx_I;
+template <typename E> class idx_cv;
+template <typename E, typename T> class idx_range;
+template <typename E, typename T> class idx_iv;
+
+template <typename E1, typename E2> class idx_J_i;
+template <typename E, typename R> class idx_iv_i;
+template <typename E1, typename E2> class idx_i_J;
+template <typename E1, typename E2, typename E3> class idx_J_J;
+template <typename E1, typename R, typename E2> class idx_range_J;
+template <typename E1, typename R, typename E2> class idx_iv_J;
+template <typename E, typename R> class idx_i_range;
+template <typename E1, typename E2, typename R> class idx_J_range;
+template <typename E, typename R1, typename R2> class idx_iv_range;
+template <typename E, typename R> class idx_i_iv;
+template <typename E1, typename E2, typename R> class idx_J_iv;
+template <typename E, typename R1, typename R2> class idx_range_iv;
+template <typename E, typename R1, typename R2> class idx_iv_iv;
+
+template <typename E>
+struct expr_alias<const E> : public expr_alias<E> {};
+
+template <typename T, typename F, typename A, bool tmp>
+struct expr_alias<matrix<T, F, A, tmp> > {
+	static int check(const matrix<T, F, A, tmp> &e, const alias_target &t) {
+		return (static_cast<const void *>(&e) == t.obj) ? alias_elementwise : alias_none;
+	}
+};
+
+//! an itr_matrix may view the storage of the assigned matrix
+template <typename T>
+struct expr_alias<itr_matrix<T *> > {
+	static int check(const itr_matrix<T *> &e, const alias_target &t) {
+		const void *lo = e.begin(), *hi = e.end();
+		return (t.lo < hi && lo < t.hi) ? alias_other : alias_none;
+	}
+};
+
+template <typename E, typename F>
+struct expr_alias<matrix_each_element<E, F> > {
+	static int check(const matrix_each_element<E, F> &e, const alias_target &t) {
+		return expr_alias<E>::check(e.m_e, t);
+	}
+};
+
+template <typename E1, typename E2, typename F>
+struct expr_alias<matrix_matrix_each_element<E1, E2, F> > {
+	static int check(const matrix_matrix_each_element<E1, E2, F> &e, const alias_target &t) {
+		return std::max(expr_alias<E1>::check(e.m_e1, t), expr_alias<E2>::check(e.m_e2, t));
+	}
+};
+
+template <typename E, typename F>
+struct expr_alias<matrix_scalar_function<E, F> > {
+	static int check(const matrix_scalar_function<E, F> &e, const alias_target &t) {
+		return expr_alias<E>::check(e.m_e1, t);
+	}
+};
+
+template <typename E, typename F>
+struct expr_alias<scalar_matrix_function<E, F> > {
+	static int check(const scalar_matrix_function<E, F> &e, const alias_target &t) {
+		return expr_alias<E>::check(e.m_e2, t);
+	}
+};
+
+template <typename T, typename E>
+struct expr_alias<matrix_convert<T, E> > {
+	static int check(const matrix_convert<T, E> &e, const alias_target &t) {
+		return expr_alias<E>::check(e.m_e, t);
+	}
+};
+
+template <typename E1, typename E2>
+struct expr_alias<matrix_matrix_multiplies<E1, E2> > {
+	static int check(const matrix_matrix_multiplies<E1, E2> &e, const alias_target &t) {
+		return (expr_alias<E1>::check(e.m_e1, t) || expr_alias<E2>::check(e.m_e2, t))
+			? alias_other : alias_none;
+	}
+};
+
+template <typename E>
+struct expr_alias<matrix_trans<E> > {
+	static int check(const matrix_trans<E> &e, const alias_target &t) {
+		return expr_alias<E>::check(e.m_e, t) ? alias_other : alias_none;
+	}
+};
+
+//! proxies read their source through m_m, or through the m_m of the
+//! inner proxy they wrap, with another index mapping
+#define ZJUCAD_MATRIX_PROXY_ALIAS(TARGS, PROXY, SRC, MEMBER)	\
+template <TARGS>												\
+struct expr_alias<PROXY > {										\
+	static int check(const PROXY &e, const alias_target &t) {	\
+		return expr_alias<SRC>::check(e.MEMBER, t) ? alias_other : alias_none; \
+	}															\
+}
+
+#define ZJUCAD_MATRIX_COMMA ,
+
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E, idx_cv_i<E>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2, idx_cv_J<E1 ZJUCAD_MATRIX_COMMA E2>, E1, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_cv_range<E ZJUCAD_MATRIX_COMMA R>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_cv_iv<E ZJUCAD_MATRIX_COMMA R>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E, idx_i_cv<E>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2, idx_J_cv<E1 ZJUCAD_MATRIX_COMMA E2>, E1, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_range_cv<E ZJUCAD_MATRIX_COMMA R>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_iv_cv<E ZJUCAD_MATRIX_COMMA R>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_range_i<E ZJUCAD_MATRIX_COMMA R>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R1 ZJUCAD_MATRIX_COMMA typename R2, idx_range_range<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename E1, idx_I<E ZJUCAD_MATRIX_COMMA E1>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E, idx_cv<E>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename T, idx_range<E ZJUCAD_MATRIX_COMMA T>, E, m_m);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename T, idx_iv<E ZJUCAD_MATRIX_COMMA T>, E, m_m);
+
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2, idx_J_i<E1 ZJUCAD_MATRIX_COMMA E2>, typename idx_J_i<E1 ZJUCAD_MATRIX_COMMA E2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_iv_i<E ZJUCAD_MATRIX_COMMA R>, typename idx_iv_i<E ZJUCAD_MATRIX_COMMA R>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2, idx_i_J<E1 ZJUCAD_MATRIX_COMMA E2>, typename idx_i_J<E1 ZJUCAD_MATRIX_COMMA E2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2 ZJUCAD_MATRIX_COMMA typename E3, idx_J_J<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA E3>, typename idx_J_J<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA E3>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename R ZJUCAD_MATRIX_COMMA typename E2, idx_range_J<E1 ZJUCAD_MATRIX_COMMA R ZJUCAD_MATRIX_COMMA E2>, typename idx_range_J<E1 ZJUCAD_MATRIX_COMMA R ZJUCAD_MATRIX_COMMA E2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename R ZJUCAD_MATRIX_COMMA typename E2, idx_iv_J<E1 ZJUCAD_MATRIX_COMMA R ZJUCAD_MATRIX_COMMA E2>, typename idx_iv_J<E1 ZJUCAD_MATRIX_COMMA R ZJUCAD_MATRIX_COMMA E2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_i_range<E ZJUCAD_MATRIX_COMMA R>, typename idx_i_range<E ZJUCAD_MATRIX_COMMA R>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2 ZJUCAD_MATRIX_COMMA typename R, idx_J_range<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA R>, typename idx_J_range<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA R>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R1 ZJUCAD_MATRIX_COMMA typename R2, idx_iv_range<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>, typename idx_iv_range<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R, idx_i_iv<E ZJUCAD_MATRIX_COMMA R>, typename idx_i_iv<E ZJUCAD_MATRIX_COMMA R>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E1 ZJUCAD_MATRIX_COMMA typename E2 ZJUCAD_MATRIX_COMMA typename R, idx_J_iv<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA R>, typename idx_J_iv<E1 ZJUCAD_MATRIX_COMMA E2 ZJUCAD_MATRIX_COMMA R>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R1 ZJUCAD_MATRIX_COMMA typename R2, idx_range_iv<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>, typename idx_range_iv<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>::proxy_type, proxy);
+ZJUCAD_MATRIX_PROXY_ALIAS(typename E ZJUCAD_MATRIX_COMMA typename R1 ZJUCAD_MATRIX_COMMA typename R2, idx_iv_iv<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>, typename idx_iv_iv<E ZJUCAD_MATRIX_COMMA R1 ZJUCAD_MATRIX_COMMA R2>::proxy_type, proxy);
+
+#undef ZJUCAD_MATRIX_COMMA
+#undef ZJUCAD_MATRIX_PROXY_ALIAS
+
+//! @brief a matrix on the left hand side is checked for aliasing and
+//! resized without value initialization, as assign_elements writes
+//! every element.
+template <typename T, typename F, typename A, bool tmp>
+struct assign_target<matrix<T, F, A, tmp> > {
+	typedef matrix<T, F, A, tmp> E;
+
+	static alias_target target(const E &lhs) {
+		alias_target t;
+		t.obj = &lhs;
+		t.lo = lhs.data().begin();
+		t.hi = lhs.data().end();
+		return t;
+	}
+	static void resize(E &lhs, size_type row, size_type col) {
+		lhs.resize(row, col, uninitialized);
+	}
+	//! evaluate rhs into a new matrix and take over its storage
+	template <typename E2>
+	static void assign_temp(E &lhs, const E2 &rhs) {
+		E t(rhs);
+		lhs.m_matrix.swap(t.m_matrix);
+	}
+};
+
+}}
+
+#endif
@@ -0,0 +1,297 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_ALLOCATOR_H_
+#define _ZJUCAD_MATRIX_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <limits>
+
+//! @brief storage policies for unbounded_array.
+//!
+//! std::allocator stays the default container allocator, so the layout
+//! of matrix<T> used by the prebuilt libraries does not change.  The
+//! policies here are opted in by type, e.g.
+//! unbounded_array<double, aligned_allocator<double> >, and the matrix
+//! typedefs aligned_matrix<T>::type and pooled_matrix<T>::type.
+//!
+//! Both policies return ZJUCAD_MATRIX_ALIGNMENT aligned storage and
+//! remember the capacity of the block they handed out, which lets
+//! unbounded_array shrink and regrow without touching the heap.
+
+#ifndef ZJUCAD_MATRIX_ALIGNMENT
+#  define ZJUCAD_MATRIX_ALIGNMENT 64
+#endif
+
+//! number of cached blocks per size class and thread in pool_allocator
+#ifndef ZJUCAD_MATRIX_POOL_DEPTH
+#  define ZJUCAD_MATRIX_POOL_DEPTH 32
+#endif
+
+#if defined _MSC_VER
+#  define ZJUCAD_MATRIX_TLS __declspec(thread)
+#else
+#  define ZJUCAD_MATRIX_TLS __thread
+#endif
+
+//! C++11 thread_local destructors give the blocks of an exiting thread
+//! back to the heap
+#if !defined ZJUCAD_MATRIX_POOL_EXIT_HOOK
+#  if __cplusplus >= 201103L || (defined _MSC_VER && _MSC_VER >= 1900)
+#    define ZJUCAD_MATRIX_POOL_EXIT_HOOK 1
+#  else
+#    define ZJUCAD_MATRIX_POOL_EXIT_HOOK 0
+#  endif
+#endif
+
+namespace zjucad { namespace matrix {
+
+//! @brief tag to skip value initialization of trivially constructible
+//! elements, e.g. matrix<double> A(n, m, uninitialized);
+struct uninitialized_t {};
+const uninitialized_t uninitialized = uninitialized_t();
+
+#ifdef ZJUCAD_MATRIX_COUNT_ALLOC
+//! @brief number of heap blocks unbounded_array requested in the
+//! calling thread, to see how many temporaries an expression creates
+inline std::size_t &alloc_count(void) {
+	static ZJUCAD_MATRIX_TLS std::size_t n = 0;
+	return n;
+}
+#endif
+
+//! @brief raw aligned memory, the pointer returned by malloc is kept
+//! in front of the aligned block.
+template <std::size_t ALIGN>
+struct aligned_memory {
+	static void *allocate(std::size_t bytes) {
+		char *raw = static_cast<char *>(std::malloc(bytes+ALIGN+sizeof(void *)));
+		if(!raw) throw std::bad_alloc();
+		char *p = raw + sizeof(void *);
+		p += (ALIGN - reinterpret_cast<std::size_t>(p)%ALIGN)%ALIGN;
+		reinterpret_cast<void **>(p)[-1] = raw;
+		return p;
+	}
+	static void deallocate(void *p) {
+		if(p) std::free(reinterpret_cast<void **>(p)[-1]);
+	}
+};
+
+//! @brief per thread free lists of power-of-two blocks from ALIGN to
+//! ALIGN<<(CLASSES-1) bytes, larger requests go to aligned_memory.
+//!
+//! A block freed by another thread simply joins that thread's list.
+//! Each list keeps at most ZJUCAD_MATRIX_POOL_DEPTH blocks, call
+//! release() to give the cached blocks of the calling thread back.
+//! With ZJUCAD_MATRIX_POOL_EXIT_HOOK that happens when a thread exits,
+//! e.g. a short lived std::thread or OpenMP worker, and later frees of
+//! the thread go to the heap.  Without it, i.e. before C++11, the list
+//! of a thread which exits without release() is lost.
+template <std::size_t ALIGN, int CLASSES = 16>
+struct size_class_pool {
+	struct free_list {
+		void *head[CLASSES];
+		int count[CLASSES];
+		bool exited;
+	};
+
+	static free_list &local(void) {
+		static ZJUCAD_MATRIX_TLS free_list fl;
+		return fl;
+	}
+
+	//! @return the class of bytes, or -1 if it is not pooled
+	static int size_class(std::size_t bytes) {
+		int c = 0;
+		for(std::size_t s = ALIGN; s < bytes; s <<= 1, ++c)
+			if(c == CLASSES-1) return -1;
+		return c;
+	}
+	static std::size_t class_bytes(int c) {
+		return ALIGN << c;
+	}
+
+	//! @param bytes is rounded up to the size of its class
+	static void *allocate(std::size_t &bytes) {
+		const int c = size_class(bytes);
+		if(c < 0)
+			return aligned_memory<ALIGN>::allocate(bytes);
+		bytes = class_bytes(c);
+		free_list &fl = local();
+		if(fl.head[c]) {
+			void *p = fl.head[c];
+			fl.head[c] = *static_cast<void **>(p);
+			--fl.count[c];
+			return p;
+		}
+		return aligned_memory<ALIGN>::allocate(bytes);
+	}
+	static void deallocate(void *p, std::size_t bytes) {
+		if(!p) return;
+		const int c = size_class(bytes);
+		free_list &fl = local();
+		if(c < 0 || fl.count[c] >= ZJUCAD_MATRIX_POOL_DEPTH || fl.exited) {
+			aligned_memory<ALIGN>::deallocate(p);
+			return;
+		}
+#if ZJUCAD_MATRIX_POOL_EXIT_HOOK
+		static thread_local exit_hook hook;
+		(void)hook;
+#endif
+		*static_cast<void **>(p) = fl.head[c];
+		fl.head[c] = p;
+		++fl.count[c];
+	}
+
+	static void release(void) {
+		free_list &fl = local();
+		for(int c = 0; c < CLASSES; ++c) {
+			while(fl.head[c]) {
+				void *p = fl.head[c];
+				fl.head[c] = *static_cast<void **>(p);
+				aligned_memory<ALIGN>::deallocate(p);
+			}
+			fl.count[c] = 0;
+		}
+	}
+
+#if ZJUCAD_MATRIX_POOL_EXIT_HOOK
+	//! constructed by the first block a thread caches
+	struct exit_hook {
+		~exit_hook() {
+			release();
+			local().exited = true;
+		}
+	};
+#endif
+};
+
+//! @brief common part of the allocator interface
+template <typename T>
+struct allocator_base {
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef T value_type;
+
+	pointer address(reference x) const {return &x;}
+	const_pointer address(const_reference x) const {return &x;}
+	size_type max_size(void) const {return std::numeric_limits<size_type>::max()/sizeof(T);}
+	void construct(pointer p, const T &v) {new(static_cast<void *>(p)) T(v);}
+	void destroy(pointer p) {p->~T();}
+
+	allocator_base():capacity_(0){}
+
+	//! @return number of elements in the block returned by the last
+	//! allocate, see unbounded_array::capacity
+	size_type capacity(void) const {return capacity_;}
+
+	size_type capacity_;
+};
+
+//! @brief ALIGN byte aligned heap storage
+template <typename T, std::size_t ALIGN = ZJUCAD_MATRIX_ALIGNMENT>
+struct aligned_allocator : public allocator_base<T> {
+	typedef typename allocator_base<T>::size_type size_type;
+	typedef typename allocator_base<T>::pointer pointer;
+	template <typename U> struct rebind {typedef aligned_allocator<U, ALIGN> other;};
+
+	aligned_allocator(){}
+	template <typename U>
+	aligned_allocator(const aligned_allocator<U, ALIGN> &){}
+
+	pointer allocate(size_type n, const void * = 0) {
+		this->capacity_ = n;
+		if(n == 0) return 0;
+		return static_cast<pointer>(aligned_memory<ALIGN>::allocate(n*sizeof(T)));
+	}
+	void deallocate(pointer p, size_type) {
+		aligned_memory<ALIGN>::deallocate(p);
+	}
+};
+
+//! @brief aligned storage recycled through the thread local
+//! size_class_pool, for short lived temporaries in inner loops
+template <typename T, std::size_t ALIGN = ZJUCAD_MATRIX_ALIGNMENT>
+struct pool_allocator : public allocator_base<T> {
+	typedef typename allocator_base<T>::size_type size_type;
+	typedef typename allocator_base<T>::pointer pointer;
+	typedef size_class_pool<ALIGN> pool;
+	template <typename U> struct rebind {typedef pool_allocator<U, ALIGN> other;};
+
+	pool_allocator(){}
+	template <typename U>
+	pool_allocator(const pool_allocator<U, ALIGN> &){}
+
+	pointer allocate(size_type n, const void * = 0) {
+		this->capacity_ = n;
+		if(n == 0) return 0;
+		std::size_t bytes = n*sizeof(T);
+		pointer p = static_cast<pointer>(pool::allocate(bytes));
+		this->capacity_ = bytes/sizeof(T);
+		return p;
+	}
+	//! @param n must be the capacity reported for p
+	void deallocate(pointer p, size_type n) {
+		pool::deallocate(p, n*sizeof(T));
+	}
+};
+
+template <typename T, typename U, std::size_t ALIGN>
+inline bool operator == (const aligned_allocator<T, ALIGN> &, const aligned_allocator<U, ALIGN> &) {return true;}
+template <typename T, typename U, std::size_t ALIGN>
+inline bool operator != (const aligned_allocator<T, ALIGN> &, const aligned_allocator<U, ALIGN> &) {return false;}
+template <typename T, typename U, std::size_t ALIGN>
+inline bool operator == (const pool_allocator<T, ALIGN> &, const pool_allocator<U, ALIGN> &) {return true;}
+template <typename T, typename U, std::size_t ALIGN>
+inline bool operator != (const pool_allocator<T, ALIGN> &, const pool_allocator<U, ALIGN> &) {return false;}
+
+//! @brief how unbounded_array asks A for the capacity of its block.
+//! Allocators without a capacity (std::allocator) hold exactly size
+//! elements and are always released on resize.
+template <typename A>
+struct allocator_capacity {
+	static const bool keep = false;
+	template <typename SIZE>
+	static SIZE get(const A &, SIZE size) {return size;}
+};
+
+template <typename T, std::size_t ALIGN>
+struct allocator_capacity<aligned_allocator<T, ALIGN> > {
+	static const bool keep = true;
+	template <typename SIZE>
+	static SIZE get(const aligned_allocator<T, ALIGN> &a, SIZE) {return SIZE(a.capacity());}
+};
+
+template <typename T, std::size_t ALIGN>
+struct allocator_capacity<pool_allocator<T, ALIGN> > {
+	static const bool keep = true;
+	template <typename SIZE>
+	static SIZE get(const pool_allocator<T, ALIGN> &a, SIZE) {return SIZE(a.capacity());}
+};
+
+}}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_BATCH_LAPACK_H_
+#define _ZJUCAD_MATRIX_BATCH_LAPACK_H_
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <zjucad/matrix/matrix.h>
+
+//! @brief inv, eig, svd and polar decomposition of many small D x D
+//! matrices (D = 2, 3, 4) without LAPACK.
+//!
+//! Layout is structure of arrays: element (r, c) of the i-th matrix is
+//! A[(r+c*D)*n+i], i.e. A is an n x D*D column major matrix whose k-th
+//! column holds element k of every matrix.  Vectors such as singular
+//! values are n x D.
+//!
+//! Matrices are processed in blocks of W lanes, every scalar step is a
+//! loop over the lanes which the compiler vectorizes, and the blocks
+//! are shared among OpenMP threads.  eig uses cyclic Jacobi, svd runs
+//! Jacobi on A^T*A and a Givens QR of A*V, which stays accurate for
+//! rank deficient matrices.  Each matrix is scaled by a power of 2 to
+//! entries of at most 1 first, so eig, svd and polar take any finite
+//! scale.
+
+namespace zjucad { namespace matrix {
+
+//! @brief transposed cofactor matrix r = det(a)*inv(a) and det(a)
+//! of W lanes
+template <int D> struct small_batch_cofactor;
+
+//! @brief entry k of lane l in a batch of W lanes
+template <typename T, int W>
+struct small_batch_lane {
+	small_batch_lane(T (*p)[W], int l):p_(p), l_(l) {}
+	T &operator()(int k) const { return p_[k][l_]; }
+private:
+	T (*p_)[W];
+	const int l_;
+};
+
+template <>
+struct small_batch_cofactor<2> {
+	template <typename T, int W>
+	static void apply(const T A[][W], T R[][W], T *det) {
+		for(int l = 0; l < W; ++l) {
+			const small_batch_lane<const T, W> a(A, l);
+			const small_batch_lane<T, W> r(R, l);
+			r(0) = a(3); r(3) = a(0);
+			r(1) = -a(1); r(2) = -a(2);
+			det[l] = a(0)*a(3)-a(1)*a(2);
+		}
+	}
+};
+
+template <>
+struct small_batch_cofactor<3> {
+	template <typename T, int W>
+	static void apply(const T A[][W], T R[][W], T *det) {
+		for(int l = 0; l < W; ++l) {
+			const small_batch_lane<const T, W> a(A, l);
+			const small_batch_lane<T, W> r(R, l);
+			r(0) = a(4)*a(8)-a(5)*a(7);
+			r(1) = a(2)*a(7)-a(1)*a(8);
+			r(2) = a(1)*a(5)-a(2)*a(4);
+			r(3) = a(5)*a(6)-a(3)*a(8);
+			r(4) = a(0)*a(8)-a(2)*a(6);
+			r(5) = a(2)*a(3)-a(0)*a(5);
+			r(6) = a(3)*a(7)-a(4)*a(6);
+			r(7) = a(1)*a(6)-a(0)*a(7);
+			r(8) = a(0)*a(4)-a(1)*a(3);
+			det[l] = a(0)*r(0)+a(3)*r(1)+a(6)*r(2);
+		}
+	}
+};
+
+template <>
+struct small_batch_cofactor<4> {
+	template <typename T, int W>
+	static void apply(const T A[][W], T R[][W], T *det) {
+		for(int l = 0; l < W; ++l) {
+			const small_batch_lane<const T, W> a(A, l);
+			const small_batch_lane<T, W> r(R, l);
+			// 2x2 minors of the two left and the two right columns
+			const T s0 = a(0)*a(5)-a(1)*a(4), s1 = a(0)*a(6)-a(2)*a(4),
+				s2 = a(0)*a(7)-a(3)*a(4), s3 = a(1)*a(6)-a(2)*a(5),
+				s4 = a(1)*a(7)-a(3)*a(5), s5 = a(2)*a(7)-a(3)*a(6);
+			const T c5 = a(10)*a(15)-a(11)*a(14), c4 = a(9)*a(15)-a(11)*a(13),
+				c3 = a(9)*a(14)-a(10)*a(13), c2 = a(8)*a(15)-a(11)*a(12),
+				c1 = a(8)*a(14)-a(10)*a(12), c0 = a(8)*a(13)-a(9)*a(12);
+			r(0) = a(5)*c5-a(6)*c4+a(7)*c3;
+			r(1) = -a(1)*c5+a(2)*c4-a(3)*c3;
+			r(2) = a(13)*s5-a(14)*s4+a(15)*s3;
+			r(3) = -a(9)*s5+a(10)*s4-a(11)*s3;
+			r(4) = -a(4)*c5+a(6)*c2-a(7)*c1;
+			r(5) = a(0)*c5-a(2)*c2+a(3)*c1;
+			r(6) = -a(12)*s5+a(14)*s2-a(15)*s1;
+			r(7) = a(8)*s5-a(10)*s2+a(11)*s1;
+			r(8) = a(4)*c4-a(5)*c2+a(7)*c0;
+			r(9) = -a(0)*c4+a(1)*c2-a(3)*c0;
+			r(10) = a(12)*s4-a(13)*s2+a(15)*s0;
+			r(11) = -a(8)*s4+a(9)*s2-a(11)*s0;
+			r(12) = -a(4)*c3+a(5)*c1-a(6)*c0;
+			r(13) = a(0)*c3-a(1)*c1+a(2)*c0;
+			r(14) = -a(12)*s3+a(13)*s1-a(14)*s0;
+			r(15) = a(8)*s3-a(9)*s1+a(10)*s0;
+			det[l] = s0*c5-s1*c4+s2*c3+s3*c2-s4*c1+s5*c0;
+		}
+	}
+};
+
+template <int D, typename T>
+struct small_batch {
+	enum { W = 8, DD = D*D };
+	typedef T block[DD][W];
+
+	static T tiny(void) { return std::numeric_limits<T>::min(); }
+
+	//! missing lanes of the last block are identity
+	static void load(const T *A, idx_type n, idx_type i0, idx_type w, int rows, block a) {
+		for(int k = 0; k < rows*D; ++k) {
+			const T pad = (rows == D && k%(D+1) == 0) ? T(1) : T(0);
+			for(idx_type l = 0; l < W; ++l)
+				a[k][l] = (l < w) ? A[k*n+i0+l] : pad;
+		}
+	}
+	static void store(T *A, idx_type n, idx_type i0, idx_type w, int rows, const block a) {
+		for(int k = 0; k < rows*D; ++k)
+			for(idx_type l = 0; l < w; ++l)
+				A[k*n+i0+l] = a[k][l];
+	}
+	static void identity(block a) {
+		for(int k = 0; k < DD; ++k)
+			for(int l = 0; l < W; ++l)
+				a[k][l] = (k%(D+1) == 0) ? T(1) : T(0);
+	}
+	//! c = op(a)*b, op(a) = a^T if ta
+	static void mult(bool ta, const block a, const block b, block c) {
+		for(int i = 0; i < D; ++i)
+			for(int j = 0; j < D; ++j) {
+				T *r = c[i+j*D];
+				for(int l = 0; l < W; ++l) r[l] = 0;
+				for(int k = 0; k < D; ++k) {
+					const T *x = ta ? a[k+i*D] : a[i+k*D], *y = b[k+j*D];
+					for(int l = 0; l < W; ++l) r[l] += x[l]*y[l];
+				}
+			}
+	}
+
+	//! a /= s per lane, s the power of 2 next to the largest |entry|,
+	//! so that the squares in jacobi and a^T*a of a lane with entries
+	//! near 1e+-150 neither overflow nor underflow
+	static void normalize(block a, T *s) {
+		for(int l = 0; l < W; ++l) {
+			T m = 0;
+			for(int k = 0; k < DD; ++k) m = std::max(m, std::fabs(a[k][l]));
+			int e = 0;
+			if(m > 0 && m <= std::numeric_limits<T>::max()) std::frexp(m, &e);
+			s[l] = std::ldexp(T(1), e);
+		}
+		for(int k = 0; k < DD; ++k)
+			for(int l = 0; l < W; ++l)
+				a[k][l] /= s[l];
+	}
+
+	//! a = v*diag(e)*v^T for symmetric a, v orthogonal
+	static void jacobi(block a, block v) {
+		identity(v);
+		const T eps2 = std::numeric_limits<T>::epsilon()*std::numeric_limits<T>::epsilon();
+		for(int sweep = 0; sweep < 16; ++sweep) {
+			bool done = true;
+			for(int l = 0; l < W; ++l) {
+				T off = 0, diag = 0;
+				for(int p = 0; p < D; ++p) {
+					diag += a[p+p*D][l]*a[p+p*D][l];
+					for(int q = p+1; q < D; ++q)
+						off += a[p+q*D][l]*a[p+q*D][l];
+				}
+				if(off > eps2*diag) done = false;
+			}
+			if(done) break;
+			for(int p = 0; p < D; ++p)
+				for(int q = p+1; q < D; ++q) {
+					T c[W], s[W];
+					for(int l = 0; l < W; ++l) {
+						const T apq = a[p+q*D][l], d = a[q+q*D][l]-a[p+p*D][l];
+						const T t = ((d >= 0) ? T(2) : T(-2))*apq
+							/(std::fabs(d)+std::sqrt(d*d+4*apq*apq)+tiny());
+						c[l] = 1/std::sqrt(1+t*t);
+						s[l] = t*c[l];
+					}
+					rotate(a, c, s, p, q, true);
+					rotate(v, c, s, p, q, false);
+				}
+		}
+	}
+	//! a = a*J, and a = J^T*a if both, J is the (p, q) rotation
+	static void rotate(block a, const T *c, const T *s, int p, int q, bool both) {
+		for(int k = 0; k < D; ++k) {
+			T *x = a[k+p*D], *y = a[k+q*D];
+			for(int l = 0; l < W; ++l) {
+				const T xl = x[l], yl = y[l];
+				x[l] = c[l]*xl-s[l]*yl;
+				y[l] = s[l]*xl+c[l]*yl;
+			}
+		}
+		if(!both) return;
+		for(int k = 0; k < D; ++k) {
+			T *x = a[p+k*D], *y = a[q+k*D];
+			for(int l = 0; l < W; ++l) {
+				const T xl = x[l], yl = y[l];
+				x[l] = c[l]*xl-s[l]*yl;
+				y[l] = s[l]*xl+c[l]*yl;
+			}
+		}
+	}
+	//! sort the diagonal of a and the columns of v, ascending or not
+	static void sort(block a, block v, bool ascending) {
+		for(int l = 0; l < W; ++l)
+			for(int i = 0; i < D; ++i)
+				for(int j = i+1; j < D; ++j) {
+					const T ei = a[i+i*D][l], ej = a[j+j*D][l];
+					if(ascending ? (ej < ei) : (ei < ej)) {
+						std::swap(a[i+i*D][l], a[j+j*D][l]);
+						for(int k = 0; k < D; ++k)
+							std::swap(v[k+i*D][l], v[k+j*D][l]);
+					}
+				}
+	}
+	//! flip the last column of v where det(v) < 0
+	static void make_rotation(block v) {
+		block c;
+		T det[W];
+		small_batch_cofactor<D>::apply(v, c, det);
+		for(int k = 0; k < D; ++k) {
+			T *x = v[k+(D-1)*D];
+			for(int l = 0; l < W; ++l)
+				x[l] = (det[l] < 0) ? -x[l] : x[l];
+		}
+	}
+	//! b = q^T*r with q a rotation and r upper triangular
+	static void givens_qr(block b, block qt) {
+		identity(qt);
+		for(int j = 0; j < D; ++j)
+			for(int i = j+1; i < D; ++i) {
+				T c[W], s[W];
+				for(int l = 0; l < W; ++l) {
+					const T x = b[j+j*D][l], y = b[i+j*D][l];
+					const T r = std::sqrt(x*x+y*y);
+					const bool ok = r > tiny();
+					c[l] = ok ? x/r : T(1);
+					s[l] = ok ? y/r : T(0);
+				}
+				rotate_rows(b, c, s, j, i);
+				rotate_rows(qt, c, s, j, i);
+			}
+	}
+	static void rotate_rows(block a, const T *c, const T *s, int j, int i) {
+		for(int k = 0; k < D; ++k) {
+			T *x = a[j+k*D], *y = a[i+k*D];
+			for(int l = 0; l < W; ++l) {
+				const T xl = x[l], yl = y[l];
+				x[l] = c[l]*xl+s[l]*yl;
+				y[l] = -s[l]*xl+c[l]*yl;
+			}
+		}
+	}
+	//! a = u*diag(sigma)*v^T with u, v rotations, |sigma| descending,
+	//! only the last sigma may be negative
+	static void signed_svd(const block a, block u, T sigma[D][W], block v) {
+		block as, m, b, qt;
+		T scale[W];
+		std::copy(&a[0][0], &a[0][0]+DD*W, &as[0][0]);
+		normalize(as, scale);
+		mult(true, as, as, m);
+		jacobi(m, v);
+		sort(m, v, false);
+		make_rotation(v);
+		mult(false, as, v, b);
+		givens_qr(b, qt);
+		for(int i = 0; i < D; ++i)
+			for(int j = 0; j < D; ++j)
+				for(int l = 0; l < W; ++l)
+					u[i+j*D][l] = qt[j+i*D][l];
+		for(int j = 0; j < D; ++j)
+			for(int l = 0; l < W; ++l)
+				sigma[j][l] = b[j+j*D][l]*scale[l];
+	}
+};
+
+//! @brief in place inverse of n D x D matrices
+//! @return number of singular matrices, whose result is not finite
+template <int D, typename T>
+idx_type batch_inv(idx_type n, T *A)
+{
+	typedef small_batch<D, T> SB;
+	const idx_type W = SB::W, nb = (n+W-1)/W;
+	idx_type singular = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:singular)
+#endif
+	for(idx_type b = 0; b < nb; ++b) {
+		const idx_type i0 = b*W, w = std::min(W, n-i0);
+		typename SB::block a, r;
+		SB::load(A, n, i0, w, D, a);
+		T det[SB::W];
+		small_batch_cofactor<D>::apply(a, r, det);
+		for(int l = 0; l < w; ++l)
+			if(det[l] == T(0)) ++singular;
+		for(int k = 0; k < SB::DD; ++k)
+			for(int l = 0; l < W; ++l)
+				r[k][l] /= det[l];
+		SB::store(A, n, i0, w, D, r);
+	}
+	return singular;
+}
+
+//! @brief eigen decomposition of n symmetric matrices, A = V*diag(e)*V^T
+//! with e ascending as in eig of lapack.h
+template <int D, typename T>
+void batch_eig(idx_type n, const T *A, T *V, T *e)
+{
+	typedef small_batch<D, T> SB;
+	const idx_type W = SB::W, nb = (n+W-1)/W;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(idx_type b = 0; b < nb; ++b) {
+		const idx_type i0 = b*W, w = std::min(W, n-i0);
+		typename SB::block a, v;
+		T scale[SB::W];
+		SB::load(A, n, i0, w, D, a);
+		SB::normalize(a, scale);
+		SB::jacobi(a, v);
+		SB::sort(a, v, true);
+		SB::store(V, n, i0, w, D, v);
+		for(int j = 0; j < D; ++j)
+			for(idx_type l = 0; l < w; ++l)
+				e[j*n+i0+l] = a[j+j*D][l]*scale[l];
+	}
+}
+
+//! @brief A = U*diag(S)*V^T with S >= 0 descending
+template <int D, typename T>
+void batch_svd(idx_type n, const T *A, T *U, T *S, T *V)
+{
+	typedef small_batch<D, T> SB;
+	const idx_type W = SB::W, nb = (n+W-1)/W;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(idx_type b = 0; b < nb; ++b) {
+		const idx_type i0 = b*W, w = std::min(W, n-i0);
+		typename SB::block a, u, v;
+		T sigma[D][SB::W];
+		SB::load(A, n, i0, w, D, a);
+		SB::signed_svd(a, u, sigma, v);
+		for(int l = 0; l < W; ++l)
+			if(sigma[D-1][l] < 0) {
+				sigma[D-1][l] = -sigma[D-1][l];
+				for(int k = 0; k < D; ++k) u[k+(D-1)*D][l] = -u[k+(D-1)*D][l];
+			}
+		SB::store(U, n, i0, w, D, u);
+		SB::store(V, n, i0, w, D, v);
+		for(int j = 0; j < D; ++j)
+			for(idx_type l = 0; l < w; ++l)
+				S[j*n+i0+l] = sigma[j][l];
+	}
+}
+
+//! @brief A = R*P with R a rotation and P symmetric, P may be 0
+template <int D, typename T>
+void batch_polar(idx_type n, const T *A, T *R, T *P = 0)
+{
+	typedef small_batch<D, T> SB;
+	const idx_type W = SB::W, nb = (n+W-1)/W;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(idx_type b = 0; b < nb; ++b) {
+		const idx_type i0 = b*W, w = std::min(W, n-i0);
+		typename SB::block a, u, v, r;
+		T sigma[D][SB::W];
+		SB::load(A, n, i0, w, D, a);
+		SB::signed_svd(a, u, sigma, v);
+		// r = u*v^T
+		for(int i = 0; i < D; ++i)
+			for(int j = 0; j < D; ++j)
+				for(int l = 0; l < W; ++l) {
+					T x = 0;
+					for(int k = 0; k < D; ++k) x += u[i+k*D][l]*v[j+k*D][l];
+					r[i+j*D][l] = x;
+				}
+		SB::store(R, n, i0, w, D, r);
+		if(!P) continue;
+		// p = v*diag(sigma)*v^T
+		for(int i = 0; i < D; ++i)
+			for(int j = 0; j < D; ++j)
+				for(int l = 0; l < W; ++l) {
+					T x = 0;
+					for(int k = 0; k < D; ++k) x += v[i+k*D][l]*sigma[k][l]*v[j+k*D][l];
+					r[i+j*D][l] = x;
+				}
+		SB::store(P, n, i0, w, D, r);
+	}
+}
+
+// matrix interface, A is n x D*D as described above
+
+template <int D, typename T>
+idx_type batch_inv(matrix<T> &A)
+{
+	assert(A.size(2) == D*D);
+	return batch_inv<D>(A.size(1), &A[0]);
+}
+
+template <int D, typename T>
+void batch_eig(const matrix<T> &A, matrix<T> &V, matrix<T> &e)
+{
+	assert(A.size(2) == D*D);
+	V.resize(A.size(1), D*D, uninitialized);
+	e.resize(A.size(1), D, uninitialized);
+	batch_eig<D>(A.size(1), &A[0], &V[0], &e[0]);
+}
+
+template <int D, typename T>
+void batch_svd(const matrix<T> &A, matrix<T> &U, matrix<T> &S, matrix<T> &V)
+{
+	assert(A.size(2) == D*D);
+	U.resize(A.size(1), D*D, uninitialized);
+	S.resize(A.size(1), D, uninitialized);
+	V.resize(A.size(1), D*D, uninitialized);
+	batch_svd<D>(A.size(1), &A[0], &U[0], &S[0], &V[0]);
+}
+
+template <int D, typename T>
+void batch_polar(const matrix<T> &A, matrix<T> &R)
+{
+	assert(A.size(2) == D*D);
+	R.resize(A.size(1), D*D, uninitialized);
+	batch_polar<D>(A.size(1), &A[0], &R[0]);
+}
+
+template <int D, typename T>
+void batch_polar(const matrix<T> &A, matrix<T> &R, matrix<T> &P)
+{
+	assert(A.size(2) == D*D);
+	R.resize(A.size(1), D*D, uninitialized);
+	P.resize(A.size(1), D*D, uninitialized);
+	batch_polar<D>(A.size(1), &A[0], &R[0], &P[0]);
+}
+
+}}
+
+#endif
@@ -22,9 +22,69 @@
 #define ZJUCAD_MATRIX_BLAS_H_
 
 #include <zjucad/matrix/matrix.h>
+#include <zjucad/matrix/builtin_blas.h>
+
+#include <cstdlib>
+#include <cstring>
+
+//! define ZJUCAD_MATRIX_NO_EXTERNAL_BLAS to build without a Fortran
+//! BLAS, then only the built-in kernels are used.
+
+#if !defined ZJUCAD_MATRIX_NO_EXTERNAL_BLAS && defined __GNUC__ && !defined _WIN32
+// present only when the corresponding library is linked
+extern "C" {
+char *openblas_get_config(void) __attribute__((weak));
+int MKL_Get_Max_Threads(void) __attribute__((weak));
+const char *bli_info_get_version_str(void) __attribute__((weak));
+void ATL_buildinfo(void) __attribute__((weak));
+}
+#  define ZJUCAD_MATRIX_DETECT_BLAS 1
+#endif
 
 namespace zjucad { namespace matrix {
 
+enum blas_backend {
+	blas_external = 0,	// F77_* symbols of the linked BLAS
+	blas_builtin = 1	// builtin_blas.h
+};
+
+//! @brief pick the backend once: ZJUCAD_MATRIX_BLAS=builtin or
+//! external in the environment wins, otherwise the linked BLAS is
+//! used only if it is a known optimized one.
+inline blas_backend detect_blas_backend(void)
+{
+#ifdef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	return blas_builtin;
+#else
+	const char *env = std::getenv("ZJUCAD_MATRIX_BLAS");
+	if(env && !std::strcmp(env, "builtin")) return blas_builtin;
+	if(env && !std::strcmp(env, "external")) return blas_external;
+#  if ZJUCAD_MATRIX_DETECT_BLAS
+	if(openblas_get_config || MKL_Get_Max_Threads
+	   || bli_info_get_version_str || ATL_buildinfo)
+		return blas_external;
+	return blas_builtin;
+#  else
+	return blas_external;
+#  endif
+#endif
+}
+
+inline blas_backend &blas_backend_ref(void)
+{
+	static blas_backend b = detect_blas_backend();
+	return b;
+}
+
+inline blas_backend get_blas_backend(void) { return blas_backend_ref(); }
+inline void set_blas_backend(blas_backend b) {
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	blas_backend_ref() = b;
+#else
+	(void)b;
+#endif
+}
+
 template <typename T>
 struct value_type_of_pointer
 {
@@ -36,32 +96,48 @@ struct value_type_of_pointer<T *>
 	typedef T value_type;
 };
 
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
 #ifndef F77_INT
 typedef value_type_of_pointer<FINT>::value_type F77_INT;
 #endif
 
 static char __F77_TRANS[] = {'n', 't'};
+#endif
 // GEMV
 void inline gemv(float alpha, bool trans, const matrix<float> &A,
 	const matrix<float> &x, float beta, matrix<float> &Ax)
 {
 	Ax.resize(trans?A.size(2):A.size(1), 1);
+	if(get_blas_backend() == blas_builtin) {
+		builtin_gemv(trans, A.size(1), A.size(2), alpha, &A[0], A.size(1),
+					 &x[0], beta, &Ax[0]);
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
 	F77_INT MN1[] = {F77_INT(A.size(1)), F77_INT(A.size(2)), F77_INT(1)};
 	F77_sgemv(&__F77_TRANS[trans], MN1, MN1+1,
 			  &alpha, &A[0], MN1,
 			  &x[0], MN1+2,
 			  &beta, &Ax[0], MN1+2);
+#endif
 }
 
 void inline gemv(double alpha, bool trans, const matrix<double> &A,
 	const matrix<double> &x, double beta, matrix<double> &Ax)
 {
 	Ax.resize(trans?A.size(2):A.size(1), 1);
+	if(get_blas_backend() == blas_builtin) {
+		builtin_gemv(trans, A.size(1), A.size(2), alpha, &A[0], A.size(1),
+					 &x[0], beta, &Ax[0]);
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
 	F77_INT MN1[] = {F77_INT(A.size(1)), F77_INT(A.size(2)), 1};
 	F77_dgemv(&__F77_TRANS[trans], MN1, MN1+1,
 			  &alpha, &A[0], MN1,
 			  &x[0], MN1+2,
 			  &beta, &Ax[0], MN1+2);
+#endif
 }
 
 template <typename T>
@@ -75,12 +151,17 @@ void inline gemv(bool trans, const matrix<T> &A,
 void inline gemm(float alpha, bool transA, const matrix<float> &A,
 	bool transB, const matrix<float> &B, float beta, matrix<float> &C)
 {
-	F77_INT MNK[] = {
-		F77_INT(transA?A.size(2):A.size(1)),
-		F77_INT(transB?B.size(1):B.size(2)),
-		F77_INT(transA?A.size(1):A.size(2))
-	};
-	C.resize(MNK[0], MNK[1]);
+	const idx_type m = transA?A.size(2):A.size(1),
+		n = transB?B.size(1):B.size(2), k = transA?A.size(1):A.size(2);
+	C.resize(m, n);
+	if(get_blas_backend() == blas_builtin) {
+		builtin_gemm(transA, transB, m, n, k,
+					 alpha, &A[0], A.size(1), &B[0], B.size(1),
+					 beta, &C[0], C.size(1));
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	F77_INT MNK[] = {F77_INT(m), F77_INT(n), F77_INT(k)};
 	F77_INT LD_ABC[] = {
 		F77_INT(A.size(1)), F77_INT(B.size(1)), F77_INT(C.size(1))
 	};
@@ -89,17 +170,23 @@ void inline gemm(float alpha, bool transA, const matrix<float> &A,
 			  &alpha, &A[0], LD_ABC+0,
 			  &B[0], LD_ABC+1,
 			  &beta, &C[0], LD_ABC+2);
+#endif
 }
 
 void inline gemm(double alpha, bool transA, const matrix<double> &A,
 	bool transB, const matrix<double> &B, double beta, matrix<double> &C)
 {
-	F77_INT MNK[] = {
-		F77_INT(transA?A.size(2):A.size(1)),
-		F77_INT(transB?B.size(1):B.size(2)),
-		F77_INT(transA?A.size(1):A.size(2))
-	};
-	C.resize(MNK[0], MNK[1]);
+	const idx_type m = transA?A.size(2):A.size(1),
+		n = transB?B.size(1):B.size(2), k = transA?A.size(1):A.size(2);
+	C.resize(m, n);
+	if(get_blas_backend() == blas_builtin) {
+		builtin_gemm(transA, transB, m, n, k,
+					 alpha, &A[0], A.size(1), &B[0], B.size(1),
+					 beta, &C[0], C.size(1));
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	F77_INT MNK[] = {F77_INT(m), F77_INT(n), F77_INT(k)};
 	F77_INT LD_ABC[] = {
 		F77_INT(A.size(1)), F77_INT(B.size(1)), F77_INT(C.size(1))
 	};
@@ -108,6 +195,7 @@ void inline gemm(double alpha, bool transA, const matrix<double> &A,
 			  &alpha, &A[0], LD_ABC+0,
 			  &B[0], LD_ABC+1,
 			  &beta, &C[0], LD_ABC+2);
+#endif
 }
 
 template <typename T>
@@ -117,6 +205,60 @@ void inline gemm(bool transA, const matrix<T> &A,
 	gemm(1, transA, A, transB, B, 0, C);
 }
 
+// SYRK, C = alpha*op(A)*op(A)^T + beta*C with both triangles filled.
+// C is resized to n x n, in which case beta is ignored.
+void inline syrk(float alpha, bool trans, const matrix<float> &A, float beta, matrix<float> &C)
+{
+	const idx_type n = trans?A.size(2):A.size(1), k = trans?A.size(1):A.size(2);
+	if(C.size(1) != n || C.size(2) != n) {
+		C.resize(n, n);
+		beta = 0;
+	}
+	if(get_blas_backend() == blas_builtin) {
+		builtin_syrk(trans, n, k, alpha, &A[0], A.size(1), beta, &C[0], n);
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	static char L[] = "L";
+	F77_INT NK[] = {F77_INT(n), F77_INT(k), F77_INT(A.size(1))};
+	F77_ssyrk(L, &__F77_TRANS[trans], NK, NK+1,
+			  &alpha, &A[0], NK+2,
+			  &beta, &C[0], NK);
+	for(idx_type j = 1; j < n; ++j)
+		for(idx_type i = 0; i < j; ++i)
+			C(i, j) = C(j, i);
+#endif
+}
+
+void inline syrk(double alpha, bool trans, const matrix<double> &A, double beta, matrix<double> &C)
+{
+	const idx_type n = trans?A.size(2):A.size(1), k = trans?A.size(1):A.size(2);
+	if(C.size(1) != n || C.size(2) != n) {
+		C.resize(n, n);
+		beta = 0;
+	}
+	if(get_blas_backend() == blas_builtin) {
+		builtin_syrk(trans, n, k, alpha, &A[0], A.size(1), beta, &C[0], n);
+		return;
+	}
+#ifndef ZJUCAD_MATRIX_NO_EXTERNAL_BLAS
+	static char L[] = "L";
+	F77_INT NK[] = {F77_INT(n), F77_INT(k), F77_INT(A.size(1))};
+	F77_dsyrk(L, &__F77_TRANS[trans], NK, NK+1,
+			  &alpha, &A[0], NK+2,
+			  &beta, &C[0], NK);
+	for(idx_type j = 1; j < n; ++j)
+		for(idx_type i = 0; i < j; ++i)
+			C(i, j) = C(j, i);
+#endif
+}
+
+template <typename T>
+void inline syrk(bool trans, const matrix<T> &A, matrix<T> &C)
+{
+	syrk(1, trans, A, 0, C);
+}
+
 }} // zjucad::matrix
 
 #endif
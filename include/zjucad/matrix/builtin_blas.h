@@ -0,0 +1,274 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef ZJUCAD_MATRIX_BUILTIN_BLAS_H_
+#define ZJUCAD_MATRIX_BUILTIN_BLAS_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "simd.h"
+
+//! @brief cache blocked GEMM/GEMV/SYRK on column major raw pointers,
+//! with the argument order of the Fortran BLAS.  blas.h uses them when
+//! no optimized BLAS is linked.
+//!
+//! GEMM packs op(A) into MR row panels and op(B) into NR column panels
+//! of a KC deep slice, and runs an MR x NR register kernel built on
+//! packet<T>.  The row blocks of C are shared among OpenMP threads.
+
+namespace zjucad { namespace matrix {
+
+template <typename T>
+struct builtin_blas_blocking {
+	enum {
+		PS = packet<T>::size,
+		MR = (PS == 1) ? 4 : 2*PS,
+		NR = 4,
+		MC = 96,		// MC x KC of op(A) stays in L2
+		KC = 256,		// KC x NR of op(B) stays in L1
+		NC = 4096
+	};
+};
+
+//! @brief minimal m*n*k to go parallel
+#ifndef ZJUCAD_MATRIX_BLAS_OMP_FLOPS
+#  define ZJUCAD_MATRIX_BLAS_OMP_FLOPS (64*64*64)
+#endif
+
+template <typename T>
+void builtin_scale(idx_type m, idx_type n, T beta, T *C, idx_type ldc)
+{
+	if(beta == T(1)) return;
+	for(idx_type j = 0; j < n; ++j) {
+		T *c = C+j*ldc;
+		if(beta == T(0))
+			std::fill(c, c+m, T(0));
+		else
+			for(idx_type i = 0; i < m; ++i) c[i] *= beta;
+	}
+}
+
+//! op(A)(i0:i0+mc, p0:p0+kc) into MR row panels, zero padded
+template <typename T>
+void builtin_pack_A(bool trans, const T *A, idx_type lda,
+					idx_type i0, idx_type mc, idx_type p0, idx_type kc, T *buf)
+{
+	const idx_type MR = builtin_blas_blocking<T>::MR;
+	for(idx_type ir = 0; ir < mc; ir += MR) {
+		const idx_type mr = std::min(MR, mc-ir);
+		for(idx_type p = 0; p < kc; ++p, buf += MR) {
+			idx_type r = 0;
+			if(trans) {
+				const T *a = A+(p0+p)+(i0+ir)*lda;
+				for(; r < mr; ++r) buf[r] = a[r*lda];
+			}
+			else {
+				const T *a = A+(i0+ir)+(p0+p)*lda;
+				for(; r < mr; ++r) buf[r] = a[r];
+			}
+			for(; r < MR; ++r) buf[r] = T(0);
+		}
+	}
+}
+
+//! op(B)(p0:p0+kc, j0:j0+nc) into NR column panels, zero padded
+template <typename T>
+void builtin_pack_B(bool trans, const T *B, idx_type ldb,
+					idx_type p0, idx_type kc, idx_type j0, idx_type nc, T *buf)
+{
+	const idx_type NR = builtin_blas_blocking<T>::NR;
+	for(idx_type jr = 0; jr < nc; jr += NR) {
+		const idx_type nr = std::min(NR, nc-jr);
+		T *panel = buf+jr*kc;
+		for(idx_type p = 0; p < kc; ++p) {
+			idx_type c = 0;
+			if(trans)
+				for(; c < nr; ++c) panel[p*NR+c] = B[(j0+jr+c)+(p0+p)*ldb];
+			else
+				for(; c < nr; ++c) panel[p*NR+c] = B[(p0+p)+(j0+jr+c)*ldb];
+			for(; c < NR; ++c) panel[p*NR+c] = T(0);
+		}
+	}
+}
+
+//! ab = Ap*Bp over kc, ab is MR x NR column major
+template <typename T>
+void builtin_gemm_kernel(idx_type kc, const T *Ap, const T *Bp, T *ab)
+{
+	typedef packet<T> P;
+	typedef typename P::type V;
+	enum { MR = builtin_blas_blocking<T>::MR, NR = builtin_blas_blocking<T>::NR,
+		   PN = MR/P::size };
+	V c[PN][NR];
+	for(int r = 0; r < PN; ++r)
+		for(int j = 0; j < NR; ++j)
+			c[r][j] = P::set1(T(0));
+	for(idx_type p = 0; p < kc; ++p, Ap += MR, Bp += NR) {
+		V a[PN];
+		for(int r = 0; r < PN; ++r)
+			a[r] = P::load(Ap+r*P::size);
+		for(int j = 0; j < NR; ++j) {
+			const V b = P::set1(Bp[j]);
+			for(int r = 0; r < PN; ++r)
+				c[r][j] = P::add(c[r][j], P::mul(a[r], b));
+		}
+	}
+	for(int j = 0; j < NR; ++j)
+		for(int r = 0; r < PN; ++r)
+			P::store(ab+j*MR+r*P::size, c[r][j]);
+}
+
+//! @brief C = alpha*op(A)*op(B) + beta*C, op(A) is m x k
+template <typename T>
+void builtin_gemm(bool transA, bool transB, idx_type m, idx_type n, idx_type k,
+				  T alpha, const T *A, idx_type lda, const T *B, idx_type ldb,
+				  T beta, T *C, idx_type ldc)
+{
+	typedef builtin_blas_blocking<T> BK;
+	const idx_type MR = BK::MR, NR = BK::NR, MC = BK::MC, KC = BK::KC, NC = BK::NC;
+
+	builtin_scale(m, n, beta, C, ldc);
+	if(m == 0 || n == 0 || k == 0 || alpha == T(0)) return;
+
+#ifdef _OPENMP
+	const bool par = double(m)*n*k >= ZJUCAD_MATRIX_BLAS_OMP_FLOPS;
+#endif
+	std::vector<T> Bbuf(KC*((std::min(NC, n)+NR-1)/NR*NR));
+	for(idx_type jc = 0; jc < n; jc += NC) {
+		const idx_type nc = std::min(NC, n-jc);
+		for(idx_type pc = 0; pc < k; pc += KC) {
+			const idx_type kc = std::min(KC, k-pc);
+			builtin_pack_B(transB, B, ldb, pc, kc, jc, nc, &Bbuf[0]);
+			const idx_type mblocks = (m+MC-1)/MC;
+#ifdef _OPENMP
+#pragma omp parallel if(par)
+#endif
+			{
+				std::vector<T> Abuf((MC+MR-1)/MR*MR*kc);
+				T ab[BK::MR*BK::NR];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+				for(idx_type ib = 0; ib < mblocks; ++ib) {
+					const idx_type ic = ib*MC, mc = std::min(MC, m-ic);
+					builtin_pack_A(transA, A, lda, ic, mc, pc, kc, &Abuf[0]);
+					for(idx_type jr = 0; jr < nc; jr += NR) {
+						const idx_type nr = std::min(NR, nc-jr);
+						for(idx_type ir = 0; ir < mc; ir += MR) {
+							const idx_type mr = std::min(MR, mc-ir);
+							builtin_gemm_kernel(kc, &Abuf[ir*kc], &Bbuf[jr*kc], ab);
+							T *c = C+(ic+ir)+(jc+jr)*ldc;
+							for(idx_type j = 0; j < nr; ++j)
+								for(idx_type i = 0; i < mr; ++i)
+									c[i+j*ldc] += alpha*ab[i+j*MR];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+//! @brief y = alpha*op(A)*x + beta*y, A is m x n
+template <typename T>
+void builtin_gemv(bool trans, idx_type m, idx_type n, T alpha, const T *A, idx_type lda,
+				  const T *x, T beta, T *y)
+{
+	typedef packet<T> P;
+	typedef typename P::type V;
+#ifdef _OPENMP
+	const bool par = double(m)*n >= ZJUCAD_MATRIX_BLAS_OMP_FLOPS;
+#endif
+	if(trans) {
+#ifdef _OPENMP
+#pragma omp parallel for if(par)
+#endif
+		for(idx_type j = 0; j < n; ++j) {
+			const T *a = A+j*lda;
+			V s = P::set1(T(0));
+			idx_type i = 0;
+			for(; i+P::size <= m; i += P::size)
+				s = P::add(s, P::mul(P::load(a+i), P::load(x+i)));
+			T r = P::hsum(s);
+			for(; i < m; ++i) r += a[i]*x[i];
+			y[j] = (beta == T(0) ? T(0) : beta*y[j]) + alpha*r;
+		}
+		return;
+	}
+	builtin_scale(m, idx_type(1), beta, y, m);
+	// each thread owns a range of rows of y
+	const idx_type RB = 256;
+	const idx_type rblocks = (m+RB-1)/RB;
+#ifdef _OPENMP
+#pragma omp parallel for if(par)
+#endif
+	for(idx_type ib = 0; ib < rblocks; ++ib) {
+		const idx_type i0 = ib*RB, i1 = std::min(m, i0+RB);
+		idx_type j = 0;
+		for(; j+4 <= n; j += 4) {
+			const T *a0 = A+j*lda, *a1 = a0+lda, *a2 = a1+lda, *a3 = a2+lda;
+			const V x0 = P::set1(alpha*x[j]), x1 = P::set1(alpha*x[j+1]),
+				x2 = P::set1(alpha*x[j+2]), x3 = P::set1(alpha*x[j+3]);
+			idx_type i = i0;
+			for(; i+P::size <= i1; i += P::size) {
+				V s = P::load(y+i);
+				s = P::add(s, P::mul(P::load(a0+i), x0));
+				s = P::add(s, P::mul(P::load(a1+i), x1));
+				s = P::add(s, P::mul(P::load(a2+i), x2));
+				s = P::add(s, P::mul(P::load(a3+i), x3));
+				P::store(y+i, s);
+			}
+			for(; i < i1; ++i)
+				y[i] += alpha*(a0[i]*x[j]+a1[i]*x[j+1]+a2[i]*x[j+2]+a3[i]*x[j+3]);
+		}
+		for(; j < n; ++j) {
+			const T *a = A+j*lda;
+			const T xj = alpha*x[j];
+			for(idx_type i = i0; i < i1; ++i) y[i] += a[i]*xj;
+		}
+	}
+}
+
+//! @brief C = alpha*op(A)*op(A)^T + beta*C with both triangles of C
+//! filled, op(A) is n x k
+template <typename T>
+void builtin_syrk(bool trans, idx_type n, idx_type k, T alpha, const T *A, idx_type lda,
+				  T beta, T *C, idx_type ldc)
+{
+	const idx_type NB = 64;
+	// lower block columns, as gemm of the rows below and the block
+	for(idx_type j0 = 0; j0 < n; j0 += NB) {
+		const idx_type nb = std::min(NB, n-j0);
+		if(trans)
+			builtin_gemm(true, false, n-j0, nb, k, alpha, A+j0*lda, lda,
+						 A+j0*lda, lda, beta, C+j0+j0*ldc, ldc);
+		else
+			builtin_gemm(false, true, n-j0, nb, k, alpha, A+j0, lda,
+						 A+j0, lda, beta, C+j0+j0*ldc, ldc);
+	}
+	for(idx_type j = 1; j < n; ++j)
+		for(idx_type i = 0; i < j; ++i)
+			C[i+j*ldc] = C[j+i*ldc];
+}
+
+}}
+
+#endif
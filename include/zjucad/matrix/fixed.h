@@ -0,0 +1,258 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_FIXED_H_
+#define _ZJUCAD_MATRIX_FIXED_H_
+
+#include <cmath>
+
+#include "simd.h"
+
+namespace zjucad { namespace matrix {
+
+//! @brief column major format with compile time size, the elements
+//! live in a bounded_array inside the matrix, e.g.
+//!   matrix<double, fixed<3, 3> > R;
+//! The container argument A of matrix is ignored.  resize only checks
+//! the size, so assigning an expression of another size asserts.
+template <size_type ROW, size_type COL>
+struct fixed {
+	template <typename T, typename A>
+	struct matrix_type {
+		typedef zjucad::matrix::size_type size_type;
+		typedef T value_type;
+		typedef const T &const_reference;
+		typedef T &reference;
+		typedef bounded_array<T, ROW*COL> raw_data_type;
+		typedef matrix_type<T, A> expression_type;
+		typedef typename raw_data_type::const_iterator const_iterator;
+		typedef typename raw_data_type::iterator iterator;
+
+		// size
+		size_type size(void) const {return ROW*COL;}
+		size_type size(int dim) const {return (dim==1)?ROW:COL;}
+
+		// element access
+		const_reference operator()(idx_type i) const {return m_data[i];}
+		const_reference operator()(idx_type row, idx_type col) const {return m_data[row+col*ROW];}
+		reference operator()(idx_type i) {return m_data[i];}
+		reference operator()(idx_type row, idx_type col) {return m_data[row+col*ROW];}
+
+		// iterator access
+		const_iterator begin(void) const {return m_data.begin();}
+		const_iterator end(void) const {return m_data.end();}
+		iterator begin(void) {return m_data.begin();}
+		iterator end(void) {return m_data.end();}
+
+		// used by matrix
+		void resize(size_type row, size_type col) {
+			assert(row == ROW && col == COL);
+		}
+		void resize(size_type row, size_type col, uninitialized_t) {
+			assert(row == ROW && col == COL);
+		}
+		void swap(matrix_type<T, A> &m) {
+			m_data.swap(m.m_data);
+		}
+
+		// raw data access
+		const raw_data_type &data() const {return m_data;}
+		raw_data_type &data() {return m_data;}
+
+		// data
+		raw_data_type m_data;
+	};
+};
+
+//! @brief fixed size operands take part in vectorized assignment
+template <typename T, size_type ROW, size_type COL, typename A, bool tmp>
+struct packet_expr<matrix<T, fixed<ROW, COL>, A, tmp> >
+{
+	typedef matrix<T, fixed<ROW, COL>, A, tmp> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &e, idx_type i) { return packet<T>::load(e.data().begin()+i); }
+	static T at(const E &e, idx_type i) { return e.data().begin()[i]; }
+};
+
+//! @brief compile time unrolled loops over N elements
+template <size_type N>
+struct fixed_unroll {
+	template <typename T>
+	static T dot(const T *a, const T *b) {
+		return fixed_unroll<N-1>::dot(a, b) + a[N-1]*b[N-1];
+	}
+};
+
+template <>
+struct fixed_unroll<1> {
+	template <typename T>
+	static T dot(const T *a, const T *b) {
+		return a[0]*b[0];
+	}
+};
+
+//! @brief closed form det and inv for small N, LU with partial
+//! pivoting on the stack otherwise.  A is column major.
+template <size_type N>
+struct fixed_square {
+	template <typename T>
+	static T det(const T *A) {
+		T LU[N*N];
+		std::copy(A, A+N*N, LU);
+		T rtn = 1;
+		for(size_type k = 0; k < N; ++k) {
+			size_type p = k;
+			for(size_type i = k+1; i < N; ++i)
+				if(std::fabs(LU[i+k*N]) > std::fabs(LU[p+k*N])) p = i;
+			if(LU[p+k*N] == T(0)) return T(0);
+			if(p != k) {
+				for(size_type j = 0; j < N; ++j)
+					std::swap(LU[k+j*N], LU[p+j*N]);
+				rtn = -rtn;
+			}
+			rtn *= LU[k+k*N];
+			for(size_type i = k+1; i < N; ++i) {
+				const T l = LU[i+k*N]/LU[k+k*N];
+				for(size_type j = k+1; j < N; ++j)
+					LU[i+j*N] -= l*LU[k+j*N];
+			}
+		}
+		return rtn;
+	}
+	//! Gauss-Jordan with partial pivoting, A is overwritten by inv(A)
+	template <typename T>
+	static int inv(T *A) {
+		size_type piv[N];
+		for(size_type k = 0; k < N; ++k) {
+			size_type p = k;
+			for(size_type i = k+1; i < N; ++i)
+				if(std::fabs(A[i+k*N]) > std::fabs(A[p+k*N])) p = i;
+			if(A[p+k*N] == T(0)) return 1;
+			if(p != k) {
+				for(size_type j = 0; j < N; ++j)
+					std::swap(A[k+j*N], A[p+j*N]);
+			}
+			piv[k] = p;
+			const T d = T(1)/A[k+k*N];
+			A[k+k*N] = T(1);
+			for(size_type j = 0; j < N; ++j)
+				A[k+j*N] *= d;
+			for(size_type i = 0; i < N; ++i) {
+				if(i == k) continue;
+				const T l = A[i+k*N];
+				A[i+k*N] = T(0);
+				for(size_type j = 0; j < N; ++j)
+					A[i+j*N] -= l*A[k+j*N];
+			}
+		}
+		// undo the row interchanges as column interchanges
+		for(size_type k = N; k-- > 0; ) {
+			if(piv[k] == k) continue;
+			for(size_type i = 0; i < N; ++i)
+				std::swap(A[i+k*N], A[i+piv[k]*N]);
+		}
+		return 0;
+	}
+};
+
+template <>
+struct fixed_square<1> {
+	template <typename T>
+	static T det(const T *A) {return A[0];}
+	template <typename T>
+	static int inv(T *A) {
+		if(A[0] == T(0)) return 1;
+		A[0] = T(1)/A[0];
+		return 0;
+	}
+};
+
+template <>
+struct fixed_square<2> {
+	template <typename T>
+	static T det(const T *A) {return A[0]*A[3]-A[1]*A[2];}
+	template <typename T>
+	static int inv(T *A) {
+		const T d = det(A);
+		if(d == T(0)) return 1;
+		const T a = A[0];
+		A[0] = A[3]/d; A[3] = a/d;
+		A[1] = -A[1]/d; A[2] = -A[2]/d;
+		return 0;
+	}
+};
+
+template <>
+struct fixed_square<3> {
+	template <typename T>
+	static T det(const T *A) {
+		return A[0]*(A[4]*A[8]-A[7]*A[5])
+			-A[3]*(A[1]*A[8]-A[7]*A[2])
+			+A[6]*(A[1]*A[5]-A[4]*A[2]);
+	}
+	template <typename T>
+	static int inv(T *A) {
+		const T c[9] = {
+			A[4]*A[8]-A[5]*A[7], A[2]*A[7]-A[1]*A[8], A[1]*A[5]-A[2]*A[4],
+			A[5]*A[6]-A[3]*A[8], A[0]*A[8]-A[2]*A[6], A[2]*A[3]-A[0]*A[5],
+			A[3]*A[7]-A[4]*A[6], A[1]*A[6]-A[0]*A[7], A[0]*A[4]-A[1]*A[3]
+		};
+		const T d = A[0]*c[0]+A[3]*c[1]+A[6]*c[2];
+		if(d == T(0)) return 1;
+		const T id = T(1)/d;
+		for(int i = 0; i < 9; ++i)
+			A[i] = c[i]*id;
+		return 0;
+	}
+};
+
+template <typename T, size_type ROW, size_type COL, typename A1, bool tmp1, typename A2, bool tmp2>
+T dot(const matrix<T, fixed<ROW, COL>, A1, tmp1> &a, const matrix<T, fixed<ROW, COL>, A2, tmp2> &b) {
+	return fixed_unroll<ROW*COL>::dot(a.data().begin(), b.data().begin());
+}
+
+template <typename T, typename A1, bool tmp1, typename A2, bool tmp2>
+matrix<T, fixed<3, 1> >
+cross(const matrix<T, fixed<3, 1>, A1, tmp1> &a, const matrix<T, fixed<3, 1>, A2, tmp2> &b) {
+	matrix<T, fixed<3, 1> > r;
+	r[0] = a[1]*b[2]-a[2]*b[1];
+	r[1] = a[2]*b[0]-a[0]*b[2];
+	r[2] = a[0]*b[1]-a[1]*b[0];
+	return r;
+}
+
+template <typename T, size_type N, typename A, bool tmp>
+T det(const matrix<T, fixed<N, N>, A, tmp> &m) {
+	return fixed_square<N>::det(m.data().begin());
+}
+
+//! @brief in place inverse like inv in lapack.h
+//! @return 0 on success, non zero if m is singular
+template <typename T, size_type N, typename A, bool tmp>
+int inv(matrix<T, fixed<N, N>, A, tmp> &m) {
+	return fixed_square<N>::inv(m.data().begin());
+}
+
+}}
+
+#endif
@@ -24,6 +24,8 @@
 #include "matrix_expression.h"
 #include "matrix_proxy.h"
 
+#include <boost/type_traits/remove_const.hpp>
+
 namespace zjucad { namespace matrix {
 
 // convert a random access iterator into a column major matrix
@@ -110,7 +112,7 @@ public:
 
  	typedef zjucad::matrix::size_type size_type;
 
-	typedef T value_type;
+	typedef typename boost::remove_const<T>::type value_type;
 	typedef T& reference;
 	typedef const T& const_reference;
 	typedef T* iterator;
@@ -57,6 +57,7 @@ struct matrix : public matrix_expression<matrix<T, F, A, tmp> > {
   explicit
 	matrix(size_type size){m_matrix.resize(size, 1);}
 	matrix(size_type row, size_type col){m_matrix.resize(row, col);}
+	matrix(size_type row, size_type col, uninitialized_t){m_matrix.resize(row, col, uninitialized);}
 
 	template <typename E>
 	matrix(const matrix_expression<E> &e):m_matrix(){*this=e();}
@@ -69,6 +70,7 @@ struct matrix : public matrix_expression<matrix<T, F, A, tmp> > {
 	size_type size(int dim) const {return (dim==1)?m_matrix.size(1):m_matrix.size(2);}
 	void resize(size_type size) {m_matrix.resize(size, 1);}
 	void resize(size_type row, size_type col) {m_matrix.resize(row, col);}
+	void resize(size_type row, size_type col, uninitialized_t) {m_matrix.resize(row, col, uninitialized);}
 
 	// element access
 	const_reference operator[](idx_type i) const {return m_matrix(i);}
@@ -155,6 +157,10 @@ struct column_major {
 			m_data.resize(row*col);
 			m_row = row; m_col = col;
 		}
+		void resize(size_type row, size_type col, uninitialized_t) {
+			m_data.resize(row*col, uninitialized);
+			m_row = row; m_col = col;
+		}
 		void swap(matrix_type<T, A> &m) {
 			m_data.swap(m.m_data);
 			std::swap(m_row, m.m_row);
@@ -258,6 +264,10 @@ struct row_major {
 			m_data.resize(row*col);
 			m_row = row; m_col = col;
 		}
+		void resize(size_type row, size_type col, uninitialized_t) {
+			m_data.resize(row*col, uninitialized);
+			m_row = row; m_col = col;
+		}
 		void swap(matrix_type<T, A> &m) {
 			m_data.swap(m.m_data);
 			std::swap(m_row, m.m_row);
@@ -361,6 +371,10 @@ struct bmp_order {
 			m_data.resize(row*col);
 			m_row = row; m_col = col;
 		}
+		void resize(size_type row, size_type col, uninitialized_t) {
+			m_data.resize(row*col, uninitialized);
+			m_row = row; m_col = col;
+		}
 		void swap(matrix_type<T, A> &m) {
 			m_data.swap(m.m_data);
 			std::swap(m_row, m.m_row);
@@ -382,6 +396,20 @@ struct default_tmp_matrix {
 	typedef matrix<T, default_format, default_container<T>, false> type;
 };
 
+//! @brief matrix on ZJUCAD_MATRIX_ALIGNMENT aligned storage which is
+//! kept on shrink, see allocator.h
+template <typename T>
+struct aligned_matrix {
+	typedef matrix<T, column_major, unbounded_array<T, aligned_allocator<T> >, false> type;
+};
+
+//! @brief like aligned_matrix, the storage comes from a thread local
+//! pool, for temporaries in inner loops
+template <typename T>
+struct pooled_matrix {
+	typedef matrix<T, column_major, unbounded_array<T, pool_allocator<T> >, false> type;
+};
+
 template <typename E>
 inline typename default_tmp_matrix<typename E::value_type>::type
 temp(const matrix_expression<E> &e) {
@@ -512,3 +540,4 @@ inline value_matrix<double, rand_functor> rand(size_type row, size_type col) {re
 }	// namespace zjucad
 
 #include "operation.h"
+#include "fixed.h"
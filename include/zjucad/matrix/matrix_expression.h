@@ -386,10 +386,58 @@ struct matrix_expression {
 	}
 };
 
+//! @brief element copy after resize, specialized in simd.h for
+//! contiguous operands.
+template <typename E1, typename E2, typename ENABLE = void>
+struct assign_elements {
+	static void apply(E1 &lhs, const E2 &rhs) {
+		std::copy(rhs.begin(), rhs.end(), lhs.begin());
+	}
+};
+
+//! @brief the matrix being assigned, see alias.h
+struct alias_target {
+	const void *obj;		// the matrix object
+	const void *lo, *hi;	// its storage
+};
+
+enum { alias_none = 0, alias_elementwise = 1, alias_other = 2 };
+
+//! @brief how an expression reads the alias_target, specialized in
+//! alias.h
+template <typename E>
+struct expr_alias {
+	static int check(const E &, const alias_target &) {return alias_none;}
+};
+
+//! @brief left hand side policy of assign, proxies and other
+//! expressions are resized in place and not checked for aliasing.
+template <typename E1>
+struct assign_target {
+	static alias_target target(const E1 &) {
+		alias_target t = {0, 0, 0};
+		return t;
+	}
+	static void resize(E1 &lhs, size_type row, size_type col) {
+		lhs.resize(row, col);
+	}
+	template <typename E2>
+	static void assign_temp(E1 &, const E2 &) {}
+};
+
 template <typename E1, typename E2>
 void assign(matrix_expression<E1> &lhs, const matrix_expression<E2> &rhs) {
-  lhs().resize(rhs().size(1), rhs().size(2));
-  std::copy(rhs().begin(), rhs().end(), lhs().begin());
+	const alias_target t = assign_target<E1>::target(lhs());
+	if(t.obj) {
+		const int a = expr_alias<E2>::check(rhs(), t);
+		if(a == alias_other || (a == alias_elementwise &&
+			(lhs().size(1) != rhs().size(1) || lhs().size(2) != rhs().size(2)))) {
+			assign_target<E1>::assign_temp(lhs(), rhs());
+			return;
+		}
+	}
+	assign_target<E1>::resize(lhs(), rhs().size(1), rhs().size(2));
+	assign_elements<E1, E2>::apply(lhs(), rhs());
 }
 
 template <typename E1>
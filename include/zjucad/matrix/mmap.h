@@ -0,0 +1,349 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_MMAP_H_
+#define _ZJUCAD_MATRIX_MMAP_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+//! glibc's MAP_TYPE flag mask is the name of a template parameter in
+//! hjlib/sparse, and it is not used here
+#  undef MAP_TYPE
+#endif
+
+#include "matrix.h"
+#include "itr_matrix.h"
+
+//! @brief zero copy access to the binary files of write(os, matrix).
+//!
+//! The layout written by write for simple element types is
+//!   size_type rows, size_type cols, size_type rows*cols, T data[],
+//! so the elements of a mapped file can be used in place through an
+//! itr_matrix:
+//!
+//!   mapped_matrix<double> node;
+//!   if(node.open("node.mat")) return __LINE__;
+//!   double len = norm(node()(colon(), 0));
+//!
+//! mapped_matrix::create makes a file of that layout which is filled
+//! through the mapping, and write_stream writes any expression in the
+//! same layout in small chunks without evaluating it into a matrix.
+
+namespace zjucad { namespace matrix {
+
+//! @brief a whole file mapped into memory, read only or shared
+//! read write.  Not copyable, the mapping ends with the object.
+class mapped_file
+{
+public:
+	mapped_file():addr_(0), bytes_(0), writable_(false) {
+#ifdef _WIN32
+		file_ = INVALID_HANDLE_VALUE;
+		map_ = 0;
+#else
+		fd_ = -1;
+#endif
+	}
+	~mapped_file() { close(); }
+
+	//! @return 0 on success
+	int open(const char *path, bool writable = false) {
+		close();
+		writable_ = writable;
+#ifdef _WIN32
+		file_ = CreateFileA(path, writable ? (GENERIC_READ|GENERIC_WRITE) : GENERIC_READ,
+							FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(file_ == INVALID_HANDLE_VALUE) return 1;
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(file_, &size)) { close(); return 1; }
+		bytes_ = static_cast<std::size_t>(size.QuadPart);
+#else
+		fd_ = ::open(path, writable ? O_RDWR : O_RDONLY);
+		if(fd_ < 0) return 1;
+		struct stat st;
+		if(fstat(fd_, &st)) { close(); return 1; }
+		bytes_ = static_cast<std::size_t>(st.st_size);
+#endif
+		return map();
+	}
+
+	//! @brief create or truncate path to bytes and map it read write
+	int create(const char *path, std::size_t bytes) {
+		close();
+		writable_ = true;
+		bytes_ = bytes;
+#ifdef _WIN32
+		file_ = CreateFileA(path, GENERIC_READ|GENERIC_WRITE, 0, 0,
+							CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		if(file_ == INVALID_HANDLE_VALUE) return 1;
+		LARGE_INTEGER size;
+		size.QuadPart = bytes;
+		if(!SetFilePointerEx(file_, size, 0, FILE_BEGIN) || !SetEndOfFile(file_)) {
+			close(); return 1;
+		}
+#else
+		fd_ = ::open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+		if(fd_ < 0) return 1;
+		if(ftruncate(fd_, static_cast<off_t>(bytes))) { close(); return 1; }
+#endif
+		return map();
+	}
+
+	//! @brief map a new file of bytes in dir, read write and private
+	//! to the process.  The file has a unique name, mode 0600 and no
+	//! directory entry once it is mapped, so it goes away with the
+	//! mapping or the process.
+	//! @return 0 on success
+	int create_temp(const char *dir, std::size_t bytes) {
+		close();
+		writable_ = true;
+		bytes_ = bytes;
+#ifdef _WIN32
+		char name[MAX_PATH];
+		if(!GetTempFileNameA(dir, "zjm", 0, name)) return 1;
+		file_ = CreateFileA(name, GENERIC_READ|GENERIC_WRITE, 0, 0, OPEN_EXISTING,
+							FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE, 0);
+		if(file_ == INVALID_HANDLE_VALUE) { DeleteFileA(name); return 1; }
+		LARGE_INTEGER size;
+		size.QuadPart = bytes;
+		if(!SetFilePointerEx(file_, size, 0, FILE_BEGIN) || !SetEndOfFile(file_)) {
+			close(); return 1;
+		}
+#else
+		const std::string path = std::string(dir)+"/zjucad_XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back(0);
+		fd_ = mkstemp(&name[0]);	// O_EXCL and 0600
+		if(fd_ < 0) return 1;
+		unlink(&name[0]);
+		if(ftruncate(fd_, static_cast<off_t>(bytes))) { close(); return 1; }
+#endif
+		return map();
+	}
+
+	//! @brief write dirty pages back, @return 0 on success
+	int flush(void) {
+		if(!addr_ || !writable_) return 0;
+#ifdef _WIN32
+		return FlushViewOfFile(addr_, 0) ? 0 : 1;
+#else
+		return msync(addr_, bytes_, MS_SYNC) ? 1 : 0;
+#endif
+	}
+
+	//! @brief hint the kernel that the mapping is read front to back
+	void advise_sequential(void) {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+		if(addr_) madvise(addr_, bytes_, MADV_SEQUENTIAL|MADV_WILLNEED);
+#endif
+	}
+
+	//! @brief drop the pages of [offset, offset+bytes) from memory,
+	//! they are read from the file again on access.  The changes stay
+	//! in the shared mapping and are written back by the system.
+	int release(std::size_t offset, std::size_t bytes) const {
+		if(!addr_ || bytes == 0) return 0;
+#ifdef _WIN32
+		VirtualUnlock(addr_+offset, bytes);	// leaves the working set
+		return 0;
+#else
+		const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		const std::size_t beg = offset/page*page;
+		bytes += offset-beg;
+#  ifdef MADV_DONTNEED
+		madvise(addr_+beg, bytes, MADV_DONTNEED);
+#  endif
+		return 0;
+#endif
+	}
+
+	void close(void) {
+#ifdef _WIN32
+		if(addr_) UnmapViewOfFile(addr_);
+		if(map_) CloseHandle(map_);
+		if(file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+		map_ = 0;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if(addr_) munmap(addr_, bytes_);
+		if(fd_ >= 0) ::close(fd_);
+		fd_ = -1;
+#endif
+		addr_ = 0;
+		bytes_ = 0;
+	}
+
+	char *data(void) const { return addr_; }
+	std::size_t size(void) const { return bytes_; }
+	bool writable(void) const { return writable_; }
+
+private:
+	mapped_file(const mapped_file &);
+	mapped_file &operator = (const mapped_file &);
+
+	int map(void) {
+		if(bytes_ == 0) return 0;	// empty files can not be mapped
+#ifdef _WIN32
+		map_ = CreateFileMappingA(file_, 0, writable_ ? PAGE_READWRITE : PAGE_READONLY, 0, 0, 0);
+		if(!map_) { close(); return 1; }
+		addr_ = static_cast<char *>(MapViewOfFile(map_, writable_ ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+		if(!addr_) { close(); return 1; }
+#else
+		void *p = mmap(0, bytes_, writable_ ? (PROT_READ|PROT_WRITE) : PROT_READ,
+					   MAP_SHARED, fd_, 0);
+		if(p == MAP_FAILED) { close(); return 1; }
+		addr_ = static_cast<char *>(p);
+#endif
+		return 0;
+	}
+
+	char *addr_;
+	std::size_t bytes_;
+	bool writable_;
+#ifdef _WIN32
+	HANDLE file_, map_;
+#else
+	int fd_;
+#endif
+};
+
+//! @brief a matrix<T> file of write(os, matrix) used in place
+template <typename T>
+class mapped_matrix
+{
+public:
+	typedef zjucad::matrix::size_type size_type;
+	enum { HEADER = 3*sizeof(size_type) };
+
+	mapped_matrix():nrows_(0), ncols_(0) {}
+
+	//! @return 0 on success, 1 if the file can not be mapped, 2 if it
+	//! is not a matrix<T> written by write
+	int open(const char *path, bool writable = false) {
+		nrows_ = ncols_ = 0;
+		if(file_.open(path, writable)) return 1;
+		if(file_.size() < std::size_t(HEADER)) { file_.close(); return 2; }
+		const size_type *h = reinterpret_cast<const size_type *>(file_.data());
+		std::size_t bytes = 0;
+		if(file_bytes(h[0], h[1], bytes) || h[2] != h[0]*h[1] || file_.size() != bytes) {
+			file_.close();
+			return 2;
+		}
+		nrows_ = h[0];
+		ncols_ = h[1];
+		return 0;
+	}
+
+	//! @brief make path a rows x cols matrix<T> file, the elements are
+	//! zero and written through mutable_view()
+	//! @return 0 on success
+	int create(const char *path, size_type rows, size_type cols) {
+		nrows_ = ncols_ = 0;
+		std::size_t bytes = 0;
+		if(file_bytes(rows, cols, bytes) || file_.create(path, bytes)) return 1;
+		size_type *h = reinterpret_cast<size_type *>(file_.data());
+		h[0] = rows;
+		h[1] = cols;
+		h[2] = rows*cols;
+		nrows_ = rows;
+		ncols_ = cols;
+		return 0;
+	}
+
+	int flush(void) { return file_.flush(); }
+	void close(void) { file_.close(); nrows_ = ncols_ = 0; }
+	void advise_sequential(void) { file_.advise_sequential(); }
+
+	size_type size(void) const { return nrows_*ncols_; }
+	size_type size(int dim) const { return (dim == 1) ? nrows_ : ncols_; }
+
+	itr_matrix<const T *> operator()(void) const {
+		return itr_matrix<const T *>(nrows_, ncols_, begin());
+	}
+	//! @brief only for files opened writable or created
+	itr_matrix<T *> mutable_view(void) {
+		assert(file_.writable() || size() == 0);
+		return itr_matrix<T *>(nrows_, ncols_, const_cast<T *>(begin()));
+	}
+
+private:
+	//! @brief bytes = the size of a rows x cols file
+	//! @return 1 if the sizes are negative or the size does not fit
+	//! size_t, e.g. for a corrupted header
+	static int file_bytes(size_type rows, size_type cols, std::size_t &bytes) {
+		if(rows < 0 || cols < 0) return 1;
+		const std::size_t r = rows, c = cols;
+		const std::size_t lim = std::numeric_limits<std::size_t>::max();
+		if(r != 0 && c > lim/r) return 1;
+		const std::size_t n = r*c;
+		if(n > std::size_t(std::numeric_limits<size_type>::max())
+		   || n > (lim-HEADER)/sizeof(T))
+			return 1;
+		bytes = HEADER+n*sizeof(T);
+		return 0;
+	}
+
+	const T *begin(void) const {
+		return file_.data() ? reinterpret_cast<const T *>(file_.data()+HEADER) : 0;
+	}
+
+	mapped_file file_;
+	size_type nrows_, ncols_;
+};
+
+//! @brief write e in the layout of write(os, matrix) through a small
+//! buffer, e is never evaluated as a whole
+template <typename OS, typename E>
+void write_stream(OS &os, const matrix_expression<E> &e)
+{
+	typedef typename E::value_type value_type;
+	const size_type row = e().size(1), col = e().size(2), size = e().size();
+	os.write((const char *)&row, sizeof(size_type));
+	os.write((const char *)&col, sizeof(size_type));
+	os.write((const char *)&size, sizeof(size_type));
+
+	const size_type CHUNK = 4096;
+	value_type buf[CHUNK];
+	for(size_type i = 0; i < size; i += CHUNK) {
+		const size_type n = std::min(CHUNK, size-i);
+		for(size_type j = 0; j < n; ++j)
+			buf[j] = e()[i+j];
+		os.write((const char *)buf, n*sizeof(value_type));
+	}
+}
+
+}}
+
+#endif
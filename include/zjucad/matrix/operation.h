@@ -36,6 +36,8 @@ using std::negate;
 using std::modulus;
 
 #include "matrix.h"
+#include "simd.h"
+#include "alias.h"
 
 namespace zjucad { namespace matrix {
 
@@ -430,28 +432,18 @@ const matrix_convert<T, const E> to(const matrix_expression<E> &e) { return matr
 
 template <typename E>
 typename E::value_type norm(const matrix_expression<E> &e) {
-	typename E::const_iterator i = e().begin(), end = e().end();
-	typename E::value_type r = 0;
-	for(; i != end; ++i) r+=(*i)*(*i);
-	return ::sqrt(r);
+	return ::sqrt(reduce_elements<typename E::value_type, E>::sumsqr(e()));
 }
 
 template <typename T, typename E>
 T norm(const matrix_expression<E> &e) {
-	typename E::const_iterator i = e().begin(), end = e().end();
-	T r = 0;
-	for(; i != end; ++i) r+=(*i)*(*i);
-	return ::sqrt(r);
+	return ::sqrt(reduce_elements<T, E>::sumsqr(e()));
 }
 
 template <typename E1, typename E2>
 typename E1::value_type dot(const matrix_expression<E1> &e1, const matrix_expression<E2> &e2) {
 	assert(e1().size() == e2().size());
-	typename E1::const_iterator i1 = e1().begin(), end1 = e1().end();
-	typename E2::const_iterator i2 = e2().begin();
-	typename E1::value_type r = 0;
-	for(; i1 != end1; ++i1, ++i2) r+=(*i1)*(*i2);
-	return r;
+	return reduce_dot<typename E1::value_type, E1, E2>::apply(e1(), e2());
 }
 
 template <typename E, typename E1, typename E2>
@@ -475,10 +467,7 @@ cross(const matrix_expression<E1> &e1, const matrix_expression<E2> &e2) {
 
 template <typename T, typename E>
 T sum(const matrix_expression<E> &e) {
-	T r = 0;
-	typename E::const_iterator i = e().begin(), end = e().end();
-	for(; i!=end; ++i) r+=*i;
-	return r;
+	return reduce_elements<T, E>::sum(e());
 }
 
 template <typename E>
@@ -895,12 +884,12 @@ typename E::value_type trace(const matrix_expression<E> &e) {
 #undef min
 template <typename E>
 typename E::value_type max(const matrix_expression<E> &m) {
-	return *std::max_element(m().begin(), m().end());
+	return reduce_elements<typename E::value_type, E>::max(m());
 }
 
 template <typename E>
 typename E::value_type min(const matrix_expression<E> &m) {
-	return *std::min_element(m().begin(), m().end());
+	return reduce_elements<typename E::value_type, E>::min(m());
 }
 
 }	// namespace matrix
@@ -0,0 +1,624 @@
+/*
+	State Key Lab of CAD&CG Zhejiang Unv.
+
+	Author: Jin Huang (hj@cad.zju.edu.cn)
+
+	Copyright (c) 2004-2011 <Jin Huang>
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions
+	are met:
+	1. Redistributions of source code must retain the above copyright
+	notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	notice, this list of conditions and the following disclaimer in the
+	documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	derived from this software without specific prior written permission.
+*/
+
+#ifndef _ZJUCAD_MATRIX_SIMD_H_
+#define _ZJUCAD_MATRIX_SIMD_H_
+
+#include <cmath>
+#include <functional>
+#include <algorithm>
+
+#include <boost/utility/enable_if.hpp>
+#include <boost/type_traits/is_same.hpp>
+
+#include "matrix_expression.h"
+
+//! the instruction set is selected at build time by the compiler
+//! flags (-msse2, -mavx, -mavx512f, /arch:AVX ...), define
+//! ZJUCAD_MATRIX_NO_SIMD to force the scalar pointer loops.
+
+#ifndef ZJUCAD_MATRIX_NO_SIMD
+#  if defined __AVX512F__
+#    define ZJUCAD_MATRIX_SIMD 512
+#  elif defined __AVX__
+#    define ZJUCAD_MATRIX_SIMD 256
+#  elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#    define ZJUCAD_MATRIX_SIMD 128
+#  endif
+#endif
+
+#ifndef ZJUCAD_MATRIX_SIMD
+#  define ZJUCAD_MATRIX_SIMD 0
+#endif
+
+#if ZJUCAD_MATRIX_SIMD
+#  include <immintrin.h>
+#endif
+
+namespace zjucad { namespace matrix {
+
+template <typename T, typename F, typename A, bool tmp> struct matrix;
+template <typename T, typename A> class unbounded_array;
+template <typename T, typename F> struct value_matrix;
+template <typename ITR> class itr_matrix;
+template <typename E> class idx_cv_i;
+template <typename E> class idx_cv;
+struct column_major;
+struct zero_functor;
+struct one_functor;
+template <typename T> struct fabs_scalar_functor;
+template <typename T> struct fabsf_scalar_functor;
+template <typename T> struct sqrt_scalar_functor;
+template <typename T> struct sqrtf_scalar_functor;
+
+//! @brief packet: a register of consecutive elements of type T.
+//! The default one is a single scalar, so that every packet
+//! expression at least runs as a plain pointer loop.
+template <typename T>
+struct packet
+{
+	enum { size = 1 };
+	typedef T type;
+
+	static type load(const T *p) { return *p; }
+	static void store(T *p, const type &a) { *p = a; }
+	static type set1(const T &a) { return a; }
+	static type add(const type &a, const type &b) { return a+b; }
+	static type sub(const type &a, const type &b) { return a-b; }
+	static type mul(const type &a, const type &b) { return a*b; }
+	static type div(const type &a, const type &b) { return a/b; }
+	static type neg(const type &a) { return -a; }
+	static type abs(const type &a) { return a < 0 ? -a : a; }
+	static type sqrt(const type &a) { return std::sqrt(a); }
+	static type max(const type &a, const type &b) { return a < b ? b : a; }
+	static type min(const type &a, const type &b) { return b < a ? b : a; }
+	static T hsum(const type &a) { return a; }
+	static T hmax(const type &a) { return a; }
+	static T hmin(const type &a) { return a; }
+};
+
+#define ZJUCAD_MATRIX_PACKET_REDUCE						\
+	static T hsum(const type &a) {						\
+		T buf[size]; store(buf, a);						\
+		T r = buf[0];									\
+		for(int i = 1; i < size; ++i) r += buf[i];		\
+		return r;										\
+	}													\
+	static T hmax(const type &a) {						\
+		T buf[size]; store(buf, a);						\
+		return *std::max_element(buf, buf+size);		\
+	}													\
+	static T hmin(const type &a) {						\
+		T buf[size]; store(buf, a);						\
+		return *std::min_element(buf, buf+size);		\
+	}
+
+#if ZJUCAD_MATRIX_SIMD == 512
+
+template <>
+struct packet<double>
+{
+	typedef double T;
+	enum { size = 8 };
+	typedef __m512d type;
+
+	static type load(const T *p) { return _mm512_loadu_pd(p); }
+	static void store(T *p, const type &a) { _mm512_storeu_pd(p, a); }
+	static type set1(const T &a) { return _mm512_set1_pd(a); }
+	static type add(const type &a, const type &b) { return _mm512_add_pd(a, b); }
+	static type sub(const type &a, const type &b) { return _mm512_sub_pd(a, b); }
+	static type mul(const type &a, const type &b) { return _mm512_mul_pd(a, b); }
+	static type div(const type &a, const type &b) { return _mm512_div_pd(a, b); }
+	static type neg(const type &a) { return _mm512_sub_pd(_mm512_setzero_pd(), a); }
+	static type abs(const type &a) { return _mm512_abs_pd(a); }
+	static type sqrt(const type &a) { return _mm512_sqrt_pd(a); }
+	static type max(const type &a, const type &b) { return _mm512_max_pd(b, a); }
+	static type min(const type &a, const type &b) { return _mm512_min_pd(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+template <>
+struct packet<float>
+{
+	typedef float T;
+	enum { size = 16 };
+	typedef __m512 type;
+
+	static type load(const T *p) { return _mm512_loadu_ps(p); }
+	static void store(T *p, const type &a) { _mm512_storeu_ps(p, a); }
+	static type set1(const T &a) { return _mm512_set1_ps(a); }
+	static type add(const type &a, const type &b) { return _mm512_add_ps(a, b); }
+	static type sub(const type &a, const type &b) { return _mm512_sub_ps(a, b); }
+	static type mul(const type &a, const type &b) { return _mm512_mul_ps(a, b); }
+	static type div(const type &a, const type &b) { return _mm512_div_ps(a, b); }
+	static type neg(const type &a) { return _mm512_sub_ps(_mm512_setzero_ps(), a); }
+	static type abs(const type &a) { return _mm512_abs_ps(a); }
+	static type sqrt(const type &a) { return _mm512_sqrt_ps(a); }
+	static type max(const type &a, const type &b) { return _mm512_max_ps(b, a); }
+	static type min(const type &a, const type &b) { return _mm512_min_ps(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+#elif ZJUCAD_MATRIX_SIMD == 256
+
+template <>
+struct packet<double>
+{
+	typedef double T;
+	enum { size = 4 };
+	typedef __m256d type;
+
+	static type load(const T *p) { return _mm256_loadu_pd(p); }
+	static void store(T *p, const type &a) { _mm256_storeu_pd(p, a); }
+	static type set1(const T &a) { return _mm256_set1_pd(a); }
+	static type add(const type &a, const type &b) { return _mm256_add_pd(a, b); }
+	static type sub(const type &a, const type &b) { return _mm256_sub_pd(a, b); }
+	static type mul(const type &a, const type &b) { return _mm256_mul_pd(a, b); }
+	static type div(const type &a, const type &b) { return _mm256_div_pd(a, b); }
+	static type neg(const type &a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+	static type abs(const type &a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static type sqrt(const type &a) { return _mm256_sqrt_pd(a); }
+	static type max(const type &a, const type &b) { return _mm256_max_pd(b, a); }
+	static type min(const type &a, const type &b) { return _mm256_min_pd(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+template <>
+struct packet<float>
+{
+	typedef float T;
+	enum { size = 8 };
+	typedef __m256 type;
+
+	static type load(const T *p) { return _mm256_loadu_ps(p); }
+	static void store(T *p, const type &a) { _mm256_storeu_ps(p, a); }
+	static type set1(const T &a) { return _mm256_set1_ps(a); }
+	static type add(const type &a, const type &b) { return _mm256_add_ps(a, b); }
+	static type sub(const type &a, const type &b) { return _mm256_sub_ps(a, b); }
+	static type mul(const type &a, const type &b) { return _mm256_mul_ps(a, b); }
+	static type div(const type &a, const type &b) { return _mm256_div_ps(a, b); }
+	static type neg(const type &a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+	static type abs(const type &a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	static type sqrt(const type &a) { return _mm256_sqrt_ps(a); }
+	static type max(const type &a, const type &b) { return _mm256_max_ps(b, a); }
+	static type min(const type &a, const type &b) { return _mm256_min_ps(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+#elif ZJUCAD_MATRIX_SIMD == 128
+
+template <>
+struct packet<double>
+{
+	typedef double T;
+	enum { size = 2 };
+	typedef __m128d type;
+
+	static type load(const T *p) { return _mm_loadu_pd(p); }
+	static void store(T *p, const type &a) { _mm_storeu_pd(p, a); }
+	static type set1(const T &a) { return _mm_set1_pd(a); }
+	static type add(const type &a, const type &b) { return _mm_add_pd(a, b); }
+	static type sub(const type &a, const type &b) { return _mm_sub_pd(a, b); }
+	static type mul(const type &a, const type &b) { return _mm_mul_pd(a, b); }
+	static type div(const type &a, const type &b) { return _mm_div_pd(a, b); }
+	static type neg(const type &a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+	static type abs(const type &a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+	static type sqrt(const type &a) { return _mm_sqrt_pd(a); }
+	static type max(const type &a, const type &b) { return _mm_max_pd(b, a); }
+	static type min(const type &a, const type &b) { return _mm_min_pd(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+template <>
+struct packet<float>
+{
+	typedef float T;
+	enum { size = 4 };
+	typedef __m128 type;
+
+	static type load(const T *p) { return _mm_loadu_ps(p); }
+	static void store(T *p, const type &a) { _mm_storeu_ps(p, a); }
+	static type set1(const T &a) { return _mm_set1_ps(a); }
+	static type add(const type &a, const type &b) { return _mm_add_ps(a, b); }
+	static type sub(const type &a, const type &b) { return _mm_sub_ps(a, b); }
+	static type mul(const type &a, const type &b) { return _mm_mul_ps(a, b); }
+	static type div(const type &a, const type &b) { return _mm_div_ps(a, b); }
+	static type neg(const type &a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+	static type abs(const type &a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	static type sqrt(const type &a) { return _mm_sqrt_ps(a); }
+	static type max(const type &a, const type &b) { return _mm_max_ps(b, a); }
+	static type min(const type &a, const type &b) { return _mm_min_ps(b, a); }
+	ZJUCAD_MATRIX_PACKET_REDUCE
+};
+
+#endif
+
+#undef ZJUCAD_MATRIX_PACKET_REDUCE
+
+//! @brief types which have a packet implementation
+template <typename T> struct is_packet_type { enum { value = 0 }; };
+template <> struct is_packet_type<float> { enum { value = 1 }; };
+template <> struct is_packet_type<double> { enum { value = 1 }; };
+
+//! @brief map an element-wise functor onto packet<T>
+template <typename F>
+struct packet_op { enum { value = 0 }; };
+
+#define ZJUCAD_MATRIX_PACKET_BINARY_OP(FUNCTOR, OP)						\
+template <typename T>													\
+struct packet_op<FUNCTOR<T> > {											\
+	enum { value = 1 };													\
+	typedef typename packet<T>::type type;								\
+	static type apply(const type &a, const type &b) { return packet<T>::OP(a, b); } \
+};
+
+ZJUCAD_MATRIX_PACKET_BINARY_OP(std::plus, add);
+ZJUCAD_MATRIX_PACKET_BINARY_OP(std::minus, sub);
+ZJUCAD_MATRIX_PACKET_BINARY_OP(std::multiplies, mul);
+ZJUCAD_MATRIX_PACKET_BINARY_OP(std::divides, div);
+
+#undef ZJUCAD_MATRIX_PACKET_BINARY_OP
+
+#define ZJUCAD_MATRIX_PACKET_UNARY_OP(FUNCTOR, OP)						\
+template <typename T>													\
+struct packet_op<FUNCTOR<T> > {											\
+	enum { value = 1 };													\
+	typedef typename packet<T>::type type;								\
+	static type apply(const type &a) { return packet<T>::OP(a); }		\
+};
+
+ZJUCAD_MATRIX_PACKET_UNARY_OP(std::negate, neg);
+ZJUCAD_MATRIX_PACKET_UNARY_OP(fabs_scalar_functor, abs);
+ZJUCAD_MATRIX_PACKET_UNARY_OP(fabsf_scalar_functor, abs);
+ZJUCAD_MATRIX_PACKET_UNARY_OP(sqrt_scalar_functor, sqrt);
+ZJUCAD_MATRIX_PACKET_UNARY_OP(sqrtf_scalar_functor, sqrt);
+
+#undef ZJUCAD_MATRIX_PACKET_UNARY_OP
+
+//! @brief packet_expr: an expression whose i-th element only depends
+//! on the i-th elements of contiguous column major storages, so that
+//! it can be evaluated packet by packet in linear order.
+//!
+//! load(e, i) returns the packet starting at linear index i, at(e, i)
+//! returns the scalar at linear index i.
+struct no_packet {};
+
+template <typename E>
+struct packet_expr
+{
+	enum { value = 0 };
+	typedef no_packet value_type;
+};
+
+template <typename E>
+struct packet_expr<const E> : public packet_expr<E> {};
+
+template <typename T, typename AL, bool tmp>
+struct packet_expr<matrix<T, column_major, unbounded_array<T, AL>, tmp> >
+{
+	typedef matrix<T, column_major, unbounded_array<T, AL>, tmp> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &e, idx_type i) { return packet<T>::load(e.data().begin()+i); }
+	static T at(const E &e, idx_type i) { return e.data().begin()[i]; }
+};
+
+template <typename T>
+struct packet_expr<itr_matrix<T *> >
+{
+	typedef itr_matrix<T *> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &e, idx_type i) { return packet<T>::load(e.begin()+i); }
+	static T at(const E &e, idx_type i) { return e.begin()[i]; }
+};
+
+template <typename T>
+struct packet_expr<itr_matrix<const T *> >
+{
+	typedef itr_matrix<const T *> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &e, idx_type i) { return packet<T>::load(&e[i]); }
+	static T at(const E &e, idx_type i) { return e[i]; }
+};
+
+template <typename T>
+struct packet_expr<value_matrix<T, zero_functor> >
+{
+	typedef value_matrix<T, zero_functor> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &, idx_type) { return packet<T>::set1(T(0)); }
+	static T at(const E &, idx_type) { return T(0); }
+};
+
+template <typename T>
+struct packet_expr<value_matrix<T, one_functor> >
+{
+	typedef value_matrix<T, one_functor> E;
+	enum { value = is_packet_type<T>::value };
+	typedef T value_type;
+	typedef typename packet<T>::type type;
+
+	static type load(const E &, idx_type) { return packet<T>::set1(T(1)); }
+	static T at(const E &, idx_type) { return T(1); }
+};
+
+template <typename E1, typename F>
+struct packet_expr<matrix_each_element<E1, F> >
+{
+	typedef matrix_each_element<E1, F> E;
+	typedef packet_expr<E1> arg;
+	typedef typename arg::value_type value_type;
+	enum { value = arg::value && packet_op<F>::value
+		   && boost::is_same<value_type, typename E::value_type>::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) { return packet_op<F>::apply(arg::load(e.m_e, i)); }
+	static value_type at(const E &e, idx_type i) { return F()(arg::at(e.m_e, i)); }
+};
+
+template <typename E1, typename E2, typename F>
+struct packet_expr<matrix_matrix_each_element<E1, E2, F> >
+{
+	typedef matrix_matrix_each_element<E1, E2, F> E;
+	typedef packet_expr<E1> arg1;
+	typedef packet_expr<E2> arg2;
+	typedef typename arg1::value_type value_type;
+	enum { value = arg1::value && arg2::value && packet_op<F>::value
+		   && boost::is_same<value_type, typename arg2::value_type>::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) {
+		return packet_op<F>::apply(arg1::load(e.m_e1, i), arg2::load(e.m_e2, i));
+	}
+	static value_type at(const E &e, idx_type i) {
+		return F()(arg1::at(e.m_e1, i), arg2::at(e.m_e2, i));
+	}
+};
+
+template <typename E1, typename F>
+struct packet_expr<matrix_scalar_function<E1, F> >
+{
+	typedef matrix_scalar_function<E1, F> E;
+	typedef packet_expr<E1> arg;
+	typedef typename arg::value_type value_type;
+	enum { value = arg::value && packet_op<F>::value
+		   && boost::is_same<value_type, typename E::value_type>::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) {
+		return packet_op<F>::apply(arg::load(e.m_e1, i), packet<value_type>::set1(e.m_e2));
+	}
+	static value_type at(const E &e, idx_type i) { return F()(arg::at(e.m_e1, i), e.m_e2); }
+};
+
+template <typename E1, typename F>
+struct packet_expr<scalar_matrix_function<E1, F> >
+{
+	typedef scalar_matrix_function<E1, F> E;
+	typedef packet_expr<E1> arg;
+	typedef typename arg::value_type value_type;
+	enum { value = arg::value && packet_op<F>::value
+		   && boost::is_same<value_type, typename E::value_type>::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) {
+		return packet_op<F>::apply(packet<value_type>::set1(e.m_e1), arg::load(e.m_e2, i));
+	}
+	static value_type at(const E &e, idx_type i) { return F()(e.m_e1, arg::at(e.m_e2, i)); }
+};
+
+//! a(colon(), j) is a contiguous run of a, so column proxies of
+//! packet expressions fuse into the same loop
+template <typename E1>
+struct packet_expr<idx_cv_i<E1> >
+{
+	typedef idx_cv_i<E1> E;
+	typedef packet_expr<E1> arg;
+	typedef typename arg::value_type value_type;
+	enum { value = arg::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) { return arg::load(e.m_m, e.m_col*e.m_m.size(1)+i); }
+	static value_type at(const E &e, idx_type i) { return arg::at(e.m_m, e.m_col*e.m_m.size(1)+i); }
+};
+
+//! a(colon())
+template <typename E1>
+struct packet_expr<idx_cv<E1> >
+{
+	typedef idx_cv<E1> E;
+	typedef packet_expr<E1> arg;
+	typedef typename arg::value_type value_type;
+	enum { value = arg::value };
+	typedef typename packet<value_type>::type type;
+
+	static type load(const E &e, idx_type i) { return arg::load(e.m_m, i); }
+	static value_type at(const E &e, idx_type i) { return arg::at(e.m_m, i); }
+};
+
+//! @brief is E a packet expression with elements of type T
+template <typename E, typename T>
+struct is_packet_expr_of
+{
+	enum { value = packet_expr<E>::value
+		   && boost::is_same<typename packet_expr<E>::value_type, T>::value };
+};
+
+//! vectorized assignment into a contiguous column major matrix. The
+//! i-th output only reads the i-th inputs, so lhs may appear in rhs.
+template <typename T, typename AL, bool tmp, typename E2>
+struct assign_elements<matrix<T, column_major, unbounded_array<T, AL>, tmp>, E2,
+					   typename boost::enable_if_c<is_packet_expr_of<E2, T>::value>::type>
+{
+	typedef matrix<T, column_major, unbounded_array<T, AL>, tmp> E1;
+	static void apply(E1 &lhs, const E2 &rhs) {
+		typedef packet_expr<E2> R;
+		typedef packet<T> P;
+		T *dst = lhs.data().begin();
+		const idx_type n = rhs.size();
+		idx_type i = 0;
+		for(; i+P::size <= n; i += P::size)
+			P::store(dst+i, R::load(rhs, i));
+		for(; i < n; ++i)
+			dst[i] = R::at(rhs, i);
+	}
+};
+
+//! @brief reductions used by sum, norm, max and min in operation.h,
+//! packet loops for packet expressions of T or the plain ones
+template <typename T, typename E, bool PACKET = is_packet_expr_of<E, T>::value>
+struct reduce_elements
+{
+	static T sum(const E &e) {
+		T r = 0;
+		typename E::const_iterator i = e.begin(), end = e.end();
+		for(; i != end; ++i) r += *i;
+		return r;
+	}
+	static T sumsqr(const E &e) {
+		T r = 0;
+		typename E::const_iterator i = e.begin(), end = e.end();
+		for(; i != end; ++i) r += (*i)*(*i);
+		return r;
+	}
+	static T max(const E &e) { return *std::max_element(e.begin(), e.end()); }
+	static T min(const E &e) { return *std::min_element(e.begin(), e.end()); }
+};
+
+template <typename T, typename E>
+struct reduce_elements<T, E, true>
+{
+	typedef packet_expr<E> R;
+	typedef packet<T> P;
+	typedef typename P::type type;
+
+	static T sum(const E &e) {
+		const idx_type n = e.size();
+		type r0 = P::set1(0), r1 = P::set1(0);
+		idx_type i = 0;
+		for(; i+2*P::size <= n; i += 2*P::size) {
+			r0 = P::add(r0, R::load(e, i));
+			r1 = P::add(r1, R::load(e, i+P::size));
+		}
+		for(; i+P::size <= n; i += P::size)
+			r0 = P::add(r0, R::load(e, i));
+		T r = P::hsum(P::add(r0, r1));
+		for(; i < n; ++i) r += R::at(e, i);
+		return r;
+	}
+	static T sumsqr(const E &e) {
+		const idx_type n = e.size();
+		type r0 = P::set1(0), r1 = P::set1(0);
+		idx_type i = 0;
+		for(; i+2*P::size <= n; i += 2*P::size) {
+			const type a0 = R::load(e, i), a1 = R::load(e, i+P::size);
+			r0 = P::add(r0, P::mul(a0, a0));
+			r1 = P::add(r1, P::mul(a1, a1));
+		}
+		for(; i+P::size <= n; i += P::size) {
+			const type a0 = R::load(e, i);
+			r0 = P::add(r0, P::mul(a0, a0));
+		}
+		T r = P::hsum(P::add(r0, r1));
+		for(; i < n; ++i) {
+			const T a = R::at(e, i);
+			r += a*a;
+		}
+		return r;
+	}
+	static T max(const E &e) {
+		const idx_type n = e.size();
+		assert(n > 0);
+		if(n < P::size) return reduce_elements<T, E, false>::max(e);
+		type r = R::load(e, 0);
+		idx_type i = P::size;
+		for(; i+P::size <= n; i += P::size)
+			r = P::max(r, R::load(e, i));
+		T rs = P::hmax(r);
+		for(; i < n; ++i) rs = std::max(rs, R::at(e, i));
+		return rs;
+	}
+	static T min(const E &e) {
+		const idx_type n = e.size();
+		assert(n > 0);
+		if(n < P::size) return reduce_elements<T, E, false>::min(e);
+		type r = R::load(e, 0);
+		idx_type i = P::size;
+		for(; i+P::size <= n; i += P::size)
+			r = P::min(r, R::load(e, i));
+		T rs = P::hmin(r);
+		for(; i < n; ++i) rs = std::min(rs, R::at(e, i));
+		return rs;
+	}
+};
+
+//! @brief inner product used by dot in operation.h
+template <typename T, typename E1, typename E2, typename ENABLE = void>
+struct reduce_dot
+{
+	static T apply(const E1 &e1, const E2 &e2) {
+		typename E1::const_iterator i1 = e1.begin(), end1 = e1.end();
+		typename E2::const_iterator i2 = e2.begin();
+		T r = 0;
+		for(; i1 != end1; ++i1, ++i2) r += (*i1)*(*i2);
+		return r;
+	}
+};
+
+template <typename T, typename E1, typename E2>
+struct reduce_dot<T, E1, E2,
+				  typename boost::enable_if_c<is_packet_expr_of<E1, T>::value
+											  && is_packet_expr_of<E2, T>::value>::type>
+{
+	static T apply(const E1 &e1, const E2 &e2) {
+		typedef packet_expr<E1> R1;
+		typedef packet_expr<E2> R2;
+		typedef packet<T> P;
+		typedef typename P::type type;
+		const idx_type n = e1.size();
+		type r0 = P::set1(0), r1 = P::set1(0);
+		idx_type i = 0;
+		for(; i+2*P::size <= n; i += 2*P::size) {
+			r0 = P::add(r0, P::mul(R1::load(e1, i), R2::load(e2, i)));
+			r1 = P::add(r1, P::mul(R1::load(e1, i+P::size), R2::load(e2, i+P::size)));
+		}
+		for(; i+P::size <= n; i += P::size)
+			r0 = P::add(r0, P::mul(R1::load(e1, i), R2::load(e2, i)));
+		T r = P::hsum(P::add(r0, r1));
+		for(; i < n; ++i) r += R1::at(e1, i)*R2::at(e2, i);
+		return r;
+	}
+};
+
+}	// namespace matrix
+}	// namespace zjucad
+
+#endif
@@ -21,6 +21,9 @@
 #pragma once
 
 #include "matrix_expression.h"
+#include "allocator.h"
+
+#include <boost/type_traits/has_trivial_constructor.hpp>
 
 #if defined __GNUC__
 	#include <bits/allocator.h>
@@ -53,6 +56,7 @@ public:
     // Construction and destruction
     unbounded_array ():size_ (0), data_ (0) {}
     unbounded_array (size_type size):size_ (0), data_(0){construct(size);}
+    unbounded_array (size_type size, uninitialized_t):size_ (0), data_(0){construct(size, uninitialized);}
     unbounded_array (const unbounded_array &a):
         size_ (0), data_ (0) {*this = a;}
     ~unbounded_array () {
@@ -62,12 +66,24 @@ public:
     // Resizing
     void resize (size_type size) {
         if (size != size_) {
-			destroy();
+			release(size);
 			construct(size);
         }
     }
+	//! @brief leave trivially constructible elements uninitialized
+    void resize (size_type size, uninitialized_t) {
+        if (size != size_) {
+			release(size);
+			construct(size, uninitialized);
+        }
+    }
 
     size_type size () const {return size_;}
+	//! @brief number of elements the storage can hold without
+	//! reallocation, larger than size only for allocators keeping it
+	size_type capacity () const {
+		return data_ ? allocator_capacity<A>::get(alloc_, size_) : 0;
+	}
 
     // Element access
     const_reference operator [] (size_type i) const {
@@ -82,7 +98,7 @@ public:
     // Assignment
     unbounded_array &operator = (const unbounded_array &a) {
         if (this != &a) {
-            resize (a.size_);
+            resize (a.size_, uninitialized);
 #if _MSC_VER // stupid vc stl checking
 			if(data_)
 #endif
@@ -102,6 +118,7 @@ public:
 		if (this != &a) {
 			std::swap (size_, a.size_);
 			std::swap (data_, a.data_);
+			std::swap (alloc_, a.alloc_);
 		}
 	}
 
@@ -110,18 +127,48 @@ public:
 	A alloc_;
 //protected: // cannot make friend template function in g++?
 	void construct(size_type size) {
-		assert(data_ == 0);
-		data_ = alloc_.allocate(size);
-		size_ = size;
+		allocate(size);
+		pointer data = data_;
+		for(size_type i = 0; i < size_; ++i, ++data)
+			alloc_.construct(data, value_type());
+	}
+	void construct(size_type size, uninitialized_t) {
+		allocate(size);
+		if(boost::has_trivial_constructor<value_type>::value)
+			return;
 		pointer data = data_;
 		for(size_type i = 0; i < size_; ++i, ++data)
 			alloc_.construct(data, value_type());
 	}
+	//! @brief get storage for size elements, reusing the kept block
+	void allocate(size_type size) {
+		assert(size_ == 0);
+		if(data_ == 0) {
+			data_ = alloc_.allocate(size);
+#ifdef ZJUCAD_MATRIX_COUNT_ALLOC
+			++alloc_count();
+#endif
+		}
+		size_ = size;
+	}
+	//! @brief destroy the elements, keep the storage only if the
+	//! allocator keeps capacity and it can hold size elements.
+	void release(size_type size) {
+		if(!allocator_capacity<A>::keep || capacity() < size) {
+			destroy();
+			return;
+		}
+		pointer data = data_;
+		for(size_type i = 0; i < size_; ++i, ++data)
+			alloc_.destroy(data);
+		size_ = 0;
+	}
 	void destroy(void) {
 		pointer data = data_;
 		for(size_type i = 0; i < size_; ++i, ++data)
 			alloc_.destroy(data);
-		alloc_.deallocate(data_, size_);
+		if(data_)
+			alloc_.deallocate(data_, capacity());
 		data_ = 0;
 		size_ = 0;
 	}
@@ -129,6 +176,50 @@ public:
 	//friend void read(IS &is, unbounded_array<T, A> &array);
 };
 
+//! @brief array of N elements on the stack, the storage of fixed
+//! size matrices.
+template <typename T, size_type N>
+class bounded_array {
+public:
+	typedef zjucad::matrix::size_type size_type;
+	typedef T value_type;
+	typedef const T &const_reference;
+	typedef T &reference;
+	typedef const T *const_pointer;
+	typedef T *pointer;
+
+	bounded_array():data_(){}
+	explicit bounded_array(uninitialized_t){}
+
+	void resize(size_type size) {assert(size == N);}
+	void resize(size_type size, uninitialized_t) {assert(size == N);}
+
+	size_type size () const {return N;}
+	size_type capacity () const {return N;}
+
+	const_reference operator [] (size_type i) const {
+		assert(i >= 0 && i < N);
+		return data_ [i];
+	}
+	reference operator [] (size_type i) {
+		assert(i >= 0 && i < N);
+		return data_ [i];
+	}
+
+	typedef const_pointer const_iterator;
+	const_iterator begin () const {return data_;}
+	const_iterator end () const {return data_ + N;}
+	typedef pointer iterator;
+	iterator begin () {return data_;}
+	iterator end () {return data_ + N;}
+
+	void swap (bounded_array<T, N> &a) {
+		std::swap_ranges(data_, data_+N, a.data_);
+	}
+
+	T data_[N];
+};
+
 template <typename OS, typename T, typename A>
 void write(OS &os, const unbounded_array<T, A> &array);
 template <typename IS, typename T, typename A>
@@ -168,9 +259,10 @@ struct is_simple_obj<T1> {\
 	}\
 	template <typename IS, typename T, typename A>\
 	static int read0(IS &is, unbounded_array<T, A> &array) {\
-		is.read((char *)&array.size_, sizeof(typename unbounded_array<T, A>::size_type));\
+		typename unbounded_array<T, A>::size_type size;\
+		is.read((char *)&size, sizeof(typename unbounded_array<T, A>::size_type));\
         if(is.fail())    return 1;\
-		array.data_ = array.alloc_.allocate(array.size_);\
+		array.construct(size, uninitialized);\
 		is.read((char *)array.data_, array.size_*sizeof(typename unbounded_array<T, A>::value_type));\
         if(is.fail())    return 1;\
         return 0;\
@@ -201,5 +293,23 @@ DEPRECATED int read(IS &is, unbounded_array<T, A> &array) {
 	return is_simple_obj<T>::read0(is, array);
 }
 
+//! @brief same layout as a simple obj unbounded_array on disk
+template <typename OS, typename T, size_type N>
+void write(OS &os, const bounded_array<T, N> &array) {
+	const size_type size = N;
+	os.write((const char *)&size, sizeof(size_type));
+	os.write((const char *)array.data_, N*sizeof(T));
+}
+
+template <typename IS, typename T, size_type N>
+int read(IS &is, bounded_array<T, N> &array) {
+	size_type size;
+	is.read((char *)&size, sizeof(size_type));
+	if(is.fail() || size != N)    return 1;
+	is.read((char *)array.data_, N*sizeof(T));
+	if(is.fail())    return 1;
+	return 0;
+}
+
 }	// namespace matrix
 }	// namespace zjucad